@@ -6,20 +6,67 @@
 
 QT       += core gui
 
-QMAKE_LFLAGS += -F /System/Library/Frameworks -F /System/Library/Frameworks/IOKit.framework -F /System/Library/Frameworks/CoreFoundation.framework
-LIBS += -framework IOKit -framework CoreFoundation
-
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 TARGET = TouchTest
 TEMPLATE = app
 
+CONFIG += c++11
+
 
 SOURCES += main.cpp\
         mainwindow.cpp \
-    touch_osx.cpp
+    framescheduler.cpp \
+    tiledcanvas.cpp \
+    touch_backend.cpp \
+    touch_broadcast.cpp \
+    touch_capture.cpp \
+    touch_frame.cpp \
+    touch_hid_descriptor.cpp \
+    touch_hid_device.cpp \
+    touch_hid_queue.cpp \
+    touch_history.cpp \
+    touch_latency.cpp \
+    touch_layout_cache.cpp \
+    touch_sim_device.cpp \
+    touch_stroke.cpp \
+    touch_stream.cpp \
+    touch_synth.cpp \
+    touch_trace.cpp
 
 HEADERS  += mainwindow.h \
-    touch_shared.h
+    touch_shared.h \
+    touch_backend.h \
+    touch_broadcast.h \
+    touch_capture.h \
+    touch_ring.h \
+    touch_clock.h \
+    touch_frame.h \
+    touch_hid_descriptor.h \
+    touch_hid_device.h \
+    touch_hid_queue.h \
+    touch_history.h \
+    touch_latency.h \
+    touch_layout_cache.h \
+    touch_sim_device.h \
+    touch_stroke.h \
+    touch_stream.h \
+    touch_synth.h \
+    touch_trace.h \
+    framescheduler.h \
+    tiledcanvas.h
 
 FORMS    += mainwindow.ui
+
+macx {
+    QMAKE_LFLAGS += -F /System/Library/Frameworks -F /System/Library/Frameworks/IOKit.framework -F /System/Library/Frameworks/CoreFoundation.framework
+    LIBS += -framework IOKit -framework CoreFoundation
+
+    SOURCES += touch_osx.cpp
+}
+
+linux {
+    SOURCES += touch_evdev.cpp
+    HEADERS += touch_evdev.h
+    LIBS += -lrt
+}
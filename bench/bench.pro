@@ -0,0 +1,37 @@
+#-------------------------------------------------
+#
+# End-to-end pipeline benchmark, from raw HID report to painted pixel.
+# Run on the offscreen platform: ./TouchBench [--replay FILE]
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = TouchBench
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ..
+
+SOURCES += touch_bench.cpp \
+    ../mainwindow.cpp \
+    ../framescheduler.cpp \
+    ../tiledcanvas.cpp \
+    ../touch_capture.cpp \
+    ../touch_frame.cpp \
+    ../touch_hid_descriptor.cpp \
+    ../touch_history.cpp \
+    ../touch_latency.cpp \
+    ../touch_stroke.cpp \
+    ../touch_synth.cpp \
+    ../touch_trace.cpp
+
+HEADERS  += ../mainwindow.h \
+    ../framescheduler.h \
+    ../tiledcanvas.h
+
+FORMS    += ../mainwindow.ui
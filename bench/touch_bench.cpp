@@ -0,0 +1,260 @@
+#include "mainwindow.h"
+#include <QApplication>
+
+#include <algorithm>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "touch_capture.h"
+#include "touch_clock.h"
+#include "touch_frame.h"
+#include "touch_hid_descriptor.h"
+#include "touch_synth.h"
+
+#define BENCH_SECONDS 2
+#define BENCH_FRAME_RATE 60
+
+static MainWindow *g_Window = 0;
+
+/* per-stage latency samples, in nanoseconds */
+struct Stage {
+    const char *name;
+    std::vector<uint64_t> samples;
+
+    explicit Stage(const char *n) : name(n) {}
+
+    uint64_t percentile(double p) {
+        if (samples.empty())
+            return 0;
+        size_t k = (size_t)(p * (samples.size() - 1));
+        std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+        return samples[k];
+    }
+};
+
+struct Bench {
+    Stage decode;       /* raw report through descriptor decode and frame assembly */
+    Stage submit;       /* MainWindow::submitFrames */
+    Stage paint;        /* paintEvent, including drawImage */
+    Stage latency;      /* report arrival to the end of the paint that shows it */
+    std::vector<uint64_t> unpainted;
+    unsigned long reports;
+    unsigned long contacts;
+    unsigned long frames;
+
+    Bench() : decode("decode"), submit("submit"), paint("paint"), latency("end-to-end"),
+        reports(0), contacts(0), frames(0) {}
+};
+
+static Bench *g_Bench = 0;
+static uint64_t g_SubmitStart = 0;
+
+extern "C" {
+    void submitTouchFrame(const struct TouchFrame *frames, size_t count) {
+        if (g_Window)
+            g_Window->submitFrames(frames, count);
+    }
+
+    /* version 1 entry point, one touching sample */
+    void submitTouch(struct TouchEvent ev) {
+        struct TouchFrame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.count = 1;
+        frame.fields = TOUCH_FIELD_POSITION | TOUCH_FIELD_CONTACT_ID;
+        frame.device = ev.device;
+        frame.contacts[0].id = ev.idx;
+        frame.contacts[0].x = ev.x;
+        frame.contacts[0].y = ev.y;
+        frame.contacts[0].flags = TOUCH_CONTACT_TIP;
+        if (ev.hostTime) {
+            frame.fields |= TOUCH_FIELD_HOST_TIME;
+            frame.hostTime = ev.hostTime;
+        }
+        submitTouchFrame(&frame, 1);
+    }
+
+    /* the window asks, but the bench feeds it without a backend */
+    int queryTouchDrops(struct TouchDropCounts *drops) {
+        memset(drops, 0, sizeof(*drops));
+        return 0;
+    }
+}
+
+static void AssembledFrame(const struct TouchFrame *frame, void *)
+{
+    uint64_t start = touchMonotonicNs();
+    g_Bench->decode.samples.push_back(start - g_SubmitStart);
+    submitTouchFrame(frame, 1);
+    g_Bench->submit.samples.push_back(touchMonotonicNs() - start);
+    g_Bench->contacts += frame->count;
+    g_Bench->frames++;
+}
+
+static void present(Bench *bench)
+{
+    uint64_t start = touchMonotonicNs();
+    g_Window->repaint();
+    uint64_t end = touchMonotonicNs();
+
+    bench->paint.samples.push_back(end - start);
+    for (size_t i = 0; i < bench->unpainted.size(); i++)
+        bench->latency.samples.push_back(end - bench->unpainted[i]);
+    bench->unpainted.clear();
+}
+
+static void report(const char *scenario, Bench *bench, uint64_t wall)
+{
+    double seconds = wall / 1e9;
+
+    printf("%-18s %9.0f reports/s %10.0f events/s %8.0f frames/s\n",
+           scenario,
+           bench->reports / seconds,
+           bench->contacts / seconds,
+           bench->paint.samples.size() / seconds);
+
+    Stage *stages[] = { &bench->decode, &bench->submit, &bench->paint, &bench->latency };
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+        Stage *stage = stages[i];
+        printf("    %-12s p50 %9.2f us  p99 %9.2f us  p999 %9.2f us\n",
+               stage->name,
+               stage->percentile(0.5) / 1e3,
+               stage->percentile(0.99) / 1e3,
+               stage->percentile(0.999) / 1e3);
+    }
+}
+
+/*
+ * Feeds rate reports per second of synthetic device time through decode,
+ * assembly and submitFrames, presenting at BENCH_FRAME_RATE of device time.
+ * Device time runs as fast as the pipeline allows.
+ */
+static void runSynthetic(int contacts, int rate)
+{
+    TouchSynth synth(contacts);
+    HidReportLayout layout;
+    TouchFrameAssembler assembler(AssembledFrame, 0);
+    Bench bench;
+    uint8_t buffer[256];
+    char name[64];
+
+    if (!layout.parse(synth.descriptor().data(), synth.descriptor().size())) {
+        fprintf(stderr, "synthetic descriptor did not parse\n");
+        return;
+    }
+
+    g_Bench = &bench;
+    uint64_t period = 1000000000ull / rate;
+    uint64_t framePeriod = 1000000000ull / BENCH_FRAME_RATE;
+    uint64_t nextFrame = framePeriod;
+    unsigned long total = (unsigned long)rate * BENCH_SECONDS;
+    uint64_t begin = touchMonotonicNs();
+
+    for (unsigned long n = 0; n < total; n++) {
+        uint64_t t = n * period;
+        struct TouchFrame frame;
+
+        synth.frameAt(t, &frame);
+        size_t length = synth.encode(&frame, buffer, sizeof(buffer));
+
+        g_SubmitStart = touchMonotonicNs();
+        bench.unpainted.push_back(g_SubmitStart);
+        layout.decode(buffer, length, assembler);
+        bench.reports++;
+
+        if (t >= nextFrame) {
+            present(&bench);
+            nextFrame += framePeriod;
+        }
+    }
+    present(&bench);
+
+    snprintf(name, sizeof(name), "%d contacts %d Hz", contacts, rate);
+    report(name, &bench, touchMonotonicNs() - begin);
+    g_Bench = 0;
+}
+
+/* replays a capture as fast as possible, presenting at its recorded frame rate */
+static void runReplay(const char *path)
+{
+    TouchCaptureReader reader;
+    Bench bench;
+    struct TouchFrame frame;
+    uint64_t stamp;
+
+    if (!reader.open(path)) {
+        fprintf(stderr, "cannot open capture %s\n", path);
+        return;
+    }
+
+    g_Bench = &bench;
+    uint64_t framePeriod = 1000000000ull / BENCH_FRAME_RATE;
+    uint64_t nextFrame = framePeriod;
+    uint64_t begin = touchMonotonicNs();
+
+    while (reader.next(&frame, &stamp)) {
+        g_SubmitStart = touchMonotonicNs();
+        bench.unpainted.push_back(g_SubmitStart);
+        AssembledFrame(&frame, 0);
+        bench.reports++;
+
+        if (stamp >= nextFrame) {
+            present(&bench);
+            nextFrame += framePeriod;
+        }
+    }
+    present(&bench);
+
+    report("replay", &bench, touchMonotonicNs() - begin);
+    g_Bench = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication a(argc, argv);
+    const char *replay = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+            replay = argv[++i];
+        }
+        else {
+            fprintf(stderr, "usage: %s [--replay FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    static const int contacts[] = { 1, 5, 10 };
+    static const int rates[] = { 125, 240, 1000 };
+
+    if (replay) {
+        MainWindow w;
+        g_Window = &w;
+        w.resize(TOUCH_SCREEN_WIDTH, TOUCH_SCREEN_HEIGHT);
+        w.show();
+        a.processEvents();
+        runReplay(replay);
+        g_Window = 0;
+        return 0;
+    }
+
+    for (size_t c = 0; c < sizeof(contacts) / sizeof(contacts[0]); c++) {
+        for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+            /* a fresh window per scenario, so history from the last one does not count */
+            MainWindow w;
+            g_Window = &w;
+            w.resize(TOUCH_SCREEN_WIDTH, TOUCH_SCREEN_HEIGHT);
+            w.show();
+            a.processEvents();
+            runSynthetic(contacts[c], rates[r]);
+            g_Window = 0;
+        }
+    }
+
+    return 0;
+}
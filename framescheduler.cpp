@@ -0,0 +1,87 @@
+#include "framescheduler.h"
+
+#include "touch_clock.h"
+
+FrameScheduler::FrameScheduler(QWidget *target, QObject *parent) :
+    QObject(parent),
+    _target(target),
+    _rate(0),
+    _intervalNs(0),
+    _scheduled(false),
+    _pendingSince(0),
+    _inputs(0),
+    _inFlightSince(0),
+    _lastPresent(0),
+    _frames(0),
+    _lastLatency(0),
+    _maxLatency(0),
+    _latencySum(0),
+    _latencySamples(0)
+{
+    _timer.setSingleShot(true);
+    connect(&_timer, SIGNAL(timeout()), this, SLOT(fire()));
+    setMaxRate(FRAME_RATE_DEFAULT);
+}
+
+void FrameScheduler::setMaxRate(int hz)
+{
+    if (hz <= 0)
+        hz = FRAME_RATE_DEFAULT;
+    _rate = hz;
+    _intervalNs = 1000000000ull / hz;
+}
+
+void FrameScheduler::notifyInput()
+{
+    _inputs.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t expected = 0;
+    _pendingSince.compare_exchange_strong(expected, touchMonotonicNs(),
+                                          std::memory_order_relaxed);
+
+    /* only the first input of a frame has to wake up the GUI thread */
+    if (!_scheduled.exchange(true, std::memory_order_acq_rel))
+        QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);
+}
+
+void FrameScheduler::schedule()
+{
+    if (_timer.isActive())
+        return;
+
+    uint64_t now = touchMonotonicNs();
+    uint64_t due = _lastPresent + _intervalNs;
+    int delayMs = 0;
+    if (due > now)
+        delayMs = (int)((due - now + 999999) / 1000000);
+    _timer.start(delayMs);
+}
+
+void FrameScheduler::fire()
+{
+    /* inputs arriving from here on belong to the next frame */
+    _scheduled.store(false, std::memory_order_release);
+    uint64_t since = _pendingSince.exchange(0, std::memory_order_relaxed);
+    if (since && (!_inFlightSince || since < _inFlightSince))
+        _inFlightSince = since;
+    emit frameDue();
+    if (_target)
+        _target->update();
+}
+
+void FrameScheduler::framePresented()
+{
+    uint64_t now = touchMonotonicNs();
+    _lastPresent = now;
+    _frames++;
+
+    if (_inFlightSince) {
+        uint64_t latency = now - _inFlightSince;
+        _lastLatency = latency;
+        if (latency > _maxLatency)
+            _maxLatency = latency;
+        _latencySum += latency;
+        _latencySamples++;
+        _inFlightSince = 0;
+    }
+}
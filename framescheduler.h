@@ -0,0 +1,70 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QWidget>
+
+#include <atomic>
+#include <stdint.h>
+
+#define FRAME_RATE_DEFAULT 120
+
+/*
+ * Coalesces input into at most one update() per frame.
+ *
+ * notifyInput() may be called from any thread, any number of times per
+ * frame; once the current frame interval has elapsed frameDue() is
+ * emitted and the target widget, if any, is asked to repaint. Widgets that
+ * repaint only part of themselves pass no target and call update() from
+ * frameDue(). The widget reports back from paintEvent() through
+ * framePresented(), which closes the input-to-present latency sample.
+ */
+class FrameScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FrameScheduler(QWidget *target, QObject *parent = 0);
+
+    void setMaxRate(int hz);
+    int maxRate() const { return _rate; }
+
+    void notifyInput();
+    void framePresented();
+
+    unsigned long framesPresented() const { return _frames; }
+    unsigned long inputsReceived() const { return _inputs.load(std::memory_order_relaxed); }
+    uint64_t lastLatencyNs() const { return _lastLatency; }
+    uint64_t maxLatencyNs() const { return _maxLatency; }
+    uint64_t averageLatencyNs() const { return _latencySamples ? _latencySum / _latencySamples : 0; }
+
+signals:
+    void frameDue();
+
+private slots:
+    void schedule();
+    void fire();
+
+private:
+    QWidget *_target;
+    QTimer _timer;
+    int _rate;
+    uint64_t _intervalNs;
+
+    /* shared with the input side */
+    std::atomic<bool> _scheduled;
+    std::atomic<uint64_t> _pendingSince;
+    std::atomic<unsigned long> _inputs;
+
+    /* GUI thread only */
+    uint64_t _inFlightSince;
+    uint64_t _lastPresent;
+    unsigned long _frames;
+    uint64_t _lastLatency;
+    uint64_t _maxLatency;
+    uint64_t _latencySum;
+    unsigned long _latencySamples;
+};
+
+#endif // FRAMESCHEDULER_H
@@ -1,25 +1,268 @@
 #include "mainwindow.h"
 #include <QApplication>
+#include <QCoreApplication>
+#include <QScopedPointer>
+#include <QTimer>
 
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "touch_broadcast.h"
 #include "touch_shared.h"
+#include "touch_stream.h"
+#include "touch_trace.h"
+
+/* how often a headless run looks for a signal or the end of a replay */
+#define HEADLESS_POLL_MS 100
 
 static MainWindow *g_Window = 0;
+static TouchStreamWriter *g_Stream = 0;
+static volatile sig_atomic_t g_Quit = 0;
 
-int main(int argc, char *argv[])
+static void onSignal(int)
+{
+    g_Quit = 1;
+}
+
+static void onToggleTrace(int)
+{
+    touchTraceEnable(!touchTraceEnabled());
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--record FILE] [--replay FILE [--speed N]] [--shm NAME]\n"
+            "          [--trace FILE] [--trace-json FILE]\n"
+            "          [--headless [--output FILE] [--format binary|ndjson] [--block|--drop]]\n"
+            "  --record FILE   write every touch frame to FILE\n"
+            "  --replay FILE   play FILE back instead of opening a device\n"
+            "  --speed N       replay at N times real time, 0 for as fast as possible\n"
+            "  --shm NAME      publish frames to local readers through shared memory NAME,\n"
+            "                  e.g. " TOUCH_BROADCAST_NAME "\n"
+            "  --trace FILE    log the input path and save the log to FILE on exit,\n"
+            "                  SIGUSR1 toggles logging; read FILE with TouchTraceDump\n"
+            "  --trace-json FILE\n"
+            "                  the same as a Chrome trace, also written by Ctrl+Shift+T\n"
+            "  --headless      no window, stream frames to the output until interrupted\n"
+            "                  or the replay ends\n"
+            "  --output FILE   where a headless run writes frames, - for stdout (default)\n"
+            "  --format F      binary, the capture file layout (default), or ndjson\n"
+            "  --block         hold up acquisition while the output lags behind\n"
+            "  --drop          drop frames while the output lags behind (default)\n",
+            name);
+}
+
+static bool isHeadless(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--headless"))
+            return true;
+    }
+    return false;
+}
+
+/* streams every frame to output until a signal arrives or the replay ends */
+static int runHeadless(const char *record, const char *replay, double speed,
+                       const char *output, TouchStreamFormat format, TouchStreamPolicy policy)
+{
+    TouchStreamWriter stream;
+    if (!stream.open(output, format, policy)) {
+        fprintf(stderr, "cannot write to %s\n", output);
+        return 1;
+    }
+    g_Stream = &stream;
+
+    if (record && !startTouchCapture(record)) {
+        fprintf(stderr, "cannot record to %s\n", record);
+    }
+    if (replay) {
+        selectTouchReplay(replay, speed);
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    /* a reader that goes away shows up as a failed stream instead */
+    signal(SIGPIPE, SIG_IGN);
+
+    requestTouchFields(TOUCH_FIELDS_ALL);
+    startTouchLoop();
+
+    int ret = 0;
+    if (touchLoopFinished() && !replay) {
+        fprintf(stderr, "no touch device found\n");
+        ret = 1;
+    }
+    else {
+        /* the timer only makes sure the loop wakes up to look at the flags */
+        QTimer poll;
+        poll.start(HEADLESS_POLL_MS);
+        while (!g_Quit && !touchLoopFinished() && !stream.failed())
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+
+    struct TouchDropCounts drops;
+    bool haveDrops = queryTouchDrops(&drops) && drops.overflows;
+
+    stopTouchLoop();
+    stopTouchCapture();
+    g_Stream = 0;
+    stream.close();
+
+    fprintf(stderr, "%lu frames written, %lu dropped, %lu waits for the output%s\n",
+            stream.written(), stream.dropped(), stream.waits(),
+            stream.failed() ? ", output failed" : "");
+    if (haveDrops)
+        fprintf(stderr, "device queues overflowed %lu times, about %lu reports and %lu values lost%s\n",
+                drops.overflows, drops.lostReports, drops.lostElements,
+                drops.fallbacks ? ", fell back to raw reports" : "");
+    return ret;
+}
+
+/* the interactive window, until it is closed */
+static int runWindow(QCoreApplication *app, const char *record, const char *replay, double speed,
+                     bool broadcast, const char *traceJson)
 {
-    QApplication a(argc, argv);
     MainWindow w;
     g_Window = &w;
+    if (traceJson) {
+        w.setTraceExportPath(QString::fromLocal8Bit(traceJson));
+    }
     w.show();
+
+    if (record && !startTouchCapture(record)) {
+        fprintf(stderr, "cannot record to %s\n", record);
+    }
+    if (replay) {
+        selectTouchReplay(replay, speed);
+    }
+
+    /* the window draws touching contacts and tracks their latency, captures and readers keep everything */
+    requestTouchFields(record || broadcast ? TOUCH_FIELDS_ALL
+                                           : TOUCH_FIELD_POSITION | TOUCH_FIELD_TIP | TOUCH_FIELD_CONTACT_ID
+                                             | TOUCH_FIELD_DEVICE_TIME | TOUCH_FIELD_HOST_TIME);
     startTouchLoop();
 
-    return a.exec();
+    int ret = app->exec();
+    stopTouchLoop();
+    stopTouchCapture();
+    g_Window = 0;
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    /* a headless run never touches a widget, so it gets by without a GUI */
+    bool headless = isHeadless(argc, argv);
+    QScopedPointer<QCoreApplication> a(headless ? new QCoreApplication(argc, argv)
+                                                : new QApplication(argc, argv));
+    const char *record = 0;
+    const char *replay = 0;
+    const char *shm = 0;
+    const char *trace = 0;
+    const char *traceJson = 0;
+    const char *output = "-";
+    TouchStreamFormat format = TouchStreamBinary;
+    TouchStreamPolicy policy = TouchStreamDrop;
+    double speed = 1.0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+            record = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+            replay = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--speed") && i + 1 < argc) {
+            speed = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--shm") && i + 1 < argc) {
+            shm = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            trace = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--trace-json") && i + 1 < argc) {
+            traceJson = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--headless")) {
+        }
+        else if (!strcmp(argv[i], "--output") && i + 1 < argc) {
+            output = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--format") && i + 1 < argc && !strcmp(argv[i + 1], "binary")) {
+            format = TouchStreamBinary;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--format") && i + 1 < argc && !strcmp(argv[i + 1], "ndjson")) {
+            format = TouchStreamNdjson;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--block")) {
+            policy = TouchStreamBlock;
+        }
+        else if (!strcmp(argv[i], "--drop")) {
+            policy = TouchStreamDrop;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (shm && !startTouchBroadcast(shm)) {
+        fprintf(stderr, "cannot publish to %s\n", shm);
+    }
+    if (trace || traceJson) {
+        touchTraceEnable(true);
+        signal(SIGUSR1, onToggleTrace);
+    }
+
+    int ret;
+    if (headless) {
+        ret = runHeadless(record, replay, speed, output, format, policy);
+    }
+    else {
+        ret = runWindow(a.data(), record, replay, speed, shm != 0, traceJson);
+    }
+
+    stopTouchBroadcast();
+    if (trace && !touchTraceSave(trace)) {
+        fprintf(stderr, "cannot save the trace to %s\n", trace);
+    }
+    if (traceJson && !touchTraceSaveChrome(traceJson)) {
+        fprintf(stderr, "cannot save the trace to %s\n", traceJson);
+    }
+    return ret;
 }
 
 extern "C" {
+    void submitTouchFrame(const struct TouchFrame *frames, size_t count) {
+        if (g_Stream) {
+            g_Stream->submit(frames, count);
+        }
+        else if (g_Window) {
+            g_Window->submitFrames(frames, count);
+        }
+    }
+
+    /* version 1 entry point, one touching sample */
     void submitTouch(struct TouchEvent ev) {
-        if (g_Window) {
-            g_Window->submitEvent(ev);
+        struct TouchFrame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.count = 1;
+        frame.fields = TOUCH_FIELD_POSITION | TOUCH_FIELD_CONTACT_ID;
+        frame.device = ev.device;
+        frame.contacts[0].id = ev.idx;
+        frame.contacts[0].x = ev.x;
+        frame.contacts[0].y = ev.y;
+        frame.contacts[0].flags = TOUCH_CONTACT_TIP;
+        if (ev.hostTime) {
+            frame.fields |= TOUCH_FIELD_HOST_TIME;
+            frame.hostTime = ev.hostTime;
         }
+        submitTouchFrame(&frame, 1);
     }
 }
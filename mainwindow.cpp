@@ -2,87 +2,313 @@
 #include "ui_mainwindow.h"
 
 #include <QPainter>
+#include <QShortcut>
+#include <QStatusBar>
 
-#define NUM_TOUCHES 10
+#include "touch_clock.h"
+#include "touch_trace.h"
 
-static const QImage::Format ImageFormat = QImage::Format_RGB32;
+#define LATENCY_REFRESH_MS 1000
+#define STROKE_WIDTH 4.0f
+
+/* history replay into newly exposed tiles runs in slices of this length */
+#define REPLAY_SLICE_NS 4000000ull
+
+/* samples read from the history at a time */
+#define HISTORY_BATCH 256
+
+#define HISTORY_DEFAULT_MAX_BYTES (128 * 1024 * 1024)
+#define HISTORY_SIMPLIFY_AFTER_NS 10000000000ull
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
-    _image(new QImage(size(), ImageFormat)),
-    _mutex(new QMutex()),
+    _canvas(size()),
+    _rasterized(0),
+    _presented(0),
+    _dequeued(0),
+    _replaying(false),
+    _replayed(0),
+    _scheduler(new FrameScheduler(0, this)),
+    _traceExportPath("touch-trace.json"),
     ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    _canvas.fill(QColor(Qt::gray).rgb());
+
+    QByteArray rate = qgetenv("TOUCH_FRAME_RATE");
+    if (!rate.isEmpty()) {
+        _scheduler->setMaxRate(rate.toInt());
+    }
+
+    QByteArray limit = qgetenv("TOUCH_CANVAS_LIMIT_MB");
+    if (!limit.isEmpty()) {
+        _canvas.setResidentLimit((size_t)limit.toInt() * 1024 * 1024);
+    }
+
+    /* TOUCH_HISTORY_MAX_AGE is in seconds, TOUCH_HISTORY_SIMPLIFY in pixels */
+    struct TouchHistoryPolicy policy;
+    policy.maxAgeNs = qgetenv("TOUCH_HISTORY_MAX_AGE").toInt() * 1000000000ull;
+    policy.maxEvents = qgetenv("TOUCH_HISTORY_MAX_EVENTS").toInt();
+    policy.maxBytes = HISTORY_DEFAULT_MAX_BYTES;
+    policy.simplifyError = qgetenv("TOUCH_HISTORY_SIMPLIFY").toFloat();
+    policy.simplifyAfterNs = HISTORY_SIMPLIFY_AFTER_NS;
+    QByteArray bytes = qgetenv("TOUCH_HISTORY_MAX_MB");
+    if (!bytes.isEmpty()) {
+        policy.maxBytes = (size_t)bytes.toInt() * 1024 * 1024;
+    }
+    _history.setPolicy(policy);
+
+    connect(_scheduler, SIGNAL(frameDue()), this, SLOT(renderFrame()));
+    connect(&_statsTimer, SIGNAL(timeout()), this, SLOT(showLatency()));
+    connect(&_replayTimer, SIGNAL(timeout()), this, SLOT(replayStep()));
+    connect(new QShortcut(QKeySequence("Ctrl+Shift+T"), this), SIGNAL(activated()),
+            this, SLOT(exportTrace()));
+    _replayTimer.setSingleShot(true);
+    _statsTimer.start(LATENCY_REFRESH_MS);
 }
 
 MainWindow::~MainWindow()
 {
-    delete _image;
-    delete _mutex;
     delete ui;
 }
 
-void MainWindow::paintEvent(QPaintEvent *)
+bool MainWindow::strokeFor(const struct TouchEvent &ev, StrokeBuilder &builder,
+                           struct StrokeSegment *segment) const
+{
+    if (!builder.add(ev, STROKE_WIDTH, segment))
+        return false;
+
+    float dx = -(this->pos().x());
+    float dy = -(this->pos().y());
+    segment->x0 += dx;
+    segment->y0 += dy;
+    segment->x1 += dx;
+    segment->y1 += dy;
+    segment->color = 0xff * !!(ev.idx & 1)
+            + 0xff00 * !!(ev.idx & 2)
+            + 0xff0000 * !!(ev.idx & 4);
+    return true;
+}
+
+/*
+ * Drains the input ring, bins the new stroke segments and rasterizes them
+ * into the canvas. Returns the area that has to be repainted.
+ */
+QRegion MainWindow::renderPending()
+{
+    uint64_t dequeued = touchMonotonicNs();
+    size_t drained = 0;
+    for (int d = 0; d < TOUCH_MAX_DEVICES; d++) {
+        drained += _rings[d].drain([this, dequeued](const TouchEvent &ev) {
+            if (ev.deviceTime && ev.deviceTime <= ev.hostTime)
+                touchLatency(TouchLatencyDevice).record(ev.hostTime - ev.deviceTime);
+            touchLatency(TouchLatencyQueue).record(dequeued - ev.hostTime);
+            _history.append(ev);
+        });
+    }
+    if (drained && !_dequeued)
+        _dequeued = dequeued;
+
+    TOUCH_TRACE_SCOPE(TraceStageRasterize);
+
+    /* _canvas already holds everything below the watermark */
+    struct TouchEvent batch[HISTORY_BATCH];
+    size_t count;
+    while ((count = _history.read(_rasterized, batch, HISTORY_BATCH))) {
+        for (size_t i = 0; i < count; i++) {
+            struct StrokeSegment segment;
+            if (strokeFor(batch[i], _strokes, &segment))
+                _canvas.addSegment(segment);
+        }
+    }
+
+    if (drained)
+        _history.enforce(dequeued);
+
+    _canvas.render();
+    return _canvas.takeDirty();
+}
+
+unsigned long MainWindow::droppedEvents() const
+{
+    unsigned long dropped = 0;
+    for (int d = 0; d < TOUCH_MAX_DEVICES; d++)
+        dropped += _rings[d].overflowCount();
+    return dropped;
+}
+
+void MainWindow::renderFrame()
+{
+    QRegion dirty = renderPending();
+    if (!dirty.isEmpty())
+        update(dirty);
+}
+
+void MainWindow::paintEvent(QPaintEvent *event)
 {
-    QMutexLocker lock(_mutex);
+    /* direct repaint() calls skip renderFrame() */
+    QRegion missed = renderPending() - event->region();
+    if (!missed.isEmpty())
+        update(missed);
+
     QPainter painter(this);
-    int dx = -(this->pos().x());
-    int dy = -(this->pos().y());
-    int w = _image->width();
-    int h = _image->height();
-    uchar* bits = _image->bits();
-    size_t bpl = _image->bytesPerLine();
-    foreach(TouchEvent ev, _events) {
-        int x = (ev.x + dx) % w;
-        int y = ((ev.y + dy) % h);
-        int color = 0xff * !!(ev.idx & 1)
-                + 0xff00 * !!(ev.idx & 2)
-                + 0xff0000 * !!(ev.idx & 4);
-
-        uchar *line = bits + bpl * y;
-        ((unsigned*)line)[x] = color;
+    {
+        TOUCH_TRACE_SCOPE(TraceStagePaint);
+        _canvas.paint(painter, event->region());
+    }
+    _scheduler->framePresented();
+
+    uint64_t presented = touchMonotonicNs();
+    struct TouchEvent batch[HISTORY_BATCH];
+    size_t count;
+    while ((count = _history.read(_presented, batch, HISTORY_BATCH))) {
+        for (size_t i = 0; i < count; i++) {
+            touchLatency(TouchLatencyPresent).record(presented - _dequeued);
+            touchLatency(TouchLatencyTotal).record(presented - batch[i].hostTime);
+        }
+    }
+    _dequeued = 0;
+}
+
+QString MainWindow::latencySummary() const
+{
+    QString summary;
+    for (int stage = 0; stage < TouchLatencyStageCount; stage++) {
+        const LatencyHistogram &histogram = touchLatency((TouchLatencyStage)stage);
+        if (!histogram.count())
+            continue;
+        summary += QString("%1 p50 %2 p99 %3 max %4 ms  ")
+                .arg(touchLatencyStageName((TouchLatencyStage)stage))
+                .arg(histogram.percentile(0.5) / 1e6, 0, 'f', 2)
+                .arg(histogram.percentile(0.99) / 1e6, 0, 'f', 2)
+                .arg(histogram.max() / 1e6, 0, 'f', 2);
     }
+    summary += QString("dropped %1").arg(droppedEvents());
 
-    painter.drawImage(0, 0, *_image);
+    struct TouchDropCounts drops;
+    if (queryTouchDrops(&drops) && drops.overflows)
+        summary += QString("  device lost %1 reports").arg(drops.lostReports);
+    return summary;
+}
+
+void MainWindow::showLatency()
+{
+    statusBar()->showMessage(latencySummary()
+            + QString("  canvas %1 tiles %2 MB, %3 packed %4 MB")
+            .arg(_canvas.residentTiles())
+            .arg(_canvas.residentBytes() / 1048576.0, 0, 'f', 1)
+            .arg(_canvas.compressedTiles())
+            .arg(_canvas.compressedBytes() / 1048576.0, 0, 'f', 1)
+            + QString("  history %1 samples %2 MB")
+            .arg((qint64)_history.size())
+            .arg(_history.bytes() / 1048576.0, 0, 'f', 1));
+}
+
+/*
+ * The first press starts tracing, later ones write what the trace buffers
+ * hold to the export path as a Chrome trace.
+ */
+void MainWindow::exportTrace()
+{
+    if (!touchTraceEnabled()) {
+        touchTraceEnable(true);
+        statusBar()->showMessage("tracing, Ctrl+Shift+T again to export");
+        return;
+    }
+
+    QByteArray path = _traceExportPath.toLocal8Bit();
+    if (touchTraceSaveChrome(path.constData()))
+        statusBar()->showMessage(QString("trace written to %1").arg(_traceExportPath));
+    else
+        statusBar()->showMessage(QString("cannot write the trace to %1").arg(_traceExportPath));
 }
 
 void MainWindow::resizeEvent(QResizeEvent *event) {
     QWidget::resizeEvent(event);
 
-    QMutexLocker lock(_mutex);
-    delete _image;
-    _image = new QImage(event->size(), ImageFormat);
-    _image->fill(Qt::gray);
+    /* tiles that still fit are kept, the rest is replayed from history */
+    _canvas.resize(event->size());
+    startReplay();
 }
 
-void MainWindow::submitEvent(struct TouchEvent ev) {
-    static int last_x[NUM_TOUCHES] = {
+/*
+ * Replays the history into the stale tiles, those in the visible part of
+ * the window first, one pass over the history per batch of tiles.
+ */
+void MainWindow::startReplay()
+{
+    if (_replaying || !_canvas.beginReplay(visibleRegion()))
+        return;
 
-    };
-    static int last_y[NUM_TOUCHES] = {
+    _replaying = true;
+    _replayed = _history.begin();
+    _replayStrokes.reset();
+    _replayTimer.start(0);
+}
 
-    };
+/* runs one time slice of the replay, live input keeps going in between */
+void MainWindow::replayStep()
+{
+    if (!_replaying)
+        return;
 
-    if (ev.x > 0) {
-        if (last_y[ev.idx] > 0) {
-            ev.y = last_y[ev.idx];
-            _events.append(ev);
-            last_y[ev.idx] = 0;
-        }
-        else {
-            last_x[ev.idx] = ev.x;
+    TOUCH_TRACE_SCOPE(TraceStageRasterize);
+
+    /* everything drained is rasterized right away, so _rasterized is the end */
+    uint64_t deadline = touchMonotonicNs() + REPLAY_SLICE_NS;
+    struct TouchEvent batch[HISTORY_BATCH];
+    size_t count;
+    while (_replayed < _rasterized
+           && (count = _history.read(_replayed, batch, HISTORY_BATCH))) {
+        for (size_t i = 0; i < count; i++) {
+            struct StrokeSegment segment;
+            if (strokeFor(batch[i], _replayStrokes, &segment))
+                _canvas.addSegment(segment, true);
         }
+        if (touchMonotonicNs() > deadline)
+            break;
+    }
+    _canvas.render();
+
+    if (_replayed >= _rasterized) {
+        _canvas.endReplay();
+        _replaying = false;
+        startReplay();
+    }
+    else {
+        _replayTimer.start(0);
     }
-    if (ev.y > 0) {
-        if (last_x[ev.idx] > 0) {
-            ev.x = last_x[ev.idx];
-            _events.append(ev);
-            last_y[ev.idx] = 0;
+
+    QRegion dirty = _canvas.takeDirty();
+    if (!dirty.isEmpty())
+        update(dirty);
+}
+
+void MainWindow::submitFrames(const struct TouchFrame *frames, size_t count) {
+    TOUCH_TRACE_SCOPE(TraceStageFrameAssembly);
+    uint64_t now = 0;
+    for (size_t f = 0; f < count; f++) {
+        const struct TouchFrame *frame = &frames[f];
+        TouchRing<TouchEvent, TOUCH_RING_SIZE> &ring = _rings[(unsigned)frame->device % TOUCH_MAX_DEVICES];
+
+        /* without tip switches every reported contact is touching */
+        unsigned touching = (frame->fields & TOUCH_FIELD_TIP) ? 0 : TOUCH_CONTACT_TIP;
+        uint64_t deviceTime = (frame->fields & TOUCH_FIELD_DEVICE_TIME) ? frame->deviceTime : 0;
+        uint64_t hostTime = frame->hostTime;
+        if (!(frame->fields & TOUCH_FIELD_HOST_TIME)) {
+            if (!now)
+                now = touchMonotonicNs();
+            hostTime = now;
         }
-        else {
-            last_y[ev.idx] = ev.y;
+
+        for (int i = 0; i < frame->count; i++) {
+            const struct TouchContact *contact = &frame->contacts[i];
+            struct TouchEvent ev = { contact->id, contact->x, contact->y,
+                                     contact->flags | touching, deviceTime, hostTime,
+                                     frame->device };
+            ring.push(ev);
         }
     }
-    repaint();
+    _scheduler->notifyInput();
 }
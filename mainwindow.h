@@ -2,14 +2,20 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
-#include <QList>
-#include <QImage>
+#include <QRegion>
+#include <QTimer>
 
-#include <QMutex>
-#include <QMutexLocker>
 #include <QResizeEvent>
 
 #include "touch_shared.h"
+#include "touch_ring.h"
+#include "framescheduler.h"
+#include "tiledcanvas.h"
+#include "touch_history.h"
+#include "touch_latency.h"
+#include "touch_stroke.h"
+
+#define TOUCH_RING_SIZE 4096
 
 namespace Ui {
 class MainWindow;
@@ -24,13 +30,50 @@ public:
     ~MainWindow();
 
     void paintEvent(QPaintEvent *);
-    void submitEvent(struct TouchEvent ev);
+    void submitFrames(const struct TouchFrame *frames, size_t count);
     void resizeEvent(QResizeEvent *);
 
+    unsigned long droppedEvents() const;
+    const TouchHistory &history() const { return _history; }
+    FrameScheduler *scheduler() const { return _scheduler; }
+    QString latencySummary() const;
+
+    /* where Ctrl+Shift+T writes the Chrome trace */
+    void setTraceExportPath(const QString &path) { _traceExportPath = path; }
+
+private slots:
+    void renderFrame();
+    void replayStep();
+    void showLatency();
+    void exportTrace();
+
 private:
-    QList<TouchEvent> _events;
-    QImage* _image;
-    QMutex* _mutex;
+    QRegion renderPending();
+    bool strokeFor(const struct TouchEvent &ev, StrokeBuilder &builder,
+                   struct StrokeSegment *segment) const;
+    void startReplay();
+
+    /*
+     * Written by the input side, drained by renderPending(). A ring has a
+     * single producer, so each device gets its own: devices may deliver
+     * from threads of their own, one device always from the same one.
+     */
+    TouchRing<TouchEvent, TOUCH_RING_SIZE> _rings[TOUCH_MAX_DEVICES];
+    TouchHistory _history;
+    TiledCanvas _canvas;
+    uint64_t _rasterized;   /* first sequence not yet in _canvas */
+    uint64_t _presented;    /* first sequence not yet on screen */
+    uint64_t _dequeued;     /* when the events from _presented on were drained */
+    StrokeBuilder _strokes;
+
+    /* replay of the history into tiles a resize added */
+    bool _replaying;
+    uint64_t _replayed;     /* next sequence to replay */
+    StrokeBuilder _replayStrokes;
+    QTimer _replayTimer;
+    FrameScheduler *_scheduler;
+    QTimer _statsTimer;
+    QString _traceExportPath;
     Ui::MainWindow *ui;
 };
 
@@ -0,0 +1,25 @@
+#-------------------------------------------------
+#
+# Sample consumer of the shared memory touch broadcast.
+# Start TouchTest --shm /touchtest, then ./TouchReader [--verbose]
+#
+#-------------------------------------------------
+
+TARGET = TouchReader
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += ..
+
+SOURCES += touch_reader.cpp \
+    ../touch_broadcast.cpp
+
+HEADERS += ../touch_broadcast.h \
+    ../touch_clock.h \
+    ../touch_shared.h
+
+linux {
+    LIBS += -lrt
+}
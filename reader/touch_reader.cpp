@@ -0,0 +1,99 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "touch_broadcast.h"
+#include "touch_clock.h"
+
+#define READER_WAIT_MS 100
+#define READER_REPORT_NS 1000000000ull
+
+static volatile sig_atomic_t g_Quit = 0;
+
+static void onSignal(int)
+{
+    g_Quit = 1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--verbose] [NAME]\n"
+            "  reads the touch frames TouchTest --shm NAME publishes, " TOUCH_BROADCAST_NAME " by default\n"
+            "  --verbose   print every frame, not just the rate\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = TOUCH_BROADCAST_NAME;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--verbose")) {
+            verbose = true;
+        }
+        else if (argv[i][0] != '-') {
+            name = argv[i];
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    TouchBroadcastReader reader;
+    unsigned long frames = 0;
+    unsigned long torn = 0;
+    uint64_t lost = 0;
+    uint64_t reported = touchMonotonicNs();
+
+    while (!g_Quit) {
+        /* the publisher may not be up yet or may have restarted */
+        if (reader.publisherClosed()) {
+            lost += reader.lost();
+            if (!reader.open(name)) {
+                reader.close();
+                struct timespec pause = { 0, READER_WAIT_MS * 1000000L };
+                nanosleep(&pause, 0);
+                continue;
+            }
+            fprintf(stderr, "reading %s\n", name);
+        }
+
+        reader.wait(READER_WAIT_MS);
+        while (const struct TouchFrame *frame = reader.acquire()) {
+            uint64_t now = touchMonotonicNs();
+            if (verbose) {
+                printf("%llu us:", (unsigned long long)(frame->fields & TOUCH_FIELD_HOST_TIME
+                                                        ? (now - frame->hostTime) / 1000 : 0));
+                for (int i = 0; i < frame->count && i < TOUCH_MAX_CONTACTS; i++)
+                    printf(" %d:%d,%d", frame->contacts[i].id, frame->contacts[i].x, frame->contacts[i].y);
+            }
+            if (reader.release()) {
+                frames++;
+                if (verbose)
+                    printf("\n");
+            }
+            else {
+                torn++;
+                if (verbose)
+                    printf(" (overwritten)\n");
+            }
+        }
+
+        uint64_t now = touchMonotonicNs();
+        if (now - reported >= READER_REPORT_NS) {
+            fprintf(stderr, "%lu frames/s, %llu lost, %lu overwritten while read\n", frames,
+                    (unsigned long long)(lost + reader.lost()), torn);
+            frames = 0;
+            reported = now;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# The shared memory broadcast, publisher and reader in one process.
+# ./TestBroadcast
+#
+#-------------------------------------------------
+
+TARGET = TestBroadcast
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += .. ../..
+
+SOURCES += test_broadcast.cpp \
+    ../../touch_broadcast.cpp
+
+HEADERS += ../touch_test.h \
+    ../../touch_broadcast.h
+
+linux {
+    LIBS += -lrt
+}
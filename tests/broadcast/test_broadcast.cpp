@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include "touch_broadcast.h"
+#include "touch_test.h"
+
+static char g_Name[64];
+
+/* frame n carries n in every contact, so a torn copy shows */
+static struct TouchFrame makeFrame(uint64_t n)
+{
+    struct TouchFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.count = TOUCH_MAX_CONTACTS;
+    frame.contactCount = TOUCH_MAX_CONTACTS;
+    for (int i = 0; i < TOUCH_MAX_CONTACTS; i++) {
+        frame.contacts[i].id = (int)n;
+        frame.contacts[i].x = (int)n;
+        frame.contacts[i].y = (int)n;
+    }
+    return frame;
+}
+
+static void publish(TouchBroadcastPublisher &publisher, uint64_t &next, size_t count)
+{
+    std::vector<struct TouchFrame> frames;
+    for (size_t i = 0; i < count; i++)
+        frames.push_back(makeFrame(next++));
+    publisher.publish(frames.data(), frames.size());
+}
+
+static bool intact(const struct TouchFrame &frame)
+{
+    for (int i = 0; i < TOUCH_MAX_CONTACTS; i++) {
+        if (frame.contacts[i].x != frame.contacts[0].id || frame.contacts[i].y != frame.contacts[0].id)
+            return false;
+    }
+    return frame.count == TOUCH_MAX_CONTACTS;
+}
+
+static void testInOrder()
+{
+    TouchBroadcastPublisher publisher;
+    CHECK(publisher.open(g_Name));
+    uint64_t next = 0;
+    publish(publisher, next, 5);
+
+    /* a reader starts at the newest frame */
+    TouchBroadcastReader reader;
+    CHECK(reader.open(g_Name));
+    CHECK_EQ(reader.pending(), 0);
+
+    publish(publisher, next, 10);
+    CHECK_EQ(reader.pending(), 10);
+    CHECK(reader.wait(0));
+
+    struct TouchFrame frames[16];
+    CHECK_EQ(reader.read(frames, 16), 10);
+    for (int i = 0; i < 10; i++)
+        CHECK_EQ(frames[i].contacts[0].id, 5 + i);
+    CHECK_EQ(reader.lost(), 0);
+    CHECK(!reader.wait(1));
+}
+
+/* a reader more than a ring behind picks up at the oldest frame still there */
+static void testLag()
+{
+    TouchBroadcastPublisher publisher;
+    CHECK(publisher.open(g_Name));
+    TouchBroadcastReader reader;
+    CHECK(reader.open(g_Name));
+
+    uint64_t next = 0;
+    publish(publisher, next, 100);
+    publish(publisher, next, TOUCH_BROADCAST_SLOTS);
+    CHECK_EQ(reader.pending(), TOUCH_BROADCAST_SLOTS + 100);
+
+    std::vector<struct TouchFrame> frames(TOUCH_BROADCAST_SLOTS + 100);
+    size_t n = reader.read(frames.data(), frames.size());
+    CHECK_EQ(n, TOUCH_BROADCAST_SLOTS);
+    CHECK_EQ(reader.lost(), 100);
+    for (size_t i = 0; i < n; i++)
+        CHECK_EQ(frames[i].contacts[0].id, 100 + (int)i);
+    CHECK_EQ(reader.pending(), 0);
+
+    /* back in step, nothing more is lost */
+    publish(publisher, next, 3);
+    CHECK_EQ(reader.read(frames.data(), frames.size()), 3);
+    CHECK_EQ(frames[0].contacts[0].id, TOUCH_BROADCAST_SLOTS + 100);
+    CHECK_EQ(reader.lost(), 100);
+}
+
+/* a frame overwritten while it is held is reported, and the cursor moves on */
+static void testOverwrittenWhileHeld()
+{
+    TouchBroadcastPublisher publisher;
+    CHECK(publisher.open(g_Name));
+    TouchBroadcastReader reader;
+    CHECK(reader.open(g_Name));
+
+    uint64_t next = 0;
+    publish(publisher, next, 2);
+    const struct TouchFrame *frame = reader.acquire();
+    CHECK(frame != 0);
+    CHECK(frame && frame->contacts[0].id == 0);
+
+    publish(publisher, next, TOUCH_BROADCAST_SLOTS);
+    CHECK(!reader.release());
+    CHECK_EQ(reader.lost(), 1);
+
+    /* frame 1 is gone as well; the next one read is the oldest left */
+    frame = reader.acquire();
+    CHECK(frame && frame->contacts[0].id == 2);
+    CHECK(reader.release());
+    CHECK_EQ(reader.lost(), 2);
+}
+
+/* a publisher thread racing a reader that keeps falling behind */
+static void testConcurrent()
+{
+    const uint64_t total = 50 * TOUCH_BROADCAST_SLOTS;
+    TouchBroadcastPublisher publisher;
+    CHECK(publisher.open(g_Name));
+    TouchBroadcastReader reader;
+    CHECK(reader.open(g_Name));
+
+    std::thread producer([&]() {
+        uint64_t next = 0;
+        while (next < total)
+            publish(publisher, next, 64);
+        publisher.close();
+    });
+
+    std::vector<struct TouchFrame> frames(TOUCH_BROADCAST_SLOTS);
+    uint64_t received = 0;
+    int last = -1;
+    bool ordered = true, whole = true;
+    for (;;) {
+        reader.wait(10);
+        size_t n = reader.read(frames.data(), frames.size());
+        for (size_t i = 0; i < n; i++) {
+            whole = whole && intact(frames[i]);
+            ordered = ordered && frames[i].contacts[0].id > last;
+            last = frames[i].contacts[0].id;
+        }
+        received += n;
+        if (!n && reader.publisherClosed())
+            break;
+    }
+    producer.join();
+
+    CHECK(whole);
+    CHECK(ordered);
+    CHECK_EQ(last, (int)total - 1);
+    CHECK_EQ(received + reader.lost(), total);
+}
+
+int main()
+{
+    snprintf(g_Name, sizeof(g_Name), "/touchtest-test-%d", (int)getpid());
+
+    testInOrder();
+    testLag();
+    testOverwrittenWhileHeld();
+    testConcurrent();
+    return TOUCH_TEST_RESULT();
+}
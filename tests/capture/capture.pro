@@ -0,0 +1,21 @@
+#-------------------------------------------------
+#
+# Capture files written, read back and replayed.
+# ./TestCapture
+#
+#-------------------------------------------------
+
+TARGET = TestCapture
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += .. ../..
+
+SOURCES += test_capture.cpp \
+    ../../touch_capture.cpp
+
+HEADERS += ../touch_test.h \
+    ../../touch_backend.h \
+    ../../touch_capture.h
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "touch_capture.h"
+#include "touch_test.h"
+
+static std::string g_Path;
+
+static struct TouchFrame makeFrame(int id, int x, int y)
+{
+    struct TouchFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.count = 2;
+    frame.contactCount = 1;
+    frame.device = id % 2;
+    frame.contacts[0].id = id;
+    frame.contacts[0].x = x;
+    frame.contacts[0].y = y;
+    frame.contacts[0].flags = TOUCH_CONTACT_TIP | TOUCH_CONTACT_IN_RANGE;
+    frame.contacts[1].id = id + 1;
+    frame.contacts[1].x = y;
+    frame.contacts[1].y = x;
+    return frame;
+}
+
+/* host stamps as they come in, one running backwards and one before the start */
+static const uint64_t Stamps[] = { 5000, 6000, 5500, 1000, 9000 };
+static const uint64_t Recorded[] = { 0, 1000, 1000, 1000, 4000 };
+#define FRAMES (sizeof(Stamps) / sizeof(Stamps[0]))
+
+static void writeCapture()
+{
+    TouchCaptureWriter writer;
+    CHECK(writer.open(g_Path.c_str()));
+    for (size_t i = 0; i < FRAMES; i++) {
+        struct TouchFrame frame = makeFrame((int)i, 10 * (int)i, 20 * (int)i);
+        CHECK(writer.write(&frame, Stamps[i]));
+    }
+    CHECK_EQ(writer.framesWritten(), FRAMES);
+    writer.close();
+}
+
+static void testRoundTrip()
+{
+    writeCapture();
+
+    TouchCaptureReader reader;
+    CHECK(reader.open(g_Path.c_str()));
+
+    struct TouchFrame frame;
+    uint64_t stamp = 0;
+    for (size_t i = 0; i < FRAMES; i++) {
+        CHECK(reader.next(&frame, &stamp));
+        CHECK_EQ(stamp, Recorded[i]);
+
+        struct TouchFrame written = makeFrame((int)i, 10 * (int)i, 20 * (int)i);
+        CHECK_EQ(frame.count, written.count);
+        CHECK_EQ(frame.contactCount, written.contactCount);
+        CHECK_EQ(frame.device, written.device);
+        CHECK(!memcmp(frame.contacts, written.contacts, sizeof(written.contacts[0]) * written.count));
+    }
+    CHECK(!reader.next(&frame, &stamp));
+
+    reader.rewind();
+    CHECK(reader.next(&frame, &stamp));
+    CHECK_EQ(stamp, 0);
+    CHECK_EQ(frame.contacts[0].id, 0);
+
+    /* the header holds the host time of the first frame */
+    FILE *file = fopen(g_Path.c_str(), "rb");
+    struct TouchCaptureHeader header;
+    CHECK(file && fread(&header, sizeof(header), 1, file) == 1);
+    if (file)
+        fclose(file);
+    CHECK_EQ(header.startTime, Stamps[0]);
+}
+
+static void testTruncated()
+{
+    writeCapture();
+    CHECK(truncate(g_Path.c_str(), sizeof(struct TouchCaptureHeader)
+                   + sizeof(struct TouchCaptureRecord) + sizeof(struct TouchCaptureContact)) == 0);
+
+    TouchCaptureReader reader;
+    CHECK(reader.open(g_Path.c_str()));
+    struct TouchFrame frame;
+    uint64_t stamp;
+    CHECK(!reader.next(&frame, &stamp));
+}
+
+struct Replayed {
+    std::mutex lock;
+    std::vector<struct TouchFrame> frames;
+};
+
+static void CollectFrames(const struct TouchFrame *frames, size_t count, void *context)
+{
+    struct Replayed *replayed = (struct Replayed *)context;
+    std::lock_guard<std::mutex> lock(replayed->lock);
+    replayed->frames.insert(replayed->frames.end(), frames, frames + count);
+}
+
+/* replays in recorded order at a given speed, and doesn't hang on the stamps */
+static void testReplay(double speed)
+{
+    writeCapture();
+
+    struct Replayed replayed;
+    TouchReplayBackend backend(g_Path.c_str(), speed);
+    backend.setFrameCallback(CollectFrames, &replayed);
+    CHECK(backend.start());
+
+    size_t got = 0;
+    for (int i = 0; i < 2000 && got < FRAMES; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::lock_guard<std::mutex> lock(replayed.lock);
+        got = replayed.frames.size();
+    }
+    backend.stop();
+
+    CHECK_EQ(replayed.frames.size(), FRAMES);
+    for (size_t i = 0; i < replayed.frames.size() && i < FRAMES; i++)
+        CHECK_EQ(replayed.frames[i].contacts[0].id, (int)i);
+}
+
+int main()
+{
+    char path[] = "/tmp/touch_capture_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    g_Path = path;
+
+    testRoundTrip();
+    testTruncated();
+    testReplay(0);
+    testReplay(1.0);
+
+    remove(g_Path.c_str());
+    return TOUCH_TEST_RESULT();
+}
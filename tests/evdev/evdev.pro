@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# The evdev protocol B state machine, fed through a pipe.
+# ./TestEvdev
+#
+#-------------------------------------------------
+
+TARGET = TestEvdev
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += .. ../..
+
+SOURCES += test_evdev.cpp \
+    ../../touch_evdev.cpp \
+    ../../touch_trace.cpp
+
+HEADERS += ../touch_test.h \
+    ../../touch_backend.h \
+    ../../touch_evdev.h
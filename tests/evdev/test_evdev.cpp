@@ -0,0 +1,216 @@
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "touch_evdev.h"
+#include "touch_test.h"
+
+/* an event stream as the kernel would send it, timestamped one report per ms */
+class Stream
+{
+public:
+    Stream() : _ms(0) {}
+
+    Stream &slot(int slot) { return abs(ABS_MT_SLOT, slot); }
+    Stream &id(int id) { return abs(ABS_MT_TRACKING_ID, id); }
+    Stream &x(int x) { return abs(ABS_MT_POSITION_X, x); }
+    Stream &y(int y) { return abs(ABS_MT_POSITION_Y, y); }
+    Stream &report() { event(EV_SYN, SYN_REPORT, 0); _ms++; return *this; }
+    Stream &dropped() { return event(EV_SYN, SYN_DROPPED, 0); }
+
+    const std::vector<struct input_event> &events() const { return _events; }
+
+private:
+    Stream &abs(int code, int value) { return event(EV_ABS, code, value); }
+
+    Stream &event(int type, int code, int value) {
+        struct input_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.time.tv_sec = _ms / 1000;
+        ev.time.tv_usec = (_ms % 1000) * 1000;
+        ev.type = type;
+        ev.code = code;
+        ev.value = value;
+        _events.push_back(ev);
+        return *this;
+    }
+
+    std::vector<struct input_event> _events;
+    long _ms;
+};
+
+static void CollectFrames(const struct TouchFrame *frames, size_t count, void *context)
+{
+    std::vector<struct TouchFrame> *out = (std::vector<struct TouchFrame> *)context;
+    out->insert(out->end(), frames, frames + count);
+}
+
+/*
+ * Runs stream through the reader thread of a backend on a pipe, written
+ * a few bytes at a time so records arrive split.
+ */
+static std::vector<struct TouchFrame> run(const Stream &stream, struct TouchDropCounts *drops = 0)
+{
+    std::vector<struct TouchFrame> frames;
+    int fds[2] = { -1, -1 };
+    CHECK(pipe(fds) == 0);
+    if (fds[0] < 0)
+        return frames;
+
+    EvdevTouchBackend backend(fds[0], true);
+    backend.setFrameCallback(CollectFrames, &frames);
+    CHECK(backend.start());
+
+    const char *bytes = (const char *)stream.events().data();
+    size_t length = stream.events().size() * sizeof(struct input_event);
+    for (size_t done = 0; done < length; ) {
+        ssize_t n = write(fds[1], bytes + done, std::min(length - done, (size_t)37));
+        CHECK(n > 0);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    close(fds[1]);
+
+    for (int i = 0; i < 2000 && !backend.finished(); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    CHECK(backend.finished());
+    backend.stop();
+
+    if (drops) {
+        memset(drops, 0, sizeof(*drops));
+        backend.drops(drops);
+    }
+    return frames;
+}
+
+static const struct TouchContact *findContact(const struct TouchFrame &frame, int id)
+{
+    for (int i = 0; i < frame.count; i++) {
+        if (frame.contacts[i].id == id)
+            return &frame.contacts[i];
+    }
+    return 0;
+}
+
+static void testTwoContacts()
+{
+    Stream stream;
+    stream.slot(0).id(5).x(10).y(20).report();
+    stream.slot(1).id(6).x(30).y(40).report();
+    stream.slot(0).x(11).report();
+    stream.slot(1).id(-1).report();
+    stream.report();
+
+    std::vector<struct TouchFrame> frames = run(stream);
+    CHECK_EQ(frames.size(), 5);
+    if (frames.size() != 5)
+        return;
+
+    CHECK_EQ(frames[0].count, 1);
+    CHECK_EQ(frames[0].contacts[0].id, 5);
+    CHECK_EQ(frames[0].contacts[0].x, 10);
+    CHECK_EQ(frames[0].contacts[0].y, 20);
+    CHECK_EQ(frames[0].deviceTime, 0);
+
+    CHECK_EQ(frames[1].count, 2);
+    CHECK_EQ(frames[1].contactCount, 2);
+    CHECK_EQ(frames[1].deviceTime, 1000000);
+
+    const struct TouchContact *moved = findContact(frames[2], 5);
+    CHECK(moved && moved->x == 11 && moved->y == 20);
+
+    /* the lift is reported once, without flags, where the contact was */
+    const struct TouchContact *lifted = findContact(frames[3], 6);
+    CHECK(lifted && lifted->flags == 0 && lifted->x == 30 && lifted->y == 40);
+    CHECK_EQ(frames[3].contactCount, 1);
+    CHECK_EQ(frames[3].count, 2);
+    CHECK_EQ(frames[4].count, 1);
+    CHECK_EQ(frames[4].contacts[0].id, 5);
+}
+
+/* a new tracking id without -1 in between replaces the contact */
+static void testReplacedId()
+{
+    Stream stream;
+    stream.slot(0).id(5).x(10).y(20).report();
+    stream.id(7).x(50).y(60).report();
+
+    std::vector<struct TouchFrame> frames = run(stream);
+    CHECK_EQ(frames.size(), 2);
+    if (frames.size() != 2)
+        return;
+
+    const struct TouchContact *old = findContact(frames[1], 5);
+    const struct TouchContact *now = findContact(frames[1], 7);
+    CHECK(old && old->flags == 0 && old->x == 10);
+    CHECK(now && (now->flags & TOUCH_CONTACT_TIP) && now->x == 50 && now->y == 60);
+    CHECK_EQ(frames[1].contactCount, 1);
+}
+
+/*
+ * The lift of id 5 falls in the window SYN_DROPPED throws away. A pipe
+ * can't be asked for its slots, so every contact lifts when the window
+ * ends, and id 5 never shows up touching again.
+ */
+static void testDroppedLift()
+{
+    Stream stream;
+    stream.slot(0).id(5).x(10).y(20).report();
+    stream.slot(0).x(12).report();
+    stream.dropped().slot(0).id(-1).report();
+    stream.slot(1).id(6).x(30).y(40).report();
+    stream.slot(1).x(31).report();
+
+    struct TouchDropCounts drops;
+    std::vector<struct TouchFrame> frames = run(stream, &drops);
+    CHECK_EQ(drops.overflows, 1);
+    CHECK_EQ(drops.lostReports, 1);
+    CHECK_EQ(frames.size(), 5);
+    if (frames.size() != 5)
+        return;
+
+    /* the report closing the window carries the lift */
+    const struct TouchContact *lifted = findContact(frames[2], 5);
+    CHECK(lifted && lifted->flags == 0 && lifted->x == 12);
+    CHECK_EQ(frames[2].contactCount, 0);
+
+    for (size_t i = 3; i < frames.size(); i++) {
+        CHECK(!findContact(frames[i], 5));
+        CHECK(findContact(frames[i], 6) != 0);
+        CHECK_EQ(frames[i].contactCount, 1);
+    }
+}
+
+/* contacts the window hid are lifted too, and come back once they are sent again */
+static void testDroppedWhileDown()
+{
+    Stream stream;
+    stream.slot(0).id(5).x(10).y(20).report();
+    stream.dropped().slot(0).x(15).report();
+    stream.slot(0).id(8).x(16).y(21).report();
+
+    std::vector<struct TouchFrame> frames = run(stream);
+    CHECK_EQ(frames.size(), 3);
+    if (frames.size() != 3)
+        return;
+
+    const struct TouchContact *lifted = findContact(frames[1], 5);
+    CHECK(lifted && lifted->flags == 0 && lifted->x == 10);
+    const struct TouchContact *back = findContact(frames[2], 8);
+    CHECK(back && (back->flags & TOUCH_CONTACT_TIP) && back->x == 16);
+    CHECK(!findContact(frames[2], 5));
+}
+
+int main()
+{
+    testTwoContacts();
+    testReplacedId();
+    testDroppedLift();
+    testDroppedWhileDown();
+    return TOUCH_TEST_RESULT();
+}
@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Frame assembly from the per-element value stream.
+# ./TestFrame
+#
+#-------------------------------------------------
+
+TARGET = TestFrame
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += .. ../..
+
+SOURCES += test_frame.cpp \
+    ../../touch_frame.cpp
+
+HEADERS += ../touch_test.h \
+    ../../touch_frame.h
@@ -0,0 +1,146 @@
+#include <vector>
+
+#include "touch_frame.h"
+#include "touch_test.h"
+
+struct Frames {
+    std::vector<struct TouchFrame> frames;
+};
+
+static void CollectFrame(const struct TouchFrame *frame, void *context)
+{
+    ((struct Frames *)context)->frames.push_back(*frame);
+}
+
+static const struct TouchContact *findContact(const struct TouchFrame &frame, int id)
+{
+    for (int i = 0; i < frame.count; i++) {
+        if (frame.contacts[i].id == id)
+            return &frame.contacts[i];
+    }
+    return 0;
+}
+
+/* tip switch ahead of the identifier, as most digitizer descriptors have it */
+static void testTipBeforeId()
+{
+    struct Frames frames;
+    TouchFrameAssembler assembler(CollectFrame, &frames);
+
+    assembler.setTip(true);
+    assembler.beginContact(5);
+    assembler.setX(10);
+    assembler.setY(20);
+    assembler.setTip(true);
+    assembler.setInRange(true);
+    assembler.beginContact(6);
+    assembler.setX(30);
+    assembler.setY(40);
+    assembler.setContactCount(2);
+
+    CHECK_EQ(frames.frames.size(), 1);
+    if (frames.frames.size() != 1)
+        return;
+    const struct TouchFrame &frame = frames.frames[0];
+    CHECK_EQ(frame.count, 2);
+    CHECK(!findContact(frame, 0));
+
+    const struct TouchContact *first = findContact(frame, 5);
+    CHECK(first && first->x == 10 && first->y == 20);
+    CHECK(first && first->flags == TOUCH_CONTACT_TIP);
+    const struct TouchContact *second = findContact(frame, 6);
+    CHECK(second && second->x == 30 && second->y == 40);
+    CHECK(second && second->flags == (TOUCH_CONTACT_TIP | TOUCH_CONTACT_IN_RANGE));
+}
+
+/* fields before the identifier land on that contact's carried-over state */
+static void testFieldsBeforeKnownId()
+{
+    struct Frames frames;
+    TouchFrameAssembler assembler(CollectFrame, &frames);
+
+    assembler.beginContact(3);
+    assembler.setTip(true);
+    assembler.setX(100);
+    assembler.setY(200);
+    assembler.endReport();
+
+    /* only X changed, and the queue delivers it before the identifier */
+    assembler.setX(110);
+    assembler.beginContact(3);
+    assembler.endReport();
+
+    /* the lift, tip first */
+    assembler.setTip(false);
+    assembler.beginContact(3);
+    assembler.endReport();
+
+    CHECK_EQ(frames.frames.size(), 3);
+    if (frames.frames.size() != 3)
+        return;
+    for (size_t i = 0; i < frames.frames.size(); i++) {
+        CHECK_EQ(frames.frames[i].count, 1);
+        CHECK_EQ(frames.frames[i].contacts[0].id, 3);
+        CHECK_EQ(frames.frames[i].contacts[0].y, 200);
+    }
+    CHECK_EQ(frames.frames[1].contacts[0].x, 110);
+    CHECK(frames.frames[1].contacts[0].flags & TOUCH_CONTACT_TIP);
+    CHECK_EQ(frames.frames[2].contacts[0].x, 110);
+    CHECK(!(frames.frames[2].contacts[0].flags & TOUCH_CONTACT_TIP));
+}
+
+/* a leading field whose identifier repeats one already in the frame ends it */
+static void testPendingFieldsOfNextReport()
+{
+    struct Frames frames;
+    TouchFrameAssembler assembler(CollectFrame, &frames);
+
+    assembler.setTip(true);
+    assembler.beginContact(1);
+    assembler.setX(1);
+    assembler.setTip(true);
+    assembler.beginContact(1);
+    assembler.setX(2);
+    assembler.endReport();
+
+    CHECK_EQ(frames.frames.size(), 2);
+    if (frames.frames.size() != 2)
+        return;
+    CHECK_EQ(frames.frames[0].count, 1);
+    CHECK_EQ(frames.frames[0].contacts[0].x, 1);
+    CHECK_EQ(frames.frames[1].count, 1);
+    CHECK_EQ(frames.frames[1].contacts[0].id, 1);
+    CHECK_EQ(frames.frames[1].contacts[0].x, 2);
+}
+
+/* without identifiers, a field written twice starts the next report */
+static void testNoIds()
+{
+    struct Frames frames;
+    TouchFrameAssembler assembler(CollectFrame, &frames);
+
+    assembler.setTip(true);
+    assembler.setX(5);
+    assembler.setY(6);
+    assembler.setX(7);
+    assembler.endReport();
+
+    CHECK_EQ(frames.frames.size(), 2);
+    if (frames.frames.size() != 2)
+        return;
+    CHECK_EQ(frames.frames[0].count, 1);
+    CHECK_EQ(frames.frames[0].contacts[0].x, 5);
+    CHECK_EQ(frames.frames[1].count, 1);
+    CHECK_EQ(frames.frames[1].contacts[0].x, 7);
+    CHECK_EQ(frames.frames[1].contacts[0].y, 6);
+    CHECK(frames.frames[1].contacts[0].flags & TOUCH_CONTACT_TIP);
+}
+
+int main()
+{
+    testTipBeforeId();
+    testFieldsBeforeKnownId();
+    testPendingFieldsOfNextReport();
+    testNoIds();
+    return TOUCH_TEST_RESULT();
+}
@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Report descriptor parsing and raw report decoding, from captured bytes.
+# ./TestHidDescriptor
+#
+#-------------------------------------------------
+
+TARGET = TestHidDescriptor
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += .. ../..
+
+SOURCES += test_hid_descriptor.cpp \
+    ../../touch_frame.cpp \
+    ../../touch_hid_descriptor.cpp
+
+HEADERS += ../touch_test.h \
+    ../../touch_frame.h \
+    ../../touch_hid_descriptor.h
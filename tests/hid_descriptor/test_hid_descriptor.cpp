@@ -0,0 +1,217 @@
+#include <string.h>
+
+#include <vector>
+
+#include "touch_frame.h"
+#include "touch_hid_descriptor.h"
+#include "touch_test.h"
+
+/*
+ * Two finger touch screen with 16 bit coordinates, declared with
+ * Logical Maximum 0xffff as devices commonly do. Report 1 is the report
+ * id, then per finger tip switch, padding, contact id, X and Y, then the
+ * contact count: 14 bytes.
+ */
+#define FINGER \
+    0x09, 0x22,             /* Usage (Finger) */ \
+    0xa1, 0x02,             /* Collection (Logical) */ \
+    0x05, 0x0d,             /*   Usage Page (Digitizer) */ \
+    0x09, 0x42,             /*   Usage (Tip Switch) */ \
+    0x15, 0x00,             /*   Logical Minimum (0) */ \
+    0x25, 0x01,             /*   Logical Maximum (1) */ \
+    0x75, 0x01,             /*   Report Size (1) */ \
+    0x95, 0x01,             /*   Report Count (1) */ \
+    0x81, 0x02,             /*   Input (Data, Variable, Absolute) */ \
+    0x95, 0x07,             /*   Report Count (7) */ \
+    0x81, 0x03,             /*   Input (Constant) */ \
+    0x09, 0x51,             /*   Usage (Contact Identifier) */ \
+    0x25, 0x0f,             /*   Logical Maximum (15) */ \
+    0x75, 0x08,             /*   Report Size (8) */ \
+    0x95, 0x01,             /*   Report Count (1) */ \
+    0x81, 0x02,             /*   Input (Data, Variable, Absolute) */ \
+    0x05, 0x01,             /*   Usage Page (Generic Desktop) */ \
+    0x26, 0xff, 0xff,       /*   Logical Maximum (65535) */ \
+    0x75, 0x10,             /*   Report Size (16) */ \
+    0x09, 0x30,             /*   Usage (X) */ \
+    0x81, 0x02,             /*   Input (Data, Variable, Absolute) */ \
+    0x09, 0x31,             /*   Usage (Y) */ \
+    0x81, 0x02,             /*   Input (Data, Variable, Absolute) */ \
+    0xc0                    /* End Collection */
+
+static const uint8_t TouchScreenDescriptor[] = {
+    0x05, 0x0d,             /* Usage Page (Digitizer) */
+    0x09, 0x04,             /* Usage (Touch Screen) */
+    0xa1, 0x01,             /* Collection (Application) */
+    0x85, 0x01,             /*   Report ID (1) */
+    FINGER,
+    FINGER,
+    0x05, 0x0d,             /*   Usage Page (Digitizer) */
+    0x09, 0x54,             /*   Usage (Contact Count) */
+    0x25, 0x0a,             /*   Logical Maximum (10) */
+    0x75, 0x08,             /*   Report Size (8) */
+    0x95, 0x01,             /*   Report Count (1) */
+    0x81, 0x02,             /*   Input (Data, Variable, Absolute) */
+    0xc0                    /* End Collection */
+};
+
+struct Frames {
+    std::vector<struct TouchFrame> frames;
+};
+
+static void CollectFrame(const struct TouchFrame *frame, void *context)
+{
+    ((struct Frames *)context)->frames.push_back(*frame);
+}
+
+static const HidField *findField(const HidReport *report, uint16_t page, uint16_t usage)
+{
+    for (size_t i = 0; report && i < report->fields.size(); i++) {
+        if (report->fields[i].usagePage == page && report->fields[i].usage == usage)
+            return &report->fields[i];
+    }
+    return 0;
+}
+
+static void testUnsignedLogicalMaximum()
+{
+    HidReportLayout layout;
+    CHECK(layout.parse(TouchScreenDescriptor, sizeof(TouchScreenDescriptor)));
+    CHECK(layout.isTouchLayout());
+
+    const HidReport *report = layout.report(1);
+    CHECK(report != 0);
+    CHECK_EQ(report ? report->bitLength : 0, 13 * 8);
+
+    const HidField *x = findField(report, HID_PAGE_GENERIC_DESKTOP, HID_USAGE_GD_X);
+    const HidField *y = findField(report, HID_PAGE_GENERIC_DESKTOP, HID_USAGE_GD_Y);
+    CHECK(x && y);
+    if (!x || !y)
+        return;
+    CHECK_EQ(x->logicalMin, 0);
+    CHECK_EQ(x->logicalMax, 65535);
+    CHECK_EQ(y->logicalMax, 65535);
+    CHECK(!(x->flags & HidFieldSigned));
+}
+
+static void testSignedLogicalMaximum()
+{
+    /* a negative minimum keeps the maximum signed */
+    static const uint8_t descriptor[] = {
+        0x05, 0x01,         /* Usage Page (Generic Desktop) */
+        0x09, 0x02,         /* Usage (Mouse) */
+        0xa1, 0x01,         /* Collection (Application) */
+        0x09, 0x30,         /*   Usage (X) */
+        0x09, 0x31,         /*   Usage (Y) */
+        0x15, 0x81,         /*   Logical Minimum (-127) */
+        0x25, 0x7f,         /*   Logical Maximum (127) */
+        0x75, 0x08,         /*   Report Size (8) */
+        0x95, 0x02,         /*   Report Count (2) */
+        0x81, 0x06,         /*   Input (Data, Variable, Relative) */
+        0xc0                /* End Collection */
+    };
+
+    HidReportLayout layout;
+    CHECK(layout.parse(descriptor, sizeof(descriptor)));
+    const HidField *x = findField(layout.report(0), HID_PAGE_GENERIC_DESKTOP, HID_USAGE_GD_X);
+    CHECK(x != 0);
+    if (!x)
+        return;
+    CHECK_EQ(x->logicalMin, -127);
+    CHECK_EQ(x->logicalMax, 127);
+    CHECK(x->flags & HidFieldSigned);
+}
+
+static void putContact(uint8_t *report, int slot, bool tip, int id, int x, int y)
+{
+    uint8_t *p = report + 1 + slot * 6;
+    p[0] = tip ? 1 : 0;
+    p[1] = (uint8_t)id;
+    p[2] = (uint8_t)x;
+    p[3] = (uint8_t)(x >> 8);
+    p[4] = (uint8_t)y;
+    p[5] = (uint8_t)(y >> 8);
+}
+
+static void testDecodeCentre()
+{
+    HidReportLayout layout;
+    CHECK(layout.parse(TouchScreenDescriptor, sizeof(TouchScreenDescriptor)));
+
+    uint8_t report[14];
+    memset(report, 0, sizeof(report));
+    report[0] = 1;
+    putContact(report, 0, true, 5, 0x8000, 0x8000);
+    putContact(report, 1, true, 6, 0xffff, 0);
+    report[13] = 2;
+
+    struct Frames frames;
+    TouchFrameAssembler assembler(CollectFrame, &frames);
+    CHECK(layout.decode(report, sizeof(report), assembler));
+
+    CHECK_EQ(frames.frames.size(), 1);
+    if (frames.frames.size() != 1)
+        return;
+    const struct TouchFrame &frame = frames.frames[0];
+    CHECK_EQ(frame.count, 2);
+    CHECK_EQ(frame.contactCount, 2);
+    CHECK_EQ(frame.contacts[0].id, 5);
+    CHECK_EQ(frame.contacts[0].x, TOUCH_SCREEN_WIDTH / 2);
+    CHECK_EQ(frame.contacts[0].y, TOUCH_SCREEN_HEIGHT / 2);
+    CHECK(frame.contacts[0].flags & TOUCH_CONTACT_TIP);
+    CHECK_EQ(frame.contacts[1].id, 6);
+    CHECK_EQ(frame.contacts[1].x, TOUCH_SCREEN_WIDTH - 1);
+    CHECK_EQ(frame.contacts[1].y, 0);
+}
+
+static void testDecodeUnusedSlot()
+{
+    HidReportLayout layout;
+    CHECK(layout.parse(TouchScreenDescriptor, sizeof(TouchScreenDescriptor)));
+
+    /* one finger down, the second slot zeroed as devices leave it */
+    uint8_t report[14];
+    memset(report, 0, sizeof(report));
+    report[0] = 1;
+    putContact(report, 0, true, 3, 0x4000, 0xc000);
+    report[13] = 1;
+
+    struct Frames frames;
+    TouchFrameAssembler assembler(CollectFrame, &frames);
+    CHECK(layout.decode(report, sizeof(report), assembler));
+    CHECK(layout.decode(report, sizeof(report), assembler));
+
+    CHECK_EQ(frames.frames.size(), 2);
+    for (size_t i = 0; i < frames.frames.size(); i++) {
+        CHECK_EQ(frames.frames[i].count, 1);
+        CHECK_EQ(frames.frames[i].contacts[0].id, 3);
+        CHECK_EQ(frames.frames[i].contacts[0].x, TOUCH_SCREEN_WIDTH / 4);
+        CHECK_EQ(frames.frames[i].contacts[0].y, TOUCH_SCREEN_HEIGHT * 3 / 4);
+    }
+}
+
+static void testDecodeShortReport()
+{
+    HidReportLayout layout;
+    CHECK(layout.parse(TouchScreenDescriptor, sizeof(TouchScreenDescriptor)));
+
+    uint8_t report[14];
+    memset(report, 0, sizeof(report));
+    report[0] = 1;
+
+    struct Frames frames;
+    TouchFrameAssembler assembler(CollectFrame, &frames);
+    CHECK(!layout.decode(report, 8, assembler));
+    report[0] = 2;
+    CHECK(!layout.decode(report, sizeof(report), assembler));
+    CHECK_EQ(frames.frames.size(), 0);
+}
+
+int main()
+{
+    testUnsignedLogicalMaximum();
+    testSignedLogicalMaximum();
+    testDecodeCentre();
+    testDecodeUnusedSlot();
+    testDecodeShortReport();
+    return TOUCH_TEST_RESULT();
+}
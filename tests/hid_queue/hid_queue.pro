@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# HID queue sizing and overflow accounting against a simulated queue.
+# ./TestHidQueue
+#
+#-------------------------------------------------
+
+TARGET = TestHidQueue
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += .. ../..
+
+SOURCES += test_hid_queue.cpp \
+    ../../touch_hid_queue.cpp
+
+HEADERS += ../touch_test.h \
+    ../../touch_hid_queue.h
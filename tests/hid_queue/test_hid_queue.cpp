@@ -0,0 +1,198 @@
+#include <string.h>
+
+#include <vector>
+
+#include "touch_hid_queue.h"
+#include "touch_test.h"
+
+#define ELEMENTS 4
+#define INTERVAL_NS 1000000ull      /* 1000 reports per second */
+
+/*
+ * A device reporting ELEMENTS values every INTERVAL_NS into a queue,
+ * drained by a monitor. Report n is stamped n * INTERVAL_NS.
+ */
+struct Device {
+    SimulatedHidQueue queue;
+    HidQueueMonitor monitor;
+    uint64_t next;              /* report to generate next */
+
+    explicit Device(int depth) : next(1) {
+        monitor.setElementsPerReport(ELEMENTS);
+        queue.create(depth);
+        for (uint32_t cookie = 1; cookie <= ELEMENTS; cookie++)
+            queue.addElement(cookie);
+        queue.start();
+    }
+
+    uint64_t now() const { return (next - 1) * INTERVAL_NS; }
+
+    void generate(int reports) {
+        for (int r = 0; r < reports; r++, next++) {
+            struct HidQueueEvent events[ELEMENTS];
+            for (int i = 0; i < ELEMENTS; i++) {
+                events[i].cookie = i + 1;
+                events[i].value = (int32_t)next;
+                events[i].timestamp = next * INTERVAL_NS;
+            }
+            queue.enqueueReport(events, ELEMENTS);
+        }
+    }
+
+    size_t drain() { return monitor.drain(queue, 0, 0, now()); }
+
+    /* values the monitor thinks were lost */
+    unsigned long estimated() const {
+        return monitor.lostReports() * ELEMENTS + monitor.lostElements();
+    }
+};
+
+static void testDepth()
+{
+    /* 5 reports in 20 ms at 250 Hz, plus the one in flight */
+    CHECK_EQ(hidQueueDepth(10, 250, 20), 60);
+    CHECK_EQ(hidQueueDepth(0, 250, 20), HID_QUEUE_MIN_DEPTH);
+    CHECK_EQ(hidQueueDepth(100, 8000, 20), HID_QUEUE_MAX_DEPTH);
+
+    HidQueueMonitor monitor;
+    monitor.setElementsPerReport(ELEMENTS);
+    CHECK_EQ(monitor.initialDepth(), ELEMENTS * 6);
+}
+
+static void testServicedInTime()
+{
+    Device device(ELEMENTS * 6);
+    for (int i = 0; i < 100; i++) {
+        device.generate(3);
+        CHECK_EQ(device.drain(), 3 * ELEMENTS);
+        CHECK_EQ(device.monitor.advice(device.queue.depth()), HidQueueKeep);
+    }
+
+    CHECK_EQ(device.queue.rejected(), 0);
+    CHECK_EQ(device.monitor.overflows(), 0);
+    CHECK_EQ(device.estimated(), 0);
+    CHECK_EQ(device.monitor.events(), 300 * ELEMENTS);
+    /* the last report stays open until a value of the next one arrives */
+    CHECK_EQ(device.monitor.reports(), 299);
+    CHECK(device.monitor.reportRate() > 999 && device.monitor.reportRate() < 1001);
+}
+
+/*
+ * A late service, with the queue depth cutting through a report or
+ * between two. What the monitor estimates must be what the queue turned
+ * away.
+ */
+static void testLateService(int depth)
+{
+    Device device(depth);
+    for (int i = 0; i < 20; i++) {
+        device.generate(2);
+        device.drain();
+    }
+    CHECK_EQ(device.monitor.overflows(), 0);
+
+    device.generate(10);
+    device.drain();
+    CHECK_EQ(device.monitor.overflows(), 1);
+    CHECK_EQ(device.monitor.advice(device.queue.depth()), HidQueueGrow);
+    CHECK(device.queue.rejected() > 0);
+
+    /* the loss is counted once the next report shows how long the gap was */
+    for (int i = 0; i < 5; i++) {
+        device.generate(2);
+        device.drain();
+    }
+    CHECK_EQ(device.monitor.overflows(), 1);
+    CHECK_EQ(device.estimated(), device.queue.rejected());
+}
+
+/* the device keeps reporting while a drain runs; that isn't an overflow */
+struct Refill {
+    Device *device;
+    int calls;
+};
+
+static void RefillDuringDrain(const struct HidQueueEvent *, void *context)
+{
+    struct Refill *refill = (struct Refill *)context;
+    if (++refill->calls % ELEMENTS == 0 && refill->calls <= 40 * ELEMENTS)
+        refill->device->generate(1);
+}
+
+static void testLongDrain()
+{
+    Device device(ELEMENTS * 6);
+    for (int i = 0; i < 20; i++) {
+        device.generate(2);
+        device.drain();
+    }
+
+    device.generate(2);
+    struct Refill refill = { &device, 0 };
+    size_t count = device.monitor.drain(device.queue, RefillDuringDrain, &refill, device.now());
+
+    CHECK(count > (size_t)device.queue.depth());
+    CHECK_EQ(device.queue.rejected(), 0);
+    CHECK_EQ(device.monitor.overflows(), 0);
+    CHECK_EQ(device.monitor.advice(device.queue.depth()), HidQueueKeep);
+    CHECK_EQ(device.estimated(), 0);
+}
+
+/* grows to what the measured rate needs, then keeps up */
+static void testGrow()
+{
+    Device device(ELEMENTS * 6);
+    for (int i = 0; i < 20; i++) {
+        device.generate(2);
+        device.drain();
+    }
+
+    device.generate(30);
+    device.drain();
+    int depth = device.queue.depth();
+    CHECK_EQ(device.monitor.advice(depth), HidQueueGrow);
+    int grown = device.monitor.grownDepth(depth);
+    CHECK_EQ(grown, hidQueueDepth(ELEMENTS, 1000, HID_QUEUE_SERVICE_MS));
+    CHECK(device.queue.resize(grown));
+
+    unsigned long rejected = device.queue.rejected();
+    for (int i = 0; i < 20; i++) {
+        device.generate(HID_QUEUE_SERVICE_MS);
+        device.drain();
+        CHECK_EQ(device.monitor.advice(device.queue.depth()), HidQueueKeep);
+    }
+    CHECK_EQ(device.queue.rejected(), rejected);
+    CHECK_EQ(device.monitor.overflows(), 1);
+    CHECK_EQ(device.estimated(), rejected);
+}
+
+/* a queue that overflows at the largest depth is given up on */
+static void testFallBack()
+{
+    Device device(HID_QUEUE_MAX_DEPTH);
+    int reports = HID_QUEUE_MAX_DEPTH / ELEMENTS + 10;
+    for (int i = 0; i < HID_QUEUE_FALLBACK_OVERFLOWS; i++) {
+        CHECK_EQ(device.monitor.advice(device.queue.depth()), HidQueueKeep);
+        device.generate(reports);
+        device.drain();
+    }
+    CHECK_EQ(device.monitor.overflows(), HID_QUEUE_FALLBACK_OVERFLOWS);
+    CHECK_EQ(device.monitor.advice(device.queue.depth()), HidQueueFallBack);
+
+    /* a new queue starts over, the counters stay */
+    device.monitor.restart();
+    CHECK_EQ(device.monitor.advice(device.queue.depth()), HidQueueKeep);
+    CHECK_EQ(device.monitor.overflows(), HID_QUEUE_FALLBACK_OVERFLOWS);
+}
+
+int main()
+{
+    testDepth();
+    testServicedInTime();
+    testLateService(ELEMENTS * 6);
+    testLateService(ELEMENTS * 6 + 2);
+    testLongDrain();
+    testGrow();
+    testFallBack();
+    return TOUCH_TEST_RESULT();
+}
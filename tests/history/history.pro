@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Retention and simplification of the touch history.
+# ./TestHistory
+#
+#-------------------------------------------------
+
+TARGET = TestHistory
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += .. ../..
+
+SOURCES += test_history.cpp \
+    ../../touch_history.cpp
+
+HEADERS += ../touch_test.h \
+    ../../touch_history.h
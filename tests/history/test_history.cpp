@@ -0,0 +1,183 @@
+#include <string.h>
+
+#include <vector>
+
+#include "touch_history.h"
+#include "touch_test.h"
+
+static struct TouchEvent sample(int idx, int x, int y, bool tip, uint64_t hostTime)
+{
+    struct TouchEvent ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.idx = idx;
+    ev.x = x;
+    ev.y = y;
+    ev.flags = tip ? TOUCH_CONTACT_TIP : 0;
+    ev.hostTime = hostTime;
+    return ev;
+}
+
+/* n samples of one contact, stamped first, first + step, ... */
+static void fill(TouchHistory &history, size_t n, uint64_t first = 0, uint64_t step = 1)
+{
+    for (size_t i = 0; i < n; i++)
+        history.append(sample(1, (int)i, 0, true, first + i * step));
+}
+
+static std::vector<struct TouchEvent> readAll(const TouchHistory &history, size_t batch)
+{
+    std::vector<struct TouchEvent> all;
+    std::vector<struct TouchEvent> buffer(batch);
+    uint64_t seq = 0;
+    size_t n;
+    while ((n = history.read(seq, buffer.data(), batch)) > 0)
+        all.insert(all.end(), buffer.begin(), buffer.begin() + n);
+    CHECK_EQ(seq, history.end());
+    return all;
+}
+
+static void testMaxEvents()
+{
+    struct TouchHistoryPolicy policy;
+    memset(&policy, 0, sizeof(policy));
+    policy.maxEvents = 2 * HISTORY_CHUNK_EVENTS;
+
+    TouchHistory history;
+    history.setPolicy(policy);
+    fill(history, 5 * HISTORY_CHUNK_EVENTS + 100);
+    history.enforce(0);
+
+    /* whole chunks go, so it stays within one chunk above the limit */
+    CHECK(history.size() >= policy.maxEvents);
+    CHECK(history.size() < policy.maxEvents + HISTORY_CHUNK_EVENTS);
+    CHECK_EQ(history.begin() + history.size(), history.end());
+    CHECK_EQ(history.end(), 5 * HISTORY_CHUNK_EVENTS + 100);
+
+    std::vector<struct TouchEvent> all = readAll(history, 1000);
+    CHECK_EQ(all.size(), history.size());
+    CHECK_EQ(all.size() ? all.front().x : -1, (int)history.begin());
+    CHECK_EQ(all.size() ? all.back().x : -1, 5 * HISTORY_CHUNK_EVENTS + 99);
+
+    /* the chunk being appended to stays whatever the limit */
+    policy.maxEvents = 1;
+    history.setPolicy(policy);
+    history.enforce(0);
+    CHECK_EQ(history.size(), 100);
+}
+
+static void testMaxBytes()
+{
+    TouchHistory history;
+    fill(history, 1);
+    size_t chunk = history.bytes();
+
+    struct TouchHistoryPolicy policy;
+    memset(&policy, 0, sizeof(policy));
+    policy.maxBytes = 3 * chunk;
+    history.setPolicy(policy);
+
+    fill(history, 10 * HISTORY_CHUNK_EVENTS);
+    CHECK(history.bytes() > policy.maxBytes);
+    history.enforce(0);
+    CHECK(history.bytes() <= policy.maxBytes);
+    CHECK_EQ(history.bytes(), 3 * chunk);
+}
+
+static void testMaxAge()
+{
+    struct TouchHistoryPolicy policy;
+    memset(&policy, 0, sizeof(policy));
+    policy.maxAgeNs = 3 * HISTORY_CHUNK_EVENTS * 1000ull;
+
+    /* a sample every microsecond */
+    TouchHistory history;
+    history.setPolicy(policy);
+    fill(history, 8 * HISTORY_CHUNK_EVENTS, 0, 1000);
+    uint64_t now = (8 * HISTORY_CHUNK_EVENTS + 100) * 1000ull;
+    history.enforce(now);
+
+    /* the cut falls inside the first chunk left, and nothing older is kept */
+    std::vector<struct TouchEvent> all = readAll(history, 4096);
+    size_t old = 0;
+    for (size_t i = 0; i < all.size(); i++) {
+        if (all[i].hostTime < now - policy.maxAgeNs)
+            old++;
+    }
+    CHECK_EQ(old, 100);
+}
+
+/*
+ * One chunk with two interleaved contacts: 1 draws two straight strokes
+ * with a lift between them, 2 zigzags further than the tolerance.
+ */
+static void testSimplify()
+{
+    struct TouchHistoryPolicy policy;
+    memset(&policy, 0, sizeof(policy));
+    policy.simplifyError = 1.0f;
+    policy.simplifyAfterNs = 1000;
+
+    TouchHistory history;
+    history.setPolicy(policy);
+    for (int i = 0; i < HISTORY_CHUNK_EVENTS; i++) {
+        if (i % 2)
+            history.append(sample(2, i, (i / 2) % 2 ? 10 : 0, true, i));
+        else
+            history.append(sample(1, i, 0, i != 2000, i));
+    }
+    fill(history, 10, 5000);
+    CHECK_EQ(history.size(), HISTORY_CHUNK_EVENTS + 10);
+
+    /* not old enough yet */
+    history.enforce(HISTORY_CHUNK_EVENTS + 500);
+    CHECK_EQ(history.size(), HISTORY_CHUNK_EVENTS + 10);
+
+    history.enforce(10000);
+    CHECK_EQ(history.size(), HISTORY_CHUNK_EVENTS / 2 + 5 + 10);
+    /* the chunk being appended to is left alone */
+    history.enforce(100000);
+    CHECK_EQ(history.size(), HISTORY_CHUNK_EVENTS / 2 + 5 + 10);
+
+    /* read in small batches across the gaps, the same samples come out */
+    std::vector<struct TouchEvent> all = readAll(history, 7);
+    std::vector<struct TouchEvent> once = readAll(history, history.size());
+    CHECK_EQ(all.size(), history.size());
+    CHECK(all.size() == once.size()
+          && !memcmp(all.data(), once.data(), all.size() * sizeof(all[0])));
+
+    std::vector<int> line;
+    size_t zigzag = 0;
+    bool ordered = true;
+    for (size_t i = 0; i + 10 < all.size(); i++) {
+        ordered = ordered && (!i || all[i].hostTime > all[i - 1].hostTime);
+        if (all[i].idx == 1)
+            line.push_back(all[i].x);
+        else
+            zigzag++;
+    }
+    CHECK(ordered);
+    CHECK_EQ(zigzag, HISTORY_CHUNK_EVENTS / 2);
+
+    /* the ends of both strokes and the lift between them */
+    int expected[] = { 0, 1998, 2000, 2002, HISTORY_CHUNK_EVENTS - 2 };
+    CHECK_EQ(line.size(), 5);
+    for (size_t i = 0; i < line.size() && i < 5; i++)
+        CHECK_EQ(line[i], expected[i]);
+
+    /* a reader inside a removed run resumes at the next sample kept */
+    struct TouchEvent ev;
+    uint64_t seq = 4;
+    CHECK_EQ(history.read(seq, &ev, 1), 1);
+    CHECK_EQ(ev.idx, 2);
+    CHECK_EQ(ev.x, 5);
+    CHECK_EQ(seq, 6);
+}
+
+int main()
+{
+    testMaxEvents();
+    testMaxBytes();
+    testMaxAge();
+    testSimplify();
+    return TOUCH_TEST_RESULT();
+}
@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# Layout cache file round trips, and damaged files.
+# ./TestLayoutCache
+#
+#-------------------------------------------------
+
+TARGET = TestLayoutCache
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += .. ../..
+
+SOURCES += test_layout_cache.cpp \
+    ../../touch_frame.cpp \
+    ../../touch_hid_descriptor.cpp \
+    ../../touch_layout_cache.cpp
+
+HEADERS += ../touch_test.h \
+    ../../touch_hid_descriptor.h \
+    ../../touch_layout_cache.h
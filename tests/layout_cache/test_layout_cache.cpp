@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "touch_layout_cache.h"
+#include "touch_test.h"
+
+/* FileHeader, then the first FileEntry, as touch_layout_cache.cpp writes them */
+#define FILE_HEADER_SIZE 16
+#define FILE_ENTRY_SIZE 40
+
+static std::string g_Path;
+
+static struct TouchLayoutKey makeKey(uint32_t productId)
+{
+    struct TouchLayoutKey key;
+    memset(&key, 0, sizeof(key));
+    key.vendorId = 0x1234;
+    key.productId = productId;
+    key.version = 1;
+    key.descriptorHash = 0x0123456789abcdefull + productId;
+    return key;
+}
+
+static HidField makeField(uint32_t bitOffset, uint32_t bitSize, uint16_t page, uint16_t usage)
+{
+    HidField field;
+    memset(&field, 0, sizeof(field));
+    field.bitOffset = bitOffset;
+    field.bitSize = bitSize;
+    field.logicalMax = 0xffff;
+    field.usagePage = page;
+    field.usage = usage;
+    field.flags = HidFieldVariable;
+    return field;
+}
+
+/* one report with X and Y, one element per field */
+static struct TouchLayout makeLayout()
+{
+    struct TouchLayout layout;
+    layout.reportIds = true;
+
+    HidReport report;
+    report.id = 1;
+    report.bitLength = 32;
+    report.fields.push_back(makeField(0, 16, HID_PAGE_GENERIC_DESKTOP, HID_USAGE_GD_X));
+    report.fields.push_back(makeField(16, 16, HID_PAGE_GENERIC_DESKTOP, HID_USAGE_GD_Y));
+    layout.reports.push_back(report);
+
+    for (uint32_t i = 0; i < 2; i++) {
+        struct TouchLayoutElement element;
+        memset(&element, 0, sizeof(element));
+        element.cookie = 2 + i;
+        element.type = 3;
+        element.usagePage = HID_PAGE_GENERIC_DESKTOP;
+        element.usage = HID_USAGE_GD_X + i;
+        element.logicalMax = 0xffff;
+        layout.elements.push_back(element);
+    }
+    return layout;
+}
+
+static bool inFile(const struct TouchLayoutKey &key)
+{
+    TouchLayoutCache cache;
+    cache.setPath(g_Path);
+    struct TouchLayout layout;
+    return cache.find(key, &layout);
+}
+
+static void write(const struct TouchLayoutKey &key, const struct TouchLayout &layout)
+{
+    TouchLayoutCache cache;
+    cache.setPath(g_Path);
+    cache.insert(key, layout);
+}
+
+static void testRoundTrip()
+{
+    remove(g_Path.c_str());
+    write(makeKey(1), makeLayout());
+
+    TouchLayoutCache cache;
+    cache.setPath(g_Path);
+    struct TouchLayout layout;
+    CHECK(cache.find(makeKey(1), &layout));
+    CHECK(!cache.find(makeKey(2), &layout));
+    CHECK(layout.reportIds);
+    CHECK_EQ(layout.elements.size(), 2);
+    CHECK_EQ(layout.elements.size() ? layout.elements[1].cookie : 0, 3);
+    CHECK_EQ(layout.reports.size(), 1);
+    CHECK_EQ(layout.reports.size() ? layout.reports[0].fields.size() : 0, 2);
+
+    HidReportLayout decoder;
+    CHECK(decoder.load(layout.reports, layout.reportIds));
+    CHECK(decoder.isTouchLayout());
+}
+
+/* flips a byte of the first entry's first element, the cookie */
+static void testChecksum()
+{
+    remove(g_Path.c_str());
+    write(makeKey(1), makeLayout());
+    write(makeKey(2), makeLayout());
+    CHECK(inFile(makeKey(1)));
+
+    FILE *file = fopen(g_Path.c_str(), "r+b");
+    CHECK(file != 0);
+    if (!file)
+        return;
+    fseek(file, FILE_HEADER_SIZE + FILE_ENTRY_SIZE, SEEK_SET);
+    int byte = fgetc(file);
+    fseek(file, FILE_HEADER_SIZE + FILE_ENTRY_SIZE, SEEK_SET);
+    fputc(byte ^ 0x40, file);
+    fclose(file);
+
+    CHECK(!inFile(makeKey(1)));
+    CHECK(inFile(makeKey(2)));
+}
+
+/* entries written with a good checksum but fields the decoder can't use */
+static void testBadFields()
+{
+    struct TouchLayout beyond = makeLayout();
+    beyond.reports[0].fields[1].bitOffset = 1000;
+    struct TouchLayout empty = makeLayout();
+    empty.reports[0].fields[0].bitSize = 0;
+    struct TouchLayout wide = makeLayout();
+    wide.reports[0].fields[0].bitSize = 33;
+    wide.reports[0].bitLength = 64;
+    struct TouchLayout cookie = makeLayout();
+    cookie.elements[0].cookie = 0xffffffffu;
+
+    remove(g_Path.c_str());
+    write(makeKey(1), beyond);
+    write(makeKey(2), empty);
+    write(makeKey(3), wide);
+    write(makeKey(4), cookie);
+    write(makeKey(5), makeLayout());
+
+    CHECK(!inFile(makeKey(1)));
+    CHECK(!inFile(makeKey(2)));
+    CHECK(!inFile(makeKey(3)));
+    CHECK(!inFile(makeKey(4)));
+    CHECK(inFile(makeKey(5)));
+
+    HidReportLayout decoder;
+    CHECK(!decoder.load(beyond.reports, beyond.reportIds));
+    CHECK(!decoder.load(empty.reports, empty.reportIds));
+}
+
+static void testBadHeader()
+{
+    remove(g_Path.c_str());
+    write(makeKey(1), makeLayout());
+
+    FILE *file = fopen(g_Path.c_str(), "r+b");
+    CHECK(file != 0);
+    if (!file)
+        return;
+    fseek(file, 4, SEEK_SET);
+    fputc(TOUCH_LAYOUT_CACHE_VERSION + 1, file);
+    fclose(file);
+
+    CHECK(!inFile(makeKey(1)));
+}
+
+int main()
+{
+    char path[] = "/tmp/touch_layout_cache_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    g_Path = path;
+
+    testRoundTrip();
+    testChecksum();
+    testBadFields();
+    testBadHeader();
+
+    remove(g_Path.c_str());
+    return TOUCH_TEST_RESULT();
+}
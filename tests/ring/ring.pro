@@ -0,0 +1,19 @@
+#-------------------------------------------------
+#
+# The SPSC touch ring, on one thread and across two.
+# ./TestRing
+#
+#-------------------------------------------------
+
+TARGET = TestRing
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += .. ../..
+
+SOURCES += test_ring.cpp
+
+HEADERS += ../touch_test.h \
+    ../../touch_ring.h
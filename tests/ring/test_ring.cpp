@@ -0,0 +1,105 @@
+#include <thread>
+#include <vector>
+
+#include "touch_ring.h"
+#include "touch_test.h"
+
+#define CAPACITY 8
+
+typedef TouchRing<int, CAPACITY> Ring;
+
+/* the indices run past the end of the storage many times over */
+static void testWraparound()
+{
+    Ring ring;
+    int next = 0, expected = 0;
+    for (int round = 0; round < 100; round++) {
+        /* never the same fill twice in a row, so every slot is both ends */
+        int fill = 1 + round % CAPACITY;
+        for (int i = 0; i < fill; i++)
+            CHECK(ring.push(next++));
+        CHECK_EQ(ring.size(), fill);
+
+        int value = -1;
+        if (round % 2) {
+            for (int i = 0; i < fill; i++) {
+                CHECK(ring.pop(value));
+                CHECK_EQ(value, expected++);
+            }
+        } else {
+            std::vector<int> drained;
+            CHECK_EQ(ring.drain([&](const int &v) { drained.push_back(v); }), fill);
+            for (size_t i = 0; i < drained.size(); i++)
+                CHECK_EQ(drained[i], expected++);
+        }
+        CHECK_EQ(ring.size(), 0);
+        CHECK(!ring.pop(value));
+    }
+    CHECK_EQ(expected, next);
+    CHECK_EQ(ring.overflowCount(), 0);
+}
+
+/* a full ring keeps what it has and counts every push it turns away */
+static void testOverflow()
+{
+    Ring ring;
+    for (int i = 0; i < CAPACITY; i++)
+        CHECK(ring.push(i));
+    for (int i = 0; i < 5; i++)
+        CHECK(!ring.push(100 + i));
+    CHECK_EQ(ring.size(), CAPACITY);
+    CHECK_EQ(ring.overflowCount(), 5);
+
+    /* one slot freed takes exactly one more */
+    int value = -1;
+    CHECK(ring.pop(value));
+    CHECK_EQ(value, 0);
+    CHECK(ring.push(200));
+    CHECK(!ring.push(201));
+    CHECK_EQ(ring.overflowCount(), 6);
+
+    std::vector<int> drained;
+    ring.drain([&](const int &v) { drained.push_back(v); });
+    CHECK_EQ(drained.size(), CAPACITY);
+    for (int i = 0; i + 1 < CAPACITY; i++)
+        CHECK_EQ(drained[i], i + 1);
+    CHECK_EQ(drained.back(), 200);
+}
+
+/* a producer thread against a consumer: what isn't dropped arrives in order */
+static void testTwoThreads()
+{
+    static Ring ring;
+    const int count = 200000;
+    std::thread producer([&]() {
+        for (int i = 0; i < count; i++)
+            ring.push(i);
+    });
+
+    int last = -1;
+    long received = 0;
+    bool ordered = true;
+    auto take = [&](const int &v) {
+        ordered = ordered && v > last;
+        last = v;
+        received++;
+    };
+    while (last != count - 1) {
+        ring.drain(take);
+        if (received + (long)ring.overflowCount() == count && !ring.size())
+            break;
+    }
+    producer.join();
+    ring.drain(take);
+
+    CHECK(ordered);
+    CHECK_EQ(received + (long)ring.overflowCount(), count);
+}
+
+int main()
+{
+    testWraparound();
+    testOverflow();
+    testTwoThreads();
+    return TOUCH_TEST_RESULT();
+}
@@ -0,0 +1,30 @@
+#-------------------------------------------------
+#
+# Simulated HID devices through the device session: plugging, queue
+# growth and the raw report fallback, against a motion script.
+# ./TestSimDevice
+#
+#-------------------------------------------------
+
+TARGET = TestSimDevice
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += .. ../..
+
+SOURCES += test_sim_device.cpp \
+    ../../touch_frame.cpp \
+    ../../touch_hid_descriptor.cpp \
+    ../../touch_hid_device.cpp \
+    ../../touch_hid_queue.cpp \
+    ../../touch_layout_cache.cpp \
+    ../../touch_sim_device.cpp \
+    ../../touch_synth.cpp \
+    ../../touch_trace.cpp
+
+HEADERS += ../touch_test.h \
+    ../../touch_hid_device.h \
+    ../../touch_hid_queue.h \
+    ../../touch_sim_device.h
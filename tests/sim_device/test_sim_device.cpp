@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "touch_sim_device.h"
+#include "touch_test.h"
+
+#define INTERVAL_NS 1000000ull      /* a report every millisecond */
+
+/* two contacts down throughout, moving apart and across */
+static const char *g_Script =
+    "# ms contact x y\n"
+    "0 1 0.1 0.2\n"
+    "2000 1 0.9 0.8\n"
+    "0 2 0.5 0.5\n"
+    "2000 2 0.3 0.7\n"
+    "10000 2 0.3 0.7\n";
+
+struct Received {
+    std::mutex lock;
+    std::vector<struct TouchFrame> frames;
+};
+
+static void CollectFrame(const struct TouchFrame *frame, void *context)
+{
+    struct Received *received = (struct Received *)context;
+    std::lock_guard<std::mutex> lock(received->lock);
+    received->frames.push_back(*frame);
+}
+
+static SimDeviceConfig scriptedConfig()
+{
+    SimDeviceConfig config;
+    CHECK(config.script.parse(g_Script));
+    return config;
+}
+
+/* screen pixels, the decoders may round differently from here */
+static bool near(int value, int logical, int screen)
+{
+    return abs(value - (int)((double)logical * screen / TOUCH_SYNTH_LOGICAL_MAX)) <= 1;
+}
+
+/* a decoded frame against the script at time t */
+static bool matchesScript(const SimMotionScript &script, const struct TouchFrame &frame, uint64_t t)
+{
+    struct TouchFrame expected;
+    script.frameAt(t, &expected);
+    if (frame.count != expected.count)
+        return false;
+    for (int i = 0; i < expected.count; i++) {
+        const struct TouchContact &c = frame.contacts[i];
+        const struct TouchContact &e = expected.contacts[i];
+        if (c.id != e.id || !near(c.x, e.x, TOUCH_SCREEN_WIDTH) || !near(c.y, e.y, TOUCH_SCREEN_HEIGHT)
+                || !(c.flags & TOUCH_CONTACT_TIP))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * A device on its queue, generating and servicing by hand so the test
+ * decides when the host is late. Report n is stamped n * INTERVAL_NS,
+ * from 1 since a zero stamp reads as none.
+ */
+struct Plugged {
+    SimulatedHidDevice device;
+    HidDeviceSession session;
+    struct Received received;
+    SimulatedHidQueue *queue;
+    uint64_t next;
+
+    explicit Plugged(const SimDeviceConfig &config, bool fallback = false) :
+        device(config), queue(0), next(1)
+    {
+        session.setRequestedFields(TOUCH_FIELDS_ALL);
+        session.setQueueFallback(fallback);
+        CHECK(session.open(&device, 0, CollectFrame, &received));
+        CHECK(session.hasReportLayout());
+        CHECK(session.setupQueue() != 0);
+        queue = device.queue();
+        CHECK(queue && queue == session.queue());
+        if (queue)
+            queue->start();
+    }
+
+    void generate(int reports) {
+        for (int i = 0; i < reports; i++, next++)
+            device.generate(next * INTERVAL_NS, session.rawReports() ? 0 : queue);
+    }
+
+    void service() { session.serviceQueue(next * INTERVAL_NS); }
+
+    void run(int reports) {
+        for (int i = 0; i < reports; i++) {
+            generate(1);
+            service();
+        }
+    }
+
+    /* frames stamped with their report's time, all as the script has them */
+    bool framesMatch(const SimMotionScript &script) {
+        std::lock_guard<std::mutex> lock(received.lock);
+        for (size_t i = 0; i < received.frames.size(); i++) {
+            if (!matchesScript(script, received.frames[i], received.frames[i].deviceTime))
+                return false;
+        }
+        return !received.frames.empty();
+    }
+
+    /* values the session thinks the queue lost */
+    unsigned long estimated() const {
+        struct TouchDropCounts drops;
+        memset(&drops, 0, sizeof(drops));
+        session.drops(&drops);
+        return drops.lostReports * session.queueMonitor().elementsPerReport() + drops.lostElements;
+    }
+
+    struct TouchDropCounts drops() const {
+        struct TouchDropCounts drops;
+        memset(&drops, 0, sizeof(drops));
+        session.drops(&drops);
+        return drops;
+    }
+};
+
+/* plugged twice, the second time from the layout cache; frames follow the script both times */
+static void testPlugUnplug()
+{
+    SimDeviceConfig config = scriptedConfig();
+    size_t cached = touchLayoutCache().size();
+    {
+        Plugged plugged(config);
+        plugged.run(100);
+        CHECK(plugged.framesMatch(config.script));
+        CHECK_EQ(plugged.received.frames.size(), 100);
+        plugged.session.close();
+        CHECK(!plugged.session.queue());
+    }
+    CHECK_EQ(touchLayoutCache().size(), cached + 1);
+    {
+        Plugged plugged(config);
+        plugged.next = 500;
+        plugged.run(100);
+        CHECK(plugged.framesMatch(config.script));
+        CHECK_EQ(plugged.received.frames.size(), 100);
+        CHECK_EQ(plugged.drops().overflows, 0);
+    }
+    CHECK_EQ(touchLayoutCache().size(), cached + 1);
+}
+
+/* a late service overflows the queue, which grows; the loss is what the queue turned away */
+static void testQueueGrowth()
+{
+    SimDeviceConfig config = scriptedConfig();
+    Plugged plugged(config);
+    int depth = plugged.queue->depth();
+
+    plugged.run(20);
+    CHECK_EQ(plugged.drops().overflows, 0);
+
+    plugged.generate(3 * depth / plugged.session.queueMonitor().elementsPerReport());
+    plugged.service();
+    CHECK_EQ(plugged.drops().overflows, 1);
+    CHECK(plugged.queue->depth() > depth);
+    CHECK(plugged.queue->rejected() > 0);
+
+    /* the gap is counted once the next report arrives */
+    plugged.run(20);
+    CHECK_EQ(plugged.drops().overflows, 1);
+    CHECK(plugged.drops().lostReports > 0);
+    CHECK_EQ(plugged.estimated(), plugged.queue->rejected());
+    CHECK(plugged.framesMatch(config.script));
+}
+
+/* a queue that overflows at its largest depth is given up for raw reports */
+static void testRawFallback()
+{
+    SimDeviceConfig config = scriptedConfig();
+    Plugged plugged(config, true);
+
+    for (int i = 0; i < 100 && !plugged.session.rawReports(); i++) {
+        plugged.generate(plugged.queue->depth() / plugged.session.queueMonitor().elementsPerReport() + 10);
+        plugged.service();
+    }
+    CHECK(plugged.session.rawReports());
+    CHECK_EQ(plugged.queue->depth(), HID_QUEUE_MAX_DEPTH);
+    CHECK_EQ(plugged.drops().fallbacks, 1);
+    CHECK(plugged.drops().overflows >= HID_QUEUE_FALLBACK_OVERFLOWS);
+
+    /* the first raw report also flushes what the queue left of a report cut short */
+    unsigned long rejected = plugged.queue->rejected();
+    plugged.generate(1);
+    plugged.received.frames.clear();
+
+    /* raw reports carry no device time, each is decoded as it is generated */
+    std::vector<uint64_t> times;
+    for (int i = 0; i < 50; i++) {
+        times.push_back(plugged.next * INTERVAL_NS);
+        plugged.generate(1);
+    }
+    CHECK_EQ(plugged.queue->rejected(), rejected);
+    CHECK_EQ(plugged.received.frames.size(), 50);
+    for (size_t i = 0; i < plugged.received.frames.size() && i < times.size(); i++)
+        CHECK(matchesScript(config.script, plugged.received.frames[i], times[i]));
+}
+
+static void CollectFrames(const struct TouchFrame *frames, size_t count, void *context)
+{
+    for (size_t i = 0; i < count; i++)
+        CollectFrame(&frames[i], context);
+}
+
+/* the backend's devices come and go on their own threads */
+static void testBackendHotPlug()
+{
+    SimDeviceConfig config = scriptedConfig();
+    config.upMs = 20;
+    config.downMs = 5;
+
+    struct Received received;
+    SimulatedTouchBackend backend(config, 2);
+    backend.setFrameCallback(CollectFrames, &received);
+    CHECK(backend.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    backend.stop();
+
+    CHECK(backend.plugs() >= 4);
+    CHECK(backend.reports() > 0);
+    CHECK(backend.devices().empty());
+
+    std::lock_guard<std::mutex> lock(received.lock);
+    CHECK(!received.frames.empty());
+    bool bothDevices[2] = { false, false };
+    bool match = true;
+    for (size_t i = 0; i < received.frames.size(); i++) {
+        const struct TouchFrame &frame = received.frames[i];
+        if (frame.device >= 0 && frame.device < 2)
+            bothDevices[frame.device] = true;
+        if (frame.fields & TOUCH_FIELD_DEVICE_TIME)
+            match = match && matchesScript(config.script, frame, frame.deviceTime);
+    }
+    CHECK(bothDevices[0] && bothDevices[1]);
+    CHECK(match);
+}
+
+int main()
+{
+    /* no cache file, models are only remembered for the run */
+    touchLayoutCache().setPath("");
+
+    testPlugUnplug();
+    testQueueGrowth();
+    testRawFallback();
+    testBackendHotPlug();
+    return TOUCH_TEST_RESULT();
+}
@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Unit tests that run without Qt or device access, on Linux as on the Mac.
+# Every test is a console program that exits non-zero on a failed check.
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += broadcast \
+    capture \
+    frame \
+    hid_descriptor \
+    hid_queue \
+    history \
+    layout_cache \
+    sim_device \
+    ring
+
+linux {
+    SUBDIRS += evdev
+}
@@ -0,0 +1,33 @@
+#ifndef TOUCH_TEST_H
+#define TOUCH_TEST_H
+
+#include <stdio.h>
+
+/*
+ * Just enough for the tests here: CHECK reports a failed condition and
+ * keeps going, TOUCH_TEST_RESULT is what main() returns.
+ */
+static int g_TestFailures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            g_TestFailures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        long long _a = (long long)(a), _b = (long long)(b); \
+        if (_a != _b) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", \
+                    __FILE__, __LINE__, #a, #b, _a, _b); \
+            g_TestFailures++; \
+        } \
+    } while (0)
+
+#define TOUCH_TEST_RESULT() \
+    (g_TestFailures ? (fprintf(stderr, "%d checks failed\n", g_TestFailures), 1) : 0)
+
+#endif // TOUCH_TEST_H
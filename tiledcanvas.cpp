@@ -0,0 +1,343 @@
+#include "tiledcanvas.h"
+
+#include <QRunnable>
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+static const QImage::Format ImageFormat = QImage::Format_RGB32;
+
+#define TILE_BYTES (TILE_SIZE * TILE_SIZE * 4)
+
+/* pulls queued tiles until none are left, the GUI thread runs one too */
+class TiledCanvas::RenderJob : public QRunnable
+{
+public:
+    RenderJob(TiledCanvas *canvas, std::atomic<int> *next) :
+        _canvas(canvas),
+        _next(next)
+    {
+        setAutoDelete(true);
+    }
+
+    void run() {
+        _canvas->renderQueued(_next);
+    }
+
+private:
+    TiledCanvas *_canvas;
+    std::atomic<int> *_next;
+};
+
+TiledCanvas::TiledCanvas(const QSize &size) :
+    _columns(0),
+    _rows(0),
+    _pendingSegments(0),
+    _background(TILE_SIZE, TILE_SIZE, ImageFormat),
+    _frame(0),
+    _residentTiles(0),
+    _compressedTiles(0),
+    _compressedBytes(0),
+    _residentLimit(TILE_RESIDENT_LIMIT)
+{
+    _background.fill(0);
+    resize(size);
+    fill(0);
+}
+
+TiledCanvas::~TiledCanvas()
+{
+    _pool.waitForDone();
+}
+
+/* keeps the tiles that still fit, the ones added are stale */
+void TiledCanvas::resize(const QSize &size)
+{
+    int columns = size.width() > 0 ? (size.width() + TILE_SIZE - 1) / TILE_SIZE : 0;
+    int rows = size.height() > 0 ? (size.height() + TILE_SIZE - 1) / TILE_SIZE : 0;
+
+    std::vector<Tile> tiles(columns * rows);
+    for (int row = 0; row < rows; row++) {
+        for (int column = 0; column < columns; column++) {
+            Tile *tile = &tiles[row * columns + column];
+            if (row < _rows && column < _columns) {
+                std::swap(*tile, _tiles[row * _columns + column]);
+                tile->pending.clear();
+            }
+            else {
+                tile->state = TileStale;
+            }
+            tile->dirty = true;
+        }
+    }
+
+    _size = size;
+    _columns = columns;
+    _rows = rows;
+    _tiles.swap(tiles);
+    _queued.clear();
+    _pendingSegments = 0;
+    recount();
+}
+
+void TiledCanvas::recount()
+{
+    _residentTiles = 0;
+    _compressedTiles = 0;
+    _compressedBytes = 0;
+    for (size_t i = 0; i < _tiles.size(); i++) {
+        if (!_tiles[i].image.isNull())
+            _residentTiles++;
+        if (!_tiles[i].packed.isEmpty()) {
+            _compressedTiles++;
+            _compressedBytes += _tiles[i].packed.size();
+        }
+    }
+}
+
+bool TiledCanvas::hasStale() const
+{
+    for (size_t i = 0; i < _tiles.size(); i++) {
+        if (_tiles[i].state == TileStale)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Starts a replay pass over the stale tiles in first, or over all stale
+ * tiles if none of them is in first. Returns the number of tiles taken.
+ */
+int TiledCanvas::beginReplay(const QRegion &first)
+{
+    int taken = 0;
+    for (int pass = 0; pass < 2 && !taken; pass++) {
+        for (size_t i = 0; i < _tiles.size(); i++) {
+            if (_tiles[i].state != TileStale)
+                continue;
+            if (pass == 0 && !first.intersects(tileRect((int)i)))
+                continue;
+            _tiles[i].state = TileReplaying;
+            taken++;
+        }
+    }
+    return taken;
+}
+
+void TiledCanvas::endReplay()
+{
+    for (size_t i = 0; i < _tiles.size(); i++) {
+        if (_tiles[i].state == TileReplaying) {
+            _tiles[i].state = TileFresh;
+            _tiles[i].dirty = true;
+        }
+    }
+}
+
+/* drops all ink, every tile shows the background again */
+void TiledCanvas::fill(QRgb color)
+{
+    _background.fill(color);
+    for (size_t i = 0; i < _tiles.size(); i++) {
+        _tiles[i].image = QImage();
+        _tiles[i].packed.clear();
+        _tiles[i].pending.clear();
+        _tiles[i].state = TileFresh;
+        _tiles[i].dirty = true;
+    }
+    _queued.clear();
+    _pendingSegments = 0;
+    _residentTiles = 0;
+    _compressedTiles = 0;
+    _compressedBytes = 0;
+}
+
+size_t TiledCanvas::residentBytes() const
+{
+    return (size_t)_residentTiles * TILE_BYTES;
+}
+
+QRect TiledCanvas::tileRect(int index) const
+{
+    return QRect((index % _columns) * TILE_SIZE, (index / _columns) * TILE_SIZE,
+                 TILE_SIZE, TILE_SIZE);
+}
+
+/*
+ * Gives tile its own pixels, from the compressed copy or the background.
+ * Only touches tile, so workers may call it for the tiles they own; the
+ * counters are settled by the caller.
+ */
+void TiledCanvas::expand(Tile *tile) const
+{
+    if (!tile->image.isNull())
+        return;
+
+    tile->image = _background.copy();
+    if (!tile->packed.isEmpty()) {
+        QByteArray pixels = qUncompress(tile->packed);
+        if (pixels.size() == TILE_BYTES)
+            memcpy(tile->image.bits(), pixels.constData(), TILE_BYTES);
+        tile->packed = QByteArray();
+    }
+}
+
+/* live segments only reach fresh tiles, replayed ones only replaying tiles */
+void TiledCanvas::addSegment(const struct StrokeSegment &segment, bool replay)
+{
+    if (_tiles.empty())
+        return;
+
+    TileState state = replay ? TileReplaying : TileFresh;
+    float reach = (segment.w0 > segment.w1 ? segment.w0 : segment.w1) * 0.5f + 1.0f;
+    int left = (int)floorf(((segment.x0 < segment.x1 ? segment.x0 : segment.x1) - reach) / TILE_SIZE);
+    int right = (int)floorf(((segment.x0 > segment.x1 ? segment.x0 : segment.x1) + reach) / TILE_SIZE);
+    int top = (int)floorf(((segment.y0 < segment.y1 ? segment.y0 : segment.y1) - reach) / TILE_SIZE);
+    int bottom = (int)floorf(((segment.y0 > segment.y1 ? segment.y0 : segment.y1) + reach) / TILE_SIZE);
+
+    if (left < 0)
+        left = 0;
+    if (top < 0)
+        top = 0;
+    if (right >= _columns)
+        right = _columns - 1;
+    if (bottom >= _rows)
+        bottom = _rows - 1;
+
+    for (int row = top; row <= bottom; row++) {
+        for (int column = left; column <= right; column++) {
+            int index = row * _columns + column;
+            Tile *tile = &_tiles[index];
+            if (tile->state != state)
+                continue;
+            if (tile->pending.empty()) {
+                _queued.push_back(index);
+
+                /* render() expands it */
+                if (tile->image.isNull()) {
+                    _residentTiles++;
+                    if (!tile->packed.isEmpty()) {
+                        _compressedTiles--;
+                        _compressedBytes -= tile->packed.size();
+                    }
+                }
+            }
+            tile->pending.push_back(segment);
+            _pendingSegments++;
+        }
+    }
+}
+
+void TiledCanvas::renderTile(int index)
+{
+    Tile *tile = &_tiles[index];
+    QRect rect = tileRect(index);
+
+    expand(tile);
+    struct StrokeTarget target = {
+        (uint32_t *)tile->image.bits(), (size_t)tile->image.bytesPerLine(),
+        TILE_SIZE, TILE_SIZE, rect.x(), rect.y()
+    };
+
+    strokeSegments(target, tile->pending.data(), tile->pending.size());
+    tile->pending.clear();
+    tile->lastUse = _frame;
+    tile->dirty = true;
+}
+
+void TiledCanvas::renderQueued(std::atomic<int> *next)
+{
+    int count = (int)_queued.size();
+    for (int i = next->fetch_add(1); i < count; i = next->fetch_add(1))
+        renderTile(_queued[i]);
+}
+
+void TiledCanvas::render()
+{
+    _frame++;
+
+    if (!_queued.empty()) {
+        std::atomic<int> next(0);
+        if (_queued.size() > 1 && _pendingSegments >= TILE_INLINE_SEGMENTS) {
+            int jobs = qMin((int)_queued.size() - 1, _pool.maxThreadCount());
+            for (int i = 0; i < jobs; i++)
+                _pool.start(new RenderJob(this, &next));
+        }
+        renderQueued(&next);
+        _pool.waitForDone();
+
+        _queued.clear();
+        _pendingSegments = 0;
+    }
+
+    if (residentBytes() > _residentLimit)
+        compressCold();
+}
+
+/* compresses the least recently drawn tiles, a few per frame */
+void TiledCanvas::compressCold()
+{
+    std::vector<int> resident;
+    for (size_t i = 0; i < _tiles.size(); i++) {
+        if (!_tiles[i].image.isNull() && _tiles[i].lastUse != _frame)
+            resident.push_back((int)i);
+    }
+
+    size_t excess = (residentBytes() - _residentLimit + TILE_BYTES - 1) / TILE_BYTES;
+    size_t batch = std::min(std::min(excess, resident.size()), (size_t)TILE_COMPRESS_BATCH);
+    std::partial_sort(resident.begin(), resident.begin() + batch, resident.end(),
+                      [this](int a, int b) { return _tiles[a].lastUse < _tiles[b].lastUse; });
+
+    for (size_t i = 0; i < batch; i++) {
+        Tile *tile = &_tiles[resident[i]];
+        tile->packed = qCompress(tile->image.constBits(), TILE_BYTES, 1);
+        tile->image = QImage();
+        _residentTiles--;
+        _compressedTiles++;
+        _compressedBytes += tile->packed.size();
+    }
+}
+
+QRegion TiledCanvas::takeDirty()
+{
+    QRegion dirty;
+    for (size_t i = 0; i < _tiles.size(); i++) {
+        if (_tiles[i].dirty) {
+            dirty += tileRect((int)i);
+            _tiles[i].dirty = false;
+        }
+    }
+    return dirty;
+}
+
+void TiledCanvas::paint(QPainter &painter, const QRegion &region)
+{
+    QRect bounds = region.boundingRect().intersected(QRect(QPoint(0, 0), _size));
+    if (bounds.isEmpty())
+        return;
+
+    int left = bounds.left() / TILE_SIZE;
+    int right = bounds.right() / TILE_SIZE;
+    int top = bounds.top() / TILE_SIZE;
+    int bottom = bounds.bottom() / TILE_SIZE;
+
+    for (int row = top; row <= bottom; row++) {
+        for (int column = left; column <= right; column++) {
+            int index = row * _columns + column;
+            QRect rect = tileRect(index);
+            if (!region.intersects(rect))
+                continue;
+
+            Tile *tile = &_tiles[index];
+            if (!tile->packed.isEmpty()) {
+                _compressedTiles--;
+                _compressedBytes -= tile->packed.size();
+                expand(tile);
+                tile->lastUse = _frame;
+                _residentTiles++;
+            }
+            painter.drawImage(rect.topLeft(), tile->image.isNull() ? _background : tile->image);
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef TILEDCANVAS_H
+#define TILEDCANVAS_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QPainter>
+#include <QRegion>
+#include <QSize>
+#include <QThreadPool>
+
+#include <atomic>
+#include <vector>
+
+#include "touch_stroke.h"
+
+#define TILE_SIZE 128
+
+/* below this many binned segments a frame is rasterized on the calling thread */
+#define TILE_INLINE_SEGMENTS 64
+
+/* resident tile memory before cold tiles get compressed */
+#define TILE_RESIDENT_LIMIT (64 * 1024 * 1024)
+
+/* at most this many tiles are compressed per render() */
+#define TILE_COMPRESS_BATCH 4
+
+/*
+ * Sparse drawing surface split into TILE_SIZE square RGB32 tiles.
+ *
+ * Tiles no stroke has touched own no pixels and are painted from one
+ * shared background tile, so memory follows the inked area rather than
+ * the surface. Segments are binned to every tile their bounds touch and
+ * rasterized by render(), with tiles spread over a worker pool; a tile is
+ * only ever touched by one thread at a time, so no locking is needed.
+ * Tiles that changed since the last takeDirty() form the region to
+ * repaint.
+ *
+ * Once the resident tiles exceed the resident limit, the least recently
+ * drawn ones are compressed and only expanded again when drawn into or
+ * painted.
+ *
+ * Resizing keeps every tile that still fits. Tiles it adds are stale: they
+ * show the background and ignore live segments until the owner replays
+ * the stroke history into them between beginReplay() and endReplay().
+ */
+class TiledCanvas
+{
+public:
+    explicit TiledCanvas(const QSize &size = QSize());
+    ~TiledCanvas();
+
+    void resize(const QSize &size);
+    QSize size() const { return _size; }
+    void fill(QRgb color);
+
+    void addSegment(const struct StrokeSegment &segment, bool replay = false);
+
+    bool hasStale() const;
+    int beginReplay(const QRegion &first);
+    void endReplay();
+    void render();
+    QRegion takeDirty();
+
+    void paint(QPainter &painter, const QRegion &region);
+
+    void setResidentLimit(size_t bytes) { _residentLimit = bytes; }
+    size_t residentBytes() const;
+    size_t compressedBytes() const { return _compressedBytes; }
+
+    int columns() const { return _columns; }
+    int rows() const { return _rows; }
+    int residentTiles() const { return _residentTiles; }
+    int compressedTiles() const { return _compressedTiles; }
+
+private:
+    enum TileState {
+        TileFresh,          /* up to date with the live stroke stream */
+        TileStale,          /* waiting for a replay */
+        TileReplaying       /* taking replayed segments only */
+    };
+
+    struct Tile {
+        Tile() : lastUse(0), state(TileFresh), dirty(true) {}
+
+        QImage image;       /* null until inked or while compressed */
+        QByteArray packed;  /* qCompress()ed pixels of a cold tile */
+        std::vector<struct StrokeSegment> pending;
+        unsigned long lastUse;
+        TileState state;
+        bool dirty;
+    };
+
+    class RenderJob;
+
+    QRect tileRect(int index) const;
+    void expand(Tile *tile) const;
+    void compressCold();
+    void recount();
+    void renderTile(int index);
+    void renderQueued(std::atomic<int> *next);
+
+    QSize _size;
+    int _columns;
+    int _rows;
+    std::vector<Tile> _tiles;
+    std::vector<int> _queued;       /* tiles with pending segments */
+    size_t _pendingSegments;
+    QImage _background;             /* shared by every tile without ink */
+    unsigned long _frame;           /* render() calls, for tile age */
+    int _residentTiles;
+    int _compressedTiles;
+    size_t _compressedBytes;
+    size_t _residentLimit;
+    QThreadPool _pool;
+};
+
+#endif // TILEDCANVAS_H
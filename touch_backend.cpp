@@ -0,0 +1,253 @@
+#include "touch_backend.h"
+#include "touch_broadcast.h"
+#include "touch_capture.h"
+#include "touch_clock.h"
+#include "touch_trace.h"
+
+#ifdef __linux__
+#include "touch_evdev.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <mutex>
+
+static TouchBackend *gBackend = 0;
+static TouchCaptureWriter gCapture;
+static TouchBroadcastPublisher gBroadcast;
+static std::string gReplayPath;
+static double gReplaySpeed = 1.0;
+static unsigned gRequestedFields = TOUCH_FIELDS_ALL;
+
+/* devices may deliver from threads of their own, the capture and broadcast are shared */
+static std::mutex gSinkLock;
+
+static void SubmitFrames(const struct TouchFrame *frames, size_t count, void *)
+{
+    if (touchTraceEnabled()) {
+        for (size_t i = 0; i < count; i++)
+            touchTraceWrite(TraceFrame, frames[i].count, frames[i].deviceTime, frames[i].hostTime);
+    }
+
+    if (gCapture.isOpen() || gBroadcast.isOpen()) {
+        std::lock_guard<std::mutex> lock(gSinkLock);
+        if (gCapture.isOpen()) {
+            uint64_t now = touchMonotonicNs();
+            for (size_t i = 0; i < count; i++)
+                gCapture.write(&frames[i], now);
+        }
+        if (gBroadcast.isOpen())
+            gBroadcast.publish(frames, count);
+    }
+
+    submitTouchFrame(frames, count);
+}
+
+TouchBackendGroup::TouchBackendGroup(const std::vector<TouchBackend *> &members) :
+    _members(members)
+{
+    for (size_t i = 0; i < _members.size(); i++) {
+        _members[i]->setDeviceId((int)i);
+        _members[i]->setFrameCallback(forward, this);
+    }
+}
+
+TouchBackendGroup::~TouchBackendGroup()
+{
+    stop();
+    for (size_t i = 0; i < _members.size(); i++)
+        delete _members[i];
+}
+
+void TouchBackendGroup::forward(const struct TouchFrame *frames, size_t count, void *context)
+{
+    ((TouchBackendGroup *)context)->deliver(frames, count);
+}
+
+/* succeeds if any member could be started */
+bool TouchBackendGroup::start()
+{
+    bool started = false;
+    for (size_t i = 0; i < _members.size(); i++) {
+        _members[i]->requestFields(requestedFields());
+        if (_members[i]->start())
+            started = true;
+    }
+    return started;
+}
+
+void TouchBackendGroup::stop()
+{
+    for (size_t i = 0; i < _members.size(); i++)
+        _members[i]->stop();
+}
+
+std::vector<TouchDeviceInfo> TouchBackendGroup::devices() const
+{
+    std::vector<TouchDeviceInfo> list;
+    for (size_t i = 0; i < _members.size(); i++) {
+        std::vector<TouchDeviceInfo> member = _members[i]->devices();
+        list.insert(list.end(), member.begin(), member.end());
+    }
+    return list;
+}
+
+/* what every member fills in */
+unsigned TouchBackendGroup::fields() const
+{
+    unsigned fields = TOUCH_FIELDS_ALL;
+    for (size_t i = 0; i < _members.size(); i++)
+        fields &= _members[i]->fields();
+    return fields;
+}
+
+bool TouchBackendGroup::finished() const
+{
+    for (size_t i = 0; i < _members.size(); i++) {
+        if (!_members[i]->finished())
+            return false;
+    }
+    return true;
+}
+
+void TouchBackendGroup::drops(struct TouchDropCounts *drops) const
+{
+    for (size_t i = 0; i < _members.size(); i++)
+        _members[i]->drops(drops);
+}
+
+TouchBackend *createDefaultTouchBackend()
+{
+    /* TOUCH_SIM replaces the devices by simulated ones, e.g. devices=4,rate=8000,up=2000,down=200 */
+    const char *sim = getenv("TOUCH_SIM");
+    if (sim && *sim)
+        return createSimulatedTouchBackend(sim);
+
+#if defined(__APPLE__)
+    return createOSXTouchBackend();
+#elif defined(__linux__)
+    /* TOUCH_EVDEV_DEVICE names event nodes separated by commas, otherwise take every multitouch one */
+    std::vector<std::string> paths;
+    const char *list = getenv("TOUCH_EVDEV_DEVICE");
+    if (list && *list) {
+        std::string rest = list;
+        size_t comma;
+        while ((comma = rest.find(',')) != std::string::npos) {
+            if (comma)
+                paths.push_back(rest.substr(0, comma));
+            rest.erase(0, comma + 1);
+        }
+        if (!rest.empty())
+            paths.push_back(rest);
+    }
+    else {
+        std::vector<TouchDeviceInfo> found = EvdevTouchBackend::enumerate();
+        for (size_t i = 0; i < found.size(); i++)
+            paths.push_back(found[i].path);
+    }
+
+    if (paths.size() > TOUCH_MAX_DEVICES)
+        paths.resize(TOUCH_MAX_DEVICES);
+    if (paths.empty())
+        return 0;
+    if (paths.size() == 1)
+        return new EvdevTouchBackend(paths[0].c_str());
+
+    std::vector<TouchBackend *> members;
+    for (size_t i = 0; i < paths.size(); i++)
+        members.push_back(new EvdevTouchBackend(paths[i].c_str()));
+    return new TouchBackendGroup(members);
+#else
+    return 0;
+#endif
+}
+
+void startTouchLoop(void)
+{
+    if (gBackend)
+        return;
+
+    if (!gReplayPath.empty())
+        gBackend = new TouchReplayBackend(gReplayPath.c_str(), gReplaySpeed);
+    else
+        gBackend = createDefaultTouchBackend();
+    if (!gBackend)
+        return;
+
+    gBackend->setFrameCallback(SubmitFrames, 0);
+    gBackend->requestFields(gRequestedFields);
+    if (!gBackend->start()) {
+        delete gBackend;
+        gBackend = 0;
+    }
+}
+
+void stopTouchLoop(void)
+{
+    if (!gBackend)
+        return;
+
+    gBackend->stop();
+    delete gBackend;
+    gBackend = 0;
+}
+
+int touchLoopFinished(void)
+{
+    return !gBackend || gBackend->finished();
+}
+
+void requestTouchFields(unsigned fields)
+{
+    gRequestedFields = fields;
+    if (gBackend)
+        gBackend->requestFields(fields);
+}
+
+int queryTouchCapabilities(struct TouchCapabilities *caps)
+{
+    if (!gBackend)
+        return 0;
+
+    caps->version = TOUCH_API_VERSION;
+    caps->fields = gBackend->fields() & gRequestedFields;
+    caps->maxContacts = TOUCH_MAX_CONTACTS;
+    return 1;
+}
+
+int queryTouchDrops(struct TouchDropCounts *drops)
+{
+    memset(drops, 0, sizeof(*drops));
+    if (!gBackend)
+        return 0;
+
+    gBackend->drops(drops);
+    return 1;
+}
+
+void selectTouchReplay(const char *path, double speed)
+{
+    gReplayPath = path ? path : "";
+    gReplaySpeed = speed;
+}
+
+int startTouchCapture(const char *path)
+{
+    return gCapture.open(path);
+}
+
+void stopTouchCapture(void)
+{
+    gCapture.close();
+}
+
+int startTouchBroadcast(const char *name)
+{
+    return gBroadcast.open(name);
+}
+
+void stopTouchBroadcast(void)
+{
+    gBroadcast.close();
+}
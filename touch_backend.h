@@ -0,0 +1,110 @@
+#ifndef TOUCH_BACKEND_H
+#define TOUCH_BACKEND_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "touch_shared.h"
+
+typedef void (*TouchFramesCallback)(const struct TouchFrame *frames, size_t count, void *context);
+
+struct TouchDeviceInfo {
+    std::string name;
+    std::string path;
+    int vendorId;
+    int productId;
+};
+
+/*
+ * A source of assembled touch frames.
+ *
+ * start() begins acquisition on whatever thread or run loop the platform
+ * needs, stop() tears it down again. Frames are handed to the callback in
+ * batches, in the order the device produced them, from the acquisition
+ * thread.
+ *
+ * fields() is what the backend can fill in; consumers narrow it with
+ * requestFields() so work nobody reads can be skipped.
+ *
+ * finished() turns true once a backend that runs out of input, like a
+ * replay, has delivered its last frame; devices never finish.
+ *
+ * drops() adds what was lost before frames could be assembled, as far as
+ * the backend can tell.
+ *
+ * A backend serving a single device stamps its frames with deviceId();
+ * backends that find devices on their own number them themselves.
+ */
+class TouchBackend
+{
+public:
+    TouchBackend() : _callback(0), _context(0), _requested(TOUCH_FIELDS_ALL), _device(0) {}
+    virtual ~TouchBackend() {}
+
+    void setFrameCallback(TouchFramesCallback callback, void *context) {
+        _callback = callback;
+        _context = context;
+    }
+
+    virtual const char *name() const = 0;
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+    virtual std::vector<TouchDeviceInfo> devices() const = 0;
+    virtual unsigned fields() const = 0;
+    virtual bool finished() const { return false; }
+    virtual void drops(struct TouchDropCounts *) const {}
+
+    void requestFields(unsigned fields) { _requested = fields; }
+    unsigned requestedFields() const { return _requested; }
+
+    void setDeviceId(int device) { _device = device; }
+    int deviceId() const { return _device; }
+
+    void deliver(const struct TouchFrame *frames, size_t count) const {
+        if (_callback && count)
+            _callback(frames, count, _context);
+    }
+
+private:
+    TouchFramesCallback _callback;
+    void *_context;
+    unsigned _requested;
+    int _device;
+};
+
+/*
+ * Runs several single device backends as one, each numbered by its
+ * position and delivering from its own thread. Takes ownership.
+ */
+class TouchBackendGroup : public TouchBackend
+{
+public:
+    explicit TouchBackendGroup(const std::vector<TouchBackend *> &members);
+    ~TouchBackendGroup();
+
+    const char *name() const { return "group"; }
+    bool start();
+    void stop();
+    std::vector<TouchDeviceInfo> devices() const;
+    unsigned fields() const;
+    bool finished() const;
+    void drops(struct TouchDropCounts *drops) const;
+
+private:
+    static void forward(const struct TouchFrame *frames, size_t count, void *context);
+
+    std::vector<TouchBackend *> _members;
+};
+
+/* the acquisition backend for the platform we were built for, or the simulated devices TOUCH_SIM asks for */
+TouchBackend *createDefaultTouchBackend();
+
+/* simulated HID devices as a spec describes them, see touch_sim_device.h */
+TouchBackend *createSimulatedTouchBackend(const char *spec);
+
+#ifdef __APPLE__
+TouchBackend *createOSXTouchBackend();
+#endif
+
+#endif // TOUCH_BACKEND_H
@@ -0,0 +1,296 @@
+#include "touch_broadcast.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <chrono>
+#include <thread>
+
+/* without a futex a waiting reader looks this often */
+#define BROADCAST_POLL_US 500
+
+static size_t BroadcastSize()
+{
+    return sizeof(TouchBroadcastHeader) + TOUCH_BROADCAST_SLOTS * sizeof(TouchBroadcastSlot);
+}
+
+#ifdef __linux__
+/* shared, not private: the waiters live in other processes */
+static void FutexWake(std::atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT32_MAX, 0, 0, 0);
+}
+
+static void FutexWait(std::atomic<uint32_t> *word, uint32_t value, int timeoutMs)
+{
+    struct timespec timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, &timeout, 0, 0);
+}
+#endif
+
+TouchBroadcastPublisher::TouchBroadcastPublisher() :
+    _header(0),
+    _slots(0),
+    _size(0)
+{
+    _name[0] = 0;
+}
+
+TouchBroadcastPublisher::~TouchBroadcastPublisher()
+{
+    close();
+}
+
+bool TouchBroadcastPublisher::open(const char *name)
+{
+    close();
+
+    if (strlen(name) >= sizeof(_name))
+        return false;
+
+    /* readers of an older broadcast keep their mapping and see it closed */
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return false;
+
+    size_t size = BroadcastSize();
+    void *data = MAP_FAILED;
+    if (!ftruncate(fd, (off_t)size))
+        data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        shm_unlink(name);
+        return false;
+    }
+
+    /* fresh pages are zero, which is an empty ring with no slot written */
+    _header = (TouchBroadcastHeader *)data;
+    _slots = (TouchBroadcastSlot *)(_header + 1);
+    _size = size;
+    strcpy(_name, name);
+
+    _header->version = TOUCH_BROADCAST_VERSION;
+    _header->headerSize = sizeof(TouchBroadcastHeader);
+    _header->slotSize = sizeof(TouchBroadcastSlot);
+    _header->slotCount = TOUCH_BROADCAST_SLOTS;
+    _header->magic.store(TOUCH_BROADCAST_MAGIC, std::memory_order_release);
+    return true;
+}
+
+void TouchBroadcastPublisher::close()
+{
+    if (!_header)
+        return;
+
+    _header->closed.store(1, std::memory_order_release);
+    _header->wake.fetch_add(1, std::memory_order_release);
+#ifdef __linux__
+    FutexWake(&_header->wake);
+#endif
+
+    shm_unlink(_name);
+    munmap(_header, _size);
+    _header = 0;
+    _slots = 0;
+    _size = 0;
+    _name[0] = 0;
+}
+
+void TouchBroadcastPublisher::publish(const struct TouchFrame *frames, size_t count)
+{
+    if (!_header || !count)
+        return;
+
+    uint64_t head = _header->head.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; i++, head++) {
+        TouchBroadcastSlot *slot = &_slots[head & (TOUCH_BROADCAST_SLOTS - 1)];
+        slot->sequence.store(2 * head + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&slot->frame, &frames[i], sizeof(slot->frame));
+        slot->sequence.store(2 * head + 2, std::memory_order_release);
+    }
+    _header->head.store(head, std::memory_order_release);
+
+    /* one wakeup per batch, and only a syscall if somebody sleeps */
+    _header->wake.fetch_add(1, std::memory_order_seq_cst);
+#ifdef __linux__
+    if (_header->waiters.load(std::memory_order_seq_cst))
+        FutexWake(&_header->wake);
+#endif
+}
+
+TouchBroadcastReader::TouchBroadcastReader() :
+    _header(0),
+    _slots(0),
+    _size(0),
+    _next(0),
+    _lost(0),
+    _held(0)
+{
+}
+
+TouchBroadcastReader::~TouchBroadcastReader()
+{
+    close();
+}
+
+bool TouchBroadcastReader::open(const char *name)
+{
+    close();
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    void *data = MAP_FAILED;
+    if (!fstat(fd, &info) && (size_t)info.st_size >= sizeof(TouchBroadcastHeader))
+        data = mmap(0, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    TouchBroadcastHeader *header = (TouchBroadcastHeader *)data;
+    if (header->magic.load(std::memory_order_acquire) != TOUCH_BROADCAST_MAGIC
+            || header->version != TOUCH_BROADCAST_VERSION
+            || header->slotSize != sizeof(TouchBroadcastSlot)
+            || header->slotCount != TOUCH_BROADCAST_SLOTS
+            || (size_t)info.st_size < header->headerSize + (size_t)header->slotCount * header->slotSize) {
+        munmap(data, (size_t)info.st_size);
+        return false;
+    }
+
+    _header = header;
+    _slots = (TouchBroadcastSlot *)((uint8_t *)data + header->headerSize);
+    _size = (size_t)info.st_size;
+    _next = _header->head.load(std::memory_order_acquire);
+    _lost = 0;
+    _held = 0;
+    return true;
+}
+
+void TouchBroadcastReader::close()
+{
+    if (_header)
+        munmap(_header, _size);
+    _header = 0;
+    _slots = 0;
+    _size = 0;
+    _held = 0;
+}
+
+/* moves a reader that fell a ring behind to the oldest frame still there */
+void TouchBroadcastReader::resync(uint64_t head)
+{
+    uint64_t oldest = head > TOUCH_BROADCAST_SLOTS ? head - TOUCH_BROADCAST_SLOTS : 0;
+    if (_next < oldest) {
+        _lost += oldest - _next;
+        _next = oldest;
+    }
+}
+
+const struct TouchFrame *TouchBroadcastReader::acquire()
+{
+    if (!_header)
+        return 0;
+
+    for (;;) {
+        uint64_t head = _header->head.load(std::memory_order_acquire);
+        if (_next >= head)
+            return 0;
+        resync(head);
+
+        const TouchBroadcastSlot *slot = &_slots[_next & (TOUCH_BROADCAST_SLOTS - 1)];
+        if (slot->sequence.load(std::memory_order_acquire) == 2 * _next + 2) {
+            _held = slot;
+            return &slot->frame;
+        }
+
+        /* overwritten between reading head and the slot */
+        _lost++;
+        _next++;
+    }
+}
+
+bool TouchBroadcastReader::release()
+{
+    if (!_held)
+        return false;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    bool intact = _held->sequence.load(std::memory_order_relaxed) == 2 * _next + 2;
+    if (!intact)
+        _lost++;
+    _held = 0;
+    _next++;
+    return intact;
+}
+
+size_t TouchBroadcastReader::read(struct TouchFrame *out, size_t max)
+{
+    size_t n = 0;
+    while (n < max) {
+        const struct TouchFrame *frame = acquire();
+        if (!frame)
+            break;
+        memcpy(&out[n], frame, sizeof(*frame));
+        if (release())
+            n++;
+    }
+    return n;
+}
+
+uint64_t TouchBroadcastReader::pending() const
+{
+    if (!_header)
+        return 0;
+    uint64_t head = _header->head.load(std::memory_order_acquire);
+    return head > _next ? head - _next : 0;
+}
+
+bool TouchBroadcastReader::publisherClosed() const
+{
+    return !_header || _header->closed.load(std::memory_order_acquire);
+}
+
+bool TouchBroadcastReader::wait(int timeoutMs)
+{
+    if (!_header)
+        return false;
+
+#ifdef __linux__
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()
+            + std::chrono::milliseconds(timeoutMs);
+    _header->waiters.fetch_add(1, std::memory_order_seq_cst);
+    for (;;) {
+        uint32_t wake = _header->wake.load(std::memory_order_seq_cst);
+        if (pending() || publisherClosed())
+            break;
+        int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                    end - std::chrono::steady_clock::now()).count();
+        if (left <= 0)
+            break;
+        FutexWait(&_header->wake, wake, left);
+    }
+    _header->waiters.fetch_sub(1, std::memory_order_seq_cst);
+#else
+    /* no cross-process futex to sleep on, poll instead */
+    for (int waited = 0; !pending() && !publisherClosed() && waited < timeoutMs * 1000;
+         waited += BROADCAST_POLL_US)
+        std::this_thread::sleep_for(std::chrono::microseconds(BROADCAST_POLL_US));
+#endif
+    return pending() != 0;
+}
@@ -0,0 +1,134 @@
+#ifndef TOUCH_BROADCAST_H
+#define TOUCH_BROADCAST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "touch_shared.h"
+
+/*
+ * Shared memory layout of a touch broadcast, a POSIX shm object holding
+ *
+ *   TouchBroadcastHeader
+ *   TouchBroadcastSlot[header.slotCount]
+ *
+ * One publisher writes frame n to slot n % slotCount. Every slot is a
+ * seqlock: its sequence is 2n + 1 while frame n is written and 2n + 2
+ * once it is complete, so a reader can tell a finished slot from one that
+ * is being or has been overwritten without ever taking a lock. Readers
+ * only write the waiter count, the publisher never waits for them.
+ */
+#define TOUCH_BROADCAST_MAGIC   0x43425354u     /* "TSBC" */
+#define TOUCH_BROADCAST_VERSION 1
+
+/* a power of two, about four seconds of a 240 Hz digitizer */
+#define TOUCH_BROADCAST_SLOTS   1024
+
+#define TOUCH_BROADCAST_NAME    "/touchtest"
+
+struct TouchBroadcastHeader {
+    std::atomic<uint32_t> magic;            /* stored last, once the rest is set up */
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t slotSize;
+    uint32_t slotCount;
+    uint32_t reserved;
+    alignas(64) std::atomic<uint64_t> head;         /* frames published */
+    alignas(64) std::atomic<uint32_t> wake;         /* bumped after every batch, the futex word */
+    std::atomic<uint32_t> waiters;                  /* readers blocked on wake */
+    std::atomic<uint32_t> closed;                   /* the publisher went away */
+};
+
+struct TouchBroadcastSlot {
+    std::atomic<uint64_t> sequence;
+    struct TouchFrame frame;
+};
+
+/*
+ * The writing side, owned by the process that runs the backend. Creating
+ * a broadcast under a name replaces whatever was published there before;
+ * readers of the old one see it closed and have to open it again.
+ */
+class TouchBroadcastPublisher
+{
+public:
+    TouchBroadcastPublisher();
+    ~TouchBroadcastPublisher();
+
+    bool open(const char *name);
+    void close();
+    bool isOpen() const { return _header != 0; }
+
+    /* called from the acquisition thread only */
+    void publish(const struct TouchFrame *frames, size_t count);
+
+private:
+    TouchBroadcastHeader *_header;
+    TouchBroadcastSlot *_slots;
+    size_t _size;
+    char _name[64];
+};
+
+/*
+ * The client library, one per reader process and broadcast. Each reader
+ * keeps its own cursor; a reader that falls more than a ring behind skips
+ * ahead to the oldest frame still there and counts what it missed.
+ *
+ *     TouchBroadcastReader reader;
+ *     reader.open(TOUCH_BROADCAST_NAME);
+ *     for (;;) {
+ *         reader.wait(100);
+ *         while (const struct TouchFrame *frame = reader.acquire()) {
+ *             ... use frame in place ...
+ *             if (!reader.release())
+ *                 ... frame was overwritten meanwhile, discard what was read ...
+ *         }
+ *     }
+ */
+class TouchBroadcastReader
+{
+public:
+    TouchBroadcastReader();
+    ~TouchBroadcastReader();
+
+    /* starts at the newest frame, older ones are not delivered */
+    bool open(const char *name);
+    void close();
+    bool isOpen() const { return _header != 0; }
+
+    /*
+     * The next frame, in place in shared memory, or 0 if there is none
+     * yet. The frame stays valid until release(), which returns false if
+     * the publisher overwrote it meanwhile and the contents can't be
+     * trusted. Either way the cursor moves on.
+     */
+    const struct TouchFrame *acquire();
+    bool release();
+
+    /* copying variant, returns the number of frames stored in out */
+    size_t read(struct TouchFrame *out, size_t max);
+
+    /* blocks up to timeoutMs for a frame past the cursor, false on timeout */
+    bool wait(int timeoutMs);
+
+    /* frames published but not yet read */
+    uint64_t pending() const;
+    /* frames skipped because this reader lagged behind */
+    uint64_t lost() const { return _lost; }
+    /* the publisher closed the broadcast, nothing more will come */
+    bool publisherClosed() const;
+
+private:
+    void resync(uint64_t head);
+
+    TouchBroadcastHeader *_header;
+    TouchBroadcastSlot *_slots;
+    size_t _size;
+    uint64_t _next;                 /* sequence of the next frame to read */
+    uint64_t _lost;
+    const TouchBroadcastSlot *_held;
+};
+
+#endif // TOUCH_BROADCAST_H
@@ -0,0 +1,306 @@
+#include "touch_capture.h"
+#include "touch_clock.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#define CAPTURE_BUFFER_SIZE (256 * 1024)
+#define REPLAY_BATCH 64
+
+TouchCaptureWriter::TouchCaptureWriter() :
+    _file(0),
+    _ownsFile(false),
+    _start(0),
+    _last(0),
+    _frames(0)
+{
+}
+
+TouchCaptureWriter::~TouchCaptureWriter()
+{
+    close();
+}
+
+bool TouchCaptureWriter::open(const char *path)
+{
+    close();
+
+    _file = fopen(path, "wb");
+    if (!_file)
+        return false;
+    setvbuf(_file, 0, _IOFBF, CAPTURE_BUFFER_SIZE);
+    _ownsFile = true;
+    return writeHeader();
+}
+
+bool TouchCaptureWriter::open(FILE *file)
+{
+    close();
+
+    _file = file;
+    _ownsFile = false;
+    return writeHeader();
+}
+
+bool TouchCaptureWriter::writeHeader()
+{
+    _start = 0;
+    _last = 0;
+    _frames = 0;
+
+    struct TouchCaptureHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TOUCH_CAPTURE_MAGIC;
+    header.version = TOUCH_CAPTURE_VERSION;
+    header.headerSize = sizeof(header);
+    if (fwrite(&header, sizeof(header), 1, _file) != 1) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void TouchCaptureWriter::close()
+{
+    if (!_file)
+        return;
+
+    /* the start time is only known once the first frame arrived, pipes go without */
+    if (_frames && !fseek(_file, offsetof(struct TouchCaptureHeader, startTime), SEEK_SET))
+        fwrite(&_start, sizeof(_start), 1, _file);
+
+    if (_ownsFile)
+        fclose(_file);
+    else
+        fflush(_file);
+    _file = 0;
+}
+
+bool TouchCaptureWriter::write(const struct TouchFrame *frame, uint64_t timestamp)
+{
+    struct TouchCaptureRecord record;
+    struct TouchCaptureContact contacts[TOUCH_MAX_CONTACTS];
+
+    if (!_file)
+        return false;
+
+    if (!_frames)
+        _start = timestamp;
+
+    /* replay waits for each record in turn, so stamps never go back */
+    uint64_t stamp = timestamp > _start ? timestamp - _start : 0;
+    if (stamp < _last)
+        stamp = _last;
+
+    memset(&record, 0, sizeof(record));
+    record.timestamp = stamp;
+    record.count = (uint16_t)frame->count;
+    record.contactCount = (uint16_t)frame->contactCount;
+    record.fields = frame->fields;
+    record.device = (uint32_t)frame->device;
+
+    for (int i = 0; i < frame->count; i++) {
+        contacts[i].id = frame->contacts[i].id;
+        contacts[i].x = frame->contacts[i].x;
+        contacts[i].y = frame->contacts[i].y;
+        contacts[i].flags = frame->contacts[i].flags;
+    }
+
+    if (fwrite(&record, sizeof(record), 1, _file) != 1
+            || fwrite(contacts, sizeof(contacts[0]), frame->count, _file) != (size_t)frame->count)
+        return false;
+
+    _last = stamp;
+    _frames++;
+    return true;
+}
+
+TouchCaptureReader::TouchCaptureReader() :
+    _data(0),
+    _size(0),
+    _pos(0),
+    _recordSize(sizeof(struct TouchCaptureRecord))
+{
+}
+
+TouchCaptureReader::~TouchCaptureReader()
+{
+    close();
+}
+
+bool TouchCaptureReader::open(const char *path)
+{
+    struct stat st;
+    const struct TouchCaptureHeader *header;
+
+    close();
+
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct TouchCaptureHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    _data = (const uint8_t *)map;
+    _size = st.st_size;
+
+    header = (const struct TouchCaptureHeader *)_data;
+    if (header->magic != TOUCH_CAPTURE_MAGIC || header->version < 1
+            || header->version > TOUCH_CAPTURE_VERSION
+            || header->headerSize < sizeof(*header) || header->headerSize > _size) {
+        close();
+        return false;
+    }
+    _recordSize = header->version < 2 ? TOUCH_CAPTURE_RECORD_V1_SIZE : sizeof(struct TouchCaptureRecord);
+
+    rewind();
+    return true;
+}
+
+void TouchCaptureReader::close()
+{
+    if (_data)
+        munmap((void *)_data, _size);
+    _data = 0;
+    _size = 0;
+    _pos = 0;
+}
+
+void TouchCaptureReader::rewind()
+{
+    _pos = _data ? ((const struct TouchCaptureHeader *)_data)->headerSize : 0;
+}
+
+bool TouchCaptureReader::next(struct TouchFrame *frame, uint64_t *timestamp)
+{
+    if (!_data || _pos + _recordSize > _size)
+        return false;
+
+    const struct TouchCaptureRecord *record = (const struct TouchCaptureRecord *)(_data + _pos);
+    size_t length = _recordSize + record->count * sizeof(struct TouchCaptureContact);
+    if (record->count > TOUCH_MAX_CONTACTS || _pos + length > _size)
+        return false;
+
+    const struct TouchCaptureContact *contacts = (const struct TouchCaptureContact *)(_data + _pos + _recordSize);
+
+    memset(frame, 0, sizeof(*frame));
+    frame->count = record->count;
+    frame->contactCount = record->contactCount;
+    frame->fields = record->fields ? record->fields : TOUCH_CAPTURE_FIELDS;
+    frame->device = _recordSize > TOUCH_CAPTURE_RECORD_V1_SIZE ? (int)record->device : 0;
+    for (int i = 0; i < frame->count; i++) {
+        frame->contacts[i].id = contacts[i].id;
+        frame->contacts[i].x = contacts[i].x;
+        frame->contacts[i].y = contacts[i].y;
+        frame->contacts[i].flags = contacts[i].flags;
+    }
+    *timestamp = record->timestamp;
+
+    _pos += length;
+    return true;
+}
+
+TouchReplayBackend::TouchReplayBackend(const char *path, double speed) :
+    _path(path),
+    _speed(speed),
+    _finished(false),
+    _running(false)
+{
+}
+
+TouchReplayBackend::~TouchReplayBackend()
+{
+    stop();
+}
+
+std::vector<TouchDeviceInfo> TouchReplayBackend::devices() const
+{
+    std::vector<TouchDeviceInfo> list;
+    TouchDeviceInfo info;
+    info.name = "capture replay";
+    info.path = _path;
+    info.vendorId = 0;
+    info.productId = 0;
+    list.push_back(info);
+    return list;
+}
+
+bool TouchReplayBackend::start()
+{
+    if (_running || !_reader.open(_path.c_str()))
+        return false;
+
+    _running = true;
+    _finished = false;
+    _thread = std::thread(&TouchReplayBackend::run, this);
+    return true;
+}
+
+void TouchReplayBackend::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if (!_running)
+            return;
+        _running = false;
+    }
+    _wake.notify_all();
+    _thread.join();
+    _reader.close();
+}
+
+void TouchReplayBackend::run()
+{
+    struct TouchFrame batch[REPLAY_BATCH];
+    struct TouchFrame ahead;
+    uint64_t stamp;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    bool more = _reader.next(&ahead, &stamp);
+
+    while (more) {
+        uint64_t now = ~0ull;
+
+        {
+            std::unique_lock<std::mutex> lock(_lock);
+            if (_speed > 0) {
+                std::chrono::nanoseconds offset((long long)(stamp / _speed));
+                _wake.wait_until(lock, begin + offset, [this] { return !_running; });
+            }
+            if (!_running)
+                return;
+        }
+
+        /* hand over everything that is due by now in one batch */
+        if (_speed > 0) {
+            std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - begin;
+            now = (uint64_t)(elapsed.count() * _speed);
+        }
+
+        /* replayed frames count as received right now */
+        uint64_t host = touchMonotonicNs();
+        size_t count = 0;
+        do {
+            ahead.fields = (ahead.fields & ~TOUCH_FIELD_DEVICE_TIME) | TOUCH_FIELD_HOST_TIME;
+            ahead.deviceTime = host;
+            ahead.hostTime = host;
+            batch[count++] = ahead;
+            more = _reader.next(&ahead, &stamp);
+        } while (more && count < REPLAY_BATCH && stamp <= now);
+
+        deliver(batch, count);
+    }
+    _finished = true;
+}
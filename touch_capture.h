@@ -0,0 +1,138 @@
+#ifndef TOUCH_CAPTURE_H
+#define TOUCH_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "touch_backend.h"
+
+/*
+ * Capture file layout, all fields little-endian and 8 byte aligned so a
+ * mapped file can be walked in place:
+ *
+ *   TouchCaptureHeader
+ *   { TouchCaptureRecord, TouchCaptureContact[record.count] } ...
+ *
+ * Record timestamps are nanoseconds on the monotonic clock, relative to
+ * the first recorded frame, and never decrease: a frame stamped earlier
+ * than the one before it is recorded at that one's time. Version 1
+ * records end before device, those frames all come from device 0.
+ */
+#define TOUCH_CAPTURE_MAGIC     0x50414354u     /* "TCAP" */
+#define TOUCH_CAPTURE_VERSION   2
+
+#define TOUCH_CAPTURE_RECORD_V1_SIZE 16
+
+struct TouchCaptureHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t reserved;
+    uint64_t startTime;         /* touchMonotonicNs() of the first frame */
+};
+
+struct TouchCaptureRecord {
+    uint64_t timestamp;
+    uint16_t count;
+    uint16_t contactCount;
+    uint32_t fields;            /* TouchFrame.fields, 0 in older captures */
+    uint32_t device;
+    uint32_t reserved;
+};
+
+/* what a capture without recorded fields holds */
+#define TOUCH_CAPTURE_FIELDS (TOUCH_FIELD_POSITION | TOUCH_FIELD_TIP | TOUCH_FIELD_IN_RANGE \
+                              | TOUCH_FIELD_CONTACT_ID | TOUCH_FIELD_CONTACT_COUNT)
+
+struct TouchCaptureContact {
+    int32_t id;
+    int32_t x;
+    int32_t y;
+    uint32_t flags;
+};
+
+class TouchCaptureWriter
+{
+public:
+    TouchCaptureWriter();
+    ~TouchCaptureWriter();
+
+    bool open(const char *path);
+    /* writes to an already open stream, e.g. stdout; closing leaves it open */
+    bool open(FILE *file);
+    void close();
+    bool isOpen() const { return _file != 0; }
+
+    bool write(const struct TouchFrame *frame, uint64_t timestamp);
+
+    unsigned long framesWritten() const { return _frames; }
+
+private:
+    bool writeHeader();
+
+    FILE *_file;
+    bool _ownsFile;
+    uint64_t _start;
+    uint64_t _last;             /* timestamp of the last record written */
+    unsigned long _frames;
+};
+
+class TouchCaptureReader
+{
+public:
+    TouchCaptureReader();
+    ~TouchCaptureReader();
+
+    bool open(const char *path);
+    void close();
+
+    /* next frame and its timestamp relative to the start of the capture */
+    bool next(struct TouchFrame *frame, uint64_t *timestamp);
+    void rewind();
+
+private:
+    const uint8_t *_data;
+    size_t _size;
+    size_t _pos;
+    size_t _recordSize;         /* as written by the file's version */
+};
+
+/*
+ * Plays a capture file back as if it came from a device. speed scales
+ * the recorded timing (2.0 plays twice as fast); 0 delivers frames as
+ * fast as the consumer takes them.
+ */
+class TouchReplayBackend : public TouchBackend
+{
+public:
+    TouchReplayBackend(const char *path, double speed);
+    ~TouchReplayBackend();
+
+    const char *name() const { return "replay"; }
+    unsigned fields() const { return TOUCH_CAPTURE_FIELDS | TOUCH_FIELD_HOST_TIME; }
+    bool start();
+    void stop();
+    std::vector<TouchDeviceInfo> devices() const;
+    bool finished() const { return _finished; }
+
+private:
+    void run();
+
+    std::string _path;
+    double _speed;
+    std::atomic<bool> _finished;
+    TouchCaptureReader _reader;
+    std::thread _thread;
+    std::mutex _lock;
+    std::condition_variable _wake;
+    bool _running;
+};
+
+#endif // TOUCH_CAPTURE_H
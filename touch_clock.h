@@ -0,0 +1,46 @@
+#ifndef TOUCH_CLOCK_H
+#define TOUCH_CLOCK_H
+
+#include <stdint.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef __APPLE__
+/* converts a mach absolute time, e.g. an IOHID event timestamp, to ns */
+static inline uint64_t touchMachTimeToNs(uint64_t ticks)
+{
+    static mach_timebase_info_data_t timebase;
+    if (!timebase.denom)
+        mach_timebase_info(&timebase);
+    return ticks * timebase.numer / timebase.denom;
+}
+#endif
+
+/*
+ * Monotonic host time in nanoseconds. On OS X this is the mach absolute
+ * clock, the same time base IOKit stamps HID events with.
+ */
+static inline uint64_t touchMonotonicNs(void)
+{
+#ifdef __APPLE__
+    return touchMachTimeToNs(mach_absolute_time());
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TOUCH_CLOCK_H
@@ -0,0 +1,395 @@
+#include "touch_evdev.h"
+#include "touch_clock.h"
+#include "touch_trace.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define EVDEV_READ_BATCH 64
+
+#define BIT_WORD(bit) ((bit) / (8 * sizeof(unsigned long)))
+#define BIT_MASK(bit) (1ul << ((bit) % (8 * sizeof(unsigned long))))
+
+static bool HasMultitouch(int fd)
+{
+    unsigned long bits[BIT_WORD(ABS_CNT) + 1];
+
+    memset(bits, 0, sizeof(bits));
+    if (ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(bits)), bits) < 0)
+        return false;
+
+    return (bits[BIT_WORD(ABS_MT_SLOT)] & BIT_MASK(ABS_MT_SLOT))
+        && (bits[BIT_WORD(ABS_MT_POSITION_X)] & BIT_MASK(ABS_MT_POSITION_X))
+        && (bits[BIT_WORD(ABS_MT_POSITION_Y)] & BIT_MASK(ABS_MT_POSITION_Y));
+}
+
+static void ReadDeviceInfo(int fd, TouchDeviceInfo *info)
+{
+    char name[256];
+    struct input_id id;
+
+    memset(name, 0, sizeof(name));
+    if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) >= 0)
+        info->name = name;
+
+    if (ioctl(fd, EVIOCGID, &id) >= 0) {
+        info->vendorId = id.vendor;
+        info->productId = id.product;
+    }
+}
+
+std::vector<TouchDeviceInfo> EvdevTouchBackend::enumerate()
+{
+    std::vector<TouchDeviceInfo> found;
+    DIR *dir = opendir("/dev/input");
+    struct dirent *entry;
+
+    if (!dir)
+        return found;
+
+    while ((entry = readdir(dir))) {
+        if (strncmp(entry->d_name, "event", 5))
+            continue;
+
+        TouchDeviceInfo info;
+        info.path = std::string("/dev/input/") + entry->d_name;
+        info.vendorId = 0;
+        info.productId = 0;
+
+        int fd = open(info.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        if (HasMultitouch(fd)) {
+            ReadDeviceInfo(fd, &info);
+            found.push_back(info);
+        }
+        close(fd);
+    }
+    closedir(dir);
+
+    return found;
+}
+
+EvdevTouchBackend::EvdevTouchBackend(const char *path) :
+    _fd(open(path, O_RDONLY | O_CLOEXEC)),
+    _ownsFd(true)
+{
+    _info.path = path;
+    init();
+}
+
+EvdevTouchBackend::EvdevTouchBackend(int fd, bool ownsFd) :
+    _fd(fd),
+    _ownsFd(ownsFd)
+{
+    init();
+}
+
+EvdevTouchBackend::~EvdevTouchBackend()
+{
+    stop();
+    if (_ownsFd && _fd >= 0)
+        close(_fd);
+}
+
+void EvdevTouchBackend::init()
+{
+    _info.vendorId = 0;
+    _info.productId = 0;
+    _wake[0] = _wake[1] = -1;
+    _running = false;
+    _finished = false;
+    _slot = 0;
+    _dropped = false;
+    _overflows = 0;
+    _lostReports = 0;
+    _minX = _minY = 0;
+    _maxX = _maxY = 0;
+    _scale = false;
+
+    for (int i = 0; i < TOUCH_MAX_CONTACTS; i++) {
+        _slots[i].trackingId = -1;
+        _slots[i].x = 0;
+        _slots[i].y = 0;
+        _slots[i].lifted = false;
+        _slots[i].liftedId = -1;
+        _slots[i].liftedX = 0;
+        _slots[i].liftedY = 0;
+    }
+
+    if (_fd >= 0) {
+        ReadDeviceInfo(_fd, &_info);
+        queryAxes();
+
+        /* event times default to the wall clock, compare against host time */
+        int clock = CLOCK_MONOTONIC;
+        ioctl(_fd, EVIOCSCLOCKID, &clock);
+    }
+}
+
+void EvdevTouchBackend::queryAxes()
+{
+    struct input_absinfo absX, absY;
+
+    if (ioctl(_fd, EVIOCGABS(ABS_MT_POSITION_X), &absX) < 0
+            || ioctl(_fd, EVIOCGABS(ABS_MT_POSITION_Y), &absY) < 0)
+        return;
+
+    setAxisRange(absX.minimum, absX.maximum, absY.minimum, absY.maximum);
+}
+
+void EvdevTouchBackend::setAxisRange(int minX, int maxX, int minY, int maxY)
+{
+    _minX = minX;
+    _maxX = maxX;
+    _minY = minY;
+    _maxY = maxY;
+    _scale = maxX > minX && maxY > minY;
+}
+
+int EvdevTouchBackend::scaleX(int value) const
+{
+    if (!_scale)
+        return value;
+    return (int)((long long)(value - _minX) * TOUCH_SCREEN_WIDTH / (_maxX - _minX + 1));
+}
+
+int EvdevTouchBackend::scaleY(int value) const
+{
+    if (!_scale)
+        return value;
+    return (int)((long long)(value - _minY) * TOUCH_SCREEN_HEIGHT / (_maxY - _minY + 1));
+}
+
+std::vector<TouchDeviceInfo> EvdevTouchBackend::devices() const
+{
+    std::vector<TouchDeviceInfo> list;
+    if (_fd >= 0)
+        list.push_back(_info);
+    return list;
+}
+
+/* the kernel buffer overflowed, the reports up to the next SYN_REPORT are gone */
+void EvdevTouchBackend::drops(struct TouchDropCounts *drops) const
+{
+    drops->overflows += _overflows;
+    drops->lostReports += _lostReports;
+}
+
+bool EvdevTouchBackend::start()
+{
+    if (_fd < 0 || _running)
+        return false;
+
+    if (pipe(_wake) < 0)
+        return false;
+
+    _running = true;
+    _thread = std::thread(&EvdevTouchBackend::run, this);
+    return true;
+}
+
+void EvdevTouchBackend::stop()
+{
+    if (!_running)
+        return;
+
+    _running = false;
+    char c = 0;
+    if (write(_wake[1], &c, 1) < 0)
+        perror("evdev wakeup");
+    _thread.join();
+
+    close(_wake[0]);
+    close(_wake[1]);
+    _wake[0] = _wake[1] = -1;
+}
+
+void EvdevTouchBackend::run()
+{
+    struct input_event events[EVDEV_READ_BATCH];
+    std::vector<struct TouchFrame> frames;
+    size_t pending = 0;     /* bytes of a partial record carried over */
+
+    frames.reserve(EVDEV_READ_BATCH);
+
+    while (_running) {
+        struct pollfd fds[2];
+        fds[0].fd = _fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = _wake[0];
+        fds[1].events = POLLIN;
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[1].revents)
+            break;
+
+        ssize_t got = read(_fd, (char *)events + pending, sizeof(events) - pending);
+        if (got < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            break;
+        }
+        if (got == 0) {
+            _finished = true;
+            break;
+        }
+
+        TOUCH_TRACE_SCOPE(TraceStageDeviceCallback);
+
+        /* pipes may split records, keep the tail for the next read */
+        size_t bytes = pending + got;
+        size_t count = bytes / sizeof(struct input_event);
+        pending = bytes % sizeof(struct input_event);
+
+        frames.clear();
+        for (size_t i = 0; i < count; i++)
+            process(events[i], frames);
+        if (pending)
+            memmove(events, (char *)events + count * sizeof(struct input_event), pending);
+
+        deliver(frames.data(), frames.size());
+    }
+}
+
+void EvdevTouchBackend::process(const struct input_event &ev, std::vector<struct TouchFrame> &out)
+{
+    if (ev.type == EV_SYN) {
+        if (ev.code == SYN_DROPPED) {
+            _dropped = true;
+            _overflows++;
+        }
+        else if (ev.code == SYN_REPORT) {
+            if (_dropped) {
+                _lostReports++;
+                resync();
+            }
+            emitFrame(out, (uint64_t)ev.time.tv_sec * 1000000000ull
+                      + (uint64_t)ev.time.tv_usec * 1000ull);
+            _dropped = false;
+        }
+        return;
+    }
+
+    if (ev.type != EV_ABS || _dropped)
+        return;
+
+    Slot *slot = &_slots[_slot];
+    switch (ev.code) {
+    case ABS_MT_SLOT:
+        _slot = (ev.value >= 0 && ev.value < TOUCH_MAX_CONTACTS) ? ev.value : 0;
+        break;
+    case ABS_MT_TRACKING_ID:
+        /* a new id without a -1 in between replaces the contact */
+        if (slot->trackingId >= 0 && ev.value != slot->trackingId)
+            lift(slot);
+        slot->trackingId = ev.value < 0 ? -1 : ev.value;
+        break;
+    case ABS_MT_POSITION_X:
+        slot->x = scaleX(ev.value);
+        break;
+    case ABS_MT_POSITION_Y:
+        slot->y = scaleY(ev.value);
+        break;
+    }
+}
+
+void EvdevTouchBackend::lift(Slot *slot)
+{
+    slot->lifted = true;
+    slot->liftedId = slot->trackingId;
+    slot->liftedX = slot->x;
+    slot->liftedY = slot->y;
+}
+
+/*
+ * Reads every slot back after SYN_DROPPED. A contact the device no
+ * longer has, or has replaced, lifts in the next frame.
+ */
+void EvdevTouchBackend::resync()
+{
+    struct {
+        __u32 code;
+        __s32 values[TOUCH_MAX_CONTACTS];
+    } ids, xs, ys;
+    struct input_absinfo current;
+
+    memset(&ids, 0, sizeof(ids));
+    memset(&xs, 0, sizeof(xs));
+    memset(&ys, 0, sizeof(ys));
+    ids.code = ABS_MT_TRACKING_ID;
+    xs.code = ABS_MT_POSITION_X;
+    ys.code = ABS_MT_POSITION_Y;
+
+    bool queried = ioctl(_fd, EVIOCGMTSLOTS(sizeof(ids)), &ids) >= 0
+            && ioctl(_fd, EVIOCGMTSLOTS(sizeof(xs)), &xs) >= 0
+            && ioctl(_fd, EVIOCGMTSLOTS(sizeof(ys)), &ys) >= 0
+            && ioctl(_fd, EVIOCGABS(ABS_MT_SLOT), &current) >= 0;
+
+    for (int i = 0; i < TOUCH_MAX_CONTACTS; i++) {
+        Slot *slot = &_slots[i];
+        int id = queried && ids.values[i] >= 0 ? ids.values[i] : -1;
+
+        if (slot->trackingId >= 0 && slot->trackingId != id)
+            lift(slot);
+        slot->trackingId = id;
+        if (queried) {
+            slot->x = scaleX(xs.values[i]);
+            slot->y = scaleY(ys.values[i]);
+        }
+    }
+
+    if (queried)
+        _slot = (current.value >= 0 && current.value < TOUCH_MAX_CONTACTS) ? current.value : 0;
+}
+
+void EvdevTouchBackend::emitFrame(std::vector<struct TouchFrame> &out, uint64_t deviceTime)
+{
+    struct TouchFrame frame;
+    int active = 0;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.fields = TOUCH_FIELDS_ALL;
+    frame.device = deviceId();
+    frame.deviceTime = deviceTime;
+    frame.hostTime = touchMonotonicNs();
+
+    /* a slot may have lifted one contact and taken up the next; a lift that doesn't fit waits */
+    for (int i = 0; i < TOUCH_MAX_CONTACTS; i++) {
+        Slot *slot = &_slots[i];
+
+        if (slot->lifted && frame.count < TOUCH_MAX_CONTACTS) {
+            struct TouchContact *contact = &frame.contacts[frame.count++];
+            contact->id = slot->liftedId;
+            contact->x = slot->liftedX;
+            contact->y = slot->liftedY;
+            contact->flags = 0;
+            slot->lifted = false;
+        }
+        if (slot->trackingId >= 0 && frame.count < TOUCH_MAX_CONTACTS) {
+            struct TouchContact *contact = &frame.contacts[frame.count++];
+            contact->id = slot->trackingId;
+            contact->x = slot->x;
+            contact->y = slot->y;
+            contact->flags = TOUCH_CONTACT_TIP | TOUCH_CONTACT_IN_RANGE;
+            active++;
+        }
+    }
+
+    if (!frame.count)
+        return;
+
+    frame.contactCount = active;
+    out.push_back(frame);
+}
@@ -0,0 +1,96 @@
+#ifndef TOUCH_EVDEV_H
+#define TOUCH_EVDEV_H
+
+#include <linux/input.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "touch_backend.h"
+
+/*
+ * Linux backend for the evdev multitouch protocol B.
+ *
+ * Reads struct input_event records from any file descriptor: an event
+ * device node, a pipe or a recorded stream. ABS_MT_SLOT selects the slot
+ * the following values belong to, ABS_MT_TRACKING_ID starts (>= 0) or
+ * ends (-1) a contact and SYN_REPORT closes the frame. Contacts that
+ * lifted in a frame are reported once more with no flags set.
+ *
+ * SYN_DROPPED means the kernel buffer overflowed: events are discarded up
+ * to the next SYN_REPORT and the slots are then read back from the device
+ * with EVIOCGMTSLOTS. A descriptor that can't be asked, a pipe or a
+ * recording, has every contact lifted instead.
+ *
+ * Coordinates are scaled from the device's absolute axis range to the
+ * TOUCH_SCREEN_WIDTH x TOUCH_SCREEN_HEIGHT surface. When the descriptor
+ * is not an event device the range is unknown and values pass through
+ * unchanged unless setAxisRange() says otherwise.
+ */
+class EvdevTouchBackend : public TouchBackend
+{
+public:
+    explicit EvdevTouchBackend(const char *path);
+    explicit EvdevTouchBackend(int fd, bool ownsFd = false);
+    ~EvdevTouchBackend();
+
+    static std::vector<TouchDeviceInfo> enumerate();
+
+    const char *name() const { return "evdev"; }
+    unsigned fields() const { return TOUCH_FIELDS_ALL; }
+    bool start();
+    void stop();
+    /* true once a pipe or recording reached its end */
+    bool finished() const { return _finished; }
+    std::vector<TouchDeviceInfo> devices() const;
+    void drops(struct TouchDropCounts *drops) const;
+
+    void setAxisRange(int minX, int maxX, int minY, int maxY);
+
+    /*
+     * Feeds one event through the slot state machine; completed frames are
+     * appended to out. Exposed so recorded streams can be replayed without
+     * the reader thread.
+     */
+    void process(const struct input_event &ev, std::vector<struct TouchFrame> &out);
+
+private:
+    struct Slot {
+        int trackingId;     /* -1 when the slot is free */
+        int x;
+        int y;
+        bool lifted;        /* freed or taken over since the last SYN_REPORT */
+        int liftedId;       /* tracking id the slot held before */
+        int liftedX;
+        int liftedY;
+    };
+
+    void init();
+    void queryAxes();
+    void run();
+    void lift(Slot *slot);
+    void resync();
+    void emitFrame(std::vector<struct TouchFrame> &out, uint64_t deviceTime);
+    int scaleX(int value) const;
+    int scaleY(int value) const;
+
+    TouchDeviceInfo _info;
+    int _fd;
+    bool _ownsFd;
+    int _wake[2];
+    std::thread _thread;
+    std::atomic<bool> _running;
+    std::atomic<bool> _finished;
+
+    Slot _slots[TOUCH_MAX_CONTACTS];
+    int _slot;
+    bool _dropped;          /* SYN_DROPPED seen, discard until the next report */
+    std::atomic<unsigned long> _overflows;  /* SYN_DROPPED seen */
+    std::atomic<unsigned long> _lostReports;    /* reports discarded after one */
+
+    int _minX, _maxX, _minY, _maxY;
+    bool _scale;
+};
+
+#endif // TOUCH_EVDEV_H
@@ -0,0 +1,251 @@
+#include "touch_frame.h"
+
+#include <string.h>
+
+TouchFrameAssembler::TouchFrameAssembler(TouchFrameHandler handler, void *context) :
+    _handler(handler),
+    _context(context),
+    _device(0)
+{
+    reset();
+}
+
+void TouchFrameAssembler::setHandler(TouchFrameHandler handler, void *context)
+{
+    _handler = handler;
+    _context = context;
+}
+
+void TouchFrameAssembler::setDevice(int device)
+{
+    _device = device;
+    _frame.device = device;
+}
+
+void TouchFrameAssembler::reset()
+{
+    memset(&_frame, 0, sizeof(_frame));
+    _frame.device = _device;
+    memset(_known, 0, sizeof(_known));
+    _have = 0;
+    _idKnown = false;
+    _sawIds = false;
+    _expected = 0;
+    _knownCount = 0;
+    _deviceTime = 0;
+    _hostTime = 0;
+}
+
+void TouchFrameAssembler::setTimestamp(uint64_t deviceTime, uint64_t hostTime)
+{
+    _deviceTime = deviceTime;
+    _hostTime = hostTime;
+}
+
+const struct TouchContact *TouchFrameAssembler::findKnown(int id) const
+{
+    for (int i = 0; i < _knownCount; i++) {
+        if (_known[i].id == id)
+            return &_known[i];
+    }
+    return 0;
+}
+
+bool TouchFrameAssembler::inFrame(int id, int count) const
+{
+    for (int i = 0; i < count; i++) {
+        if (_frame.contacts[i].id == id)
+            return true;
+    }
+    return false;
+}
+
+void TouchFrameAssembler::startContact(int id, bool known)
+{
+    if (_frame.count == TOUCH_MAX_CONTACTS)
+        flush();
+
+    if (!_frame.count) {
+        _frame.deviceTime = _deviceTime ? _deviceTime : _hostTime;
+        _frame.hostTime = _hostTime;
+        if (_deviceTime)
+            _frame.fields |= TOUCH_FIELD_DEVICE_TIME;
+        if (_hostTime)
+            _frame.fields |= TOUCH_FIELD_HOST_TIME;
+    }
+
+    struct TouchContact *contact = &_frame.contacts[_frame.count++];
+    /* a contact still waiting for its identifier is rebuilt once it arrives */
+    const struct TouchContact *last = findKnown(id);
+    if (last) {
+        *contact = *last;
+    }
+    else {
+        memset(contact, 0, sizeof(*contact));
+        contact->id = id;
+    }
+    _have = 0;
+    _idKnown = known;
+}
+
+void TouchFrameAssembler::beginContact(int id)
+{
+    if (!_frame.count || _idKnown) {
+        if (inFrame(id, _frame.count))
+            flush();
+        startContact(id, true);
+        _frame.fields |= TOUCH_FIELD_CONTACT_ID;
+        _sawIds = true;
+        return;
+    }
+
+    /* fields of this contact arrived ahead of its identifier */
+    struct TouchContact pending = _frame.contacts[_frame.count - 1];
+    unsigned have = _have;
+    if (inFrame(id, _frame.count - 1)) {
+        _frame.count--;
+        flush();
+    }
+    else {
+        _frame.count--;
+    }
+    startContact(id, true);
+
+    struct TouchContact *contact = &_frame.contacts[_frame.count - 1];
+    if (have & HaveX)
+        contact->x = pending.x;
+    if (have & HaveY)
+        contact->y = pending.y;
+    if (have & (HaveX | HaveY))
+        _frame.fields |= TOUCH_FIELD_POSITION;
+    if (have & HaveTip) {
+        contact->flags = (contact->flags & ~TOUCH_CONTACT_TIP) | (pending.flags & TOUCH_CONTACT_TIP);
+        _frame.fields |= TOUCH_FIELD_TIP;
+    }
+    if (have & HaveInRange) {
+        contact->flags = (contact->flags & ~TOUCH_CONTACT_IN_RANGE) | (pending.flags & TOUCH_CONTACT_IN_RANGE);
+        _frame.fields |= TOUCH_FIELD_IN_RANGE;
+    }
+    _have = have;
+    _frame.fields |= TOUCH_FIELD_CONTACT_ID;
+    _sawIds = true;
+}
+
+/*
+ * Returns the contact a value for field belongs to. A field written twice
+ * either starts the next contact of the report or, on devices that do not
+ * report identifiers, the next report.
+ */
+struct TouchContact *TouchFrameAssembler::open(unsigned field)
+{
+    if (!_frame.count) {
+        startContact(0, false);
+    }
+    else if (_have & field) {
+        if (_sawIds) {
+            startContact(0, false);
+        }
+        else {
+            const struct TouchContact *contact = &_frame.contacts[_frame.count - 1];
+            int id = contact->id;
+            bool known = _idKnown;
+            flush();
+            startContact(id, known);
+        }
+    }
+    _have |= field;
+    return &_frame.contacts[_frame.count - 1];
+}
+
+void TouchFrameAssembler::setX(int x)
+{
+    open(HaveX)->x = x;
+    _frame.fields |= TOUCH_FIELD_POSITION;
+}
+
+void TouchFrameAssembler::setY(int y)
+{
+    open(HaveY)->y = y;
+    _frame.fields |= TOUCH_FIELD_POSITION;
+}
+
+void TouchFrameAssembler::setTip(bool down)
+{
+    struct TouchContact *contact = open(HaveTip);
+    if (down)
+        contact->flags |= TOUCH_CONTACT_TIP;
+    else
+        contact->flags &= ~TOUCH_CONTACT_TIP;
+    _frame.fields |= TOUCH_FIELD_TIP;
+}
+
+void TouchFrameAssembler::setInRange(bool inRange)
+{
+    struct TouchContact *contact = open(HaveInRange);
+    if (inRange)
+        contact->flags |= TOUCH_CONTACT_IN_RANGE;
+    else
+        contact->flags &= ~TOUCH_CONTACT_IN_RANGE;
+    _frame.fields |= TOUCH_FIELD_IN_RANGE;
+}
+
+void TouchFrameAssembler::setContactCount(int count)
+{
+    /* in hybrid mode only the first report of a frame carries the count */
+    if (count > 0) {
+        _expected = count < TOUCH_MAX_CONTACTS ? count : TOUCH_MAX_CONTACTS;
+        _frame.contactCount = count;
+        _frame.fields |= TOUCH_FIELD_CONTACT_COUNT;
+    }
+    if (_expected && _frame.count >= _expected)
+        flush();
+}
+
+void TouchFrameAssembler::endReport()
+{
+    if (!_expected || _frame.count >= _expected)
+        flush();
+}
+
+void TouchFrameAssembler::flush()
+{
+    if (!_frame.count) {
+        _expected = 0;
+        return;
+    }
+
+    if (!_frame.contactCount)
+        _frame.contactCount = _frame.count;
+
+    /* remember contacts still touching, forget the ones that lifted */
+    for (int i = 0; i < _frame.count; i++) {
+        const struct TouchContact *contact = &_frame.contacts[i];
+        int k;
+        for (k = 0; k < _knownCount; k++) {
+            if (_known[k].id == contact->id)
+                break;
+        }
+        if (contact->flags & (TOUCH_CONTACT_TIP | TOUCH_CONTACT_IN_RANGE)) {
+            if (k == _knownCount) {
+                if (_knownCount == TOUCH_MAX_CONTACTS)
+                    continue;
+                _knownCount++;
+            }
+            _known[k] = *contact;
+        }
+        else if (k < _knownCount) {
+            _known[k] = _known[--_knownCount];
+        }
+    }
+
+    if (_handler)
+        _handler(&_frame, _context);
+
+    _frame.count = 0;
+    _frame.contactCount = 0;
+    _frame.fields = 0;
+    _have = 0;
+    _idKnown = false;
+    _sawIds = false;
+    _expected = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef TOUCH_FRAME_H
+#define TOUCH_FRAME_H
+
+#include "touch_shared.h"
+
+typedef void (*TouchFrameHandler)(const struct TouchFrame *frame, void *context);
+
+/*
+ * Turns the per-element value stream of a multitouch digitizer into one
+ * TouchFrame per report.
+ *
+ * Values are fed in report order. A contact identifier names the contact
+ * whose X/Y/tip/in-range values surround it; descriptors commonly put the
+ * tip switch ahead of the identifier, so fields written before the
+ * identifier are attached once it arrives. The frame is handed to the
+ * handler when the report ends, which is either signalled through
+ * endReport() or inferred from the stream: the device contact count being
+ * reached, a contact identifier repeating, or, for devices without
+ * identifiers, a field being written twice.
+ *
+ * Fields a device does not resend (the IOHID queue only delivers changed
+ * values) are carried over from the last frame that contained the contact.
+ * TouchFrame.fields names the kinds of values the frame was built from.
+ *
+ * An assembler holds the state of one device; every digitizer gets its
+ * own, and frames carry the device id it was given.
+ */
+class TouchFrameAssembler
+{
+public:
+    explicit TouchFrameAssembler(TouchFrameHandler handler = 0, void *context = 0);
+
+    void setHandler(TouchFrameHandler handler, void *context);
+    void setDevice(int device);
+
+    void beginContact(int id);
+    void setX(int x);
+    void setY(int y);
+    void setTip(bool down);
+    void setInRange(bool inRange);
+    void setContactCount(int count);
+    void endReport();
+
+    /* stamps the frame the next value opens, deviceTime 0 if unknown */
+    void setTimestamp(uint64_t deviceTime, uint64_t hostTime);
+
+    void reset();
+
+private:
+    enum {
+        HaveX = 0x1,
+        HaveY = 0x2,
+        HaveTip = 0x4,
+        HaveInRange = 0x8
+    };
+
+    struct TouchContact *open(unsigned field);
+    void startContact(int id, bool known);
+    const struct TouchContact *findKnown(int id) const;
+    bool inFrame(int id, int count) const;
+    void flush();
+
+    TouchFrameHandler _handler;
+    void *_context;
+
+    struct TouchFrame _frame;
+    unsigned _have;         /* fields written to the open contact */
+    bool _idKnown;          /* open contact has seen its identifier */
+    bool _sawIds;           /* current frame carries contact identifiers */
+    int _expected;          /* contacts announced for the current frame */
+    uint64_t _deviceTime;
+    uint64_t _hostTime;
+    int _device;
+
+    /* last known state per contact identifier */
+    struct TouchContact _known[TOUCH_MAX_CONTACTS];
+    int _knownCount;
+};
+
+#endif // TOUCH_FRAME_H
@@ -0,0 +1,531 @@
+#include "touch_hid_descriptor.h"
+#include "touch_frame.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+/* short item types and tags, HID 1.11 section 6.2.2 */
+enum {
+    ItemMain = 0,
+    ItemGlobal = 1,
+    ItemLocal = 2
+};
+
+enum {
+    MainInput = 0x8,
+    MainOutput = 0x9,
+    MainCollection = 0xa,
+    MainFeature = 0xb,
+    MainEndCollection = 0xc
+};
+
+enum {
+    GlobalUsagePage = 0x0,
+    GlobalLogicalMin = 0x1,
+    GlobalLogicalMax = 0x2,
+    GlobalPhysicalMin = 0x3,
+    GlobalPhysicalMax = 0x4,
+    GlobalReportSize = 0x7,
+    GlobalReportId = 0x8,
+    GlobalReportCount = 0x9,
+    GlobalPush = 0xa,
+    GlobalPop = 0xb
+};
+
+enum {
+    LocalUsage = 0x0,
+    LocalUsageMin = 0x1,
+    LocalUsageMax = 0x2
+};
+
+#define HID_MAX_USAGES 64
+#define HID_MAX_STACK 8
+
+struct GlobalState {
+    uint16_t usagePage;
+    int32_t logicalMin;
+    int32_t logicalMax;
+    int32_t physicalMin;
+    int32_t physicalMax;
+    /* the maxima as encoded, for devices that don't mean them signed */
+    uint32_t logicalMaxRaw;
+    uint32_t physicalMaxRaw;
+    uint32_t reportSize;
+    uint32_t reportCount;
+    uint8_t reportId;
+};
+
+struct LocalState {
+    uint32_t usages[HID_MAX_USAGES];    /* page << 16 | usage */
+    int usageCount;
+    uint32_t usageMin;
+    uint32_t usageMax;
+    bool haveMin;
+    bool haveMax;
+};
+
+static uint32_t itemUnsigned(const uint8_t *data, int size)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < size; i++)
+        value |= (uint32_t)data[i] << (8 * i);
+    return value;
+}
+
+static int32_t itemSigned(const uint8_t *data, int size)
+{
+    uint32_t value = itemUnsigned(data, size);
+    if (size && size < 4 && (value & (1u << (8 * size - 1))))
+        value |= ~0u << (8 * size);
+    return (int32_t)value;
+}
+
+/*
+ * A maximum below its minimum was meant unsigned: 0xffff in two bytes is
+ * 65535, not -1. The value as encoded then stands, capped to fit.
+ */
+static int32_t itemMaximum(int32_t minimum, int32_t maximum, uint32_t raw)
+{
+    if (maximum >= minimum || minimum < 0)
+        return maximum;
+    return (int32_t)std::min(raw, (uint32_t)INT32_MAX);
+}
+
+static uint32_t fullUsage(uint16_t page, uint32_t usage, int size)
+{
+    /* a four byte usage carries its own page */
+    if (size == 4)
+        return usage;
+    return ((uint32_t)page << 16) | (usage & 0xffff);
+}
+
+struct HidScale hidAxisScale(int32_t logicalMin, int32_t logicalMax,
+                             int32_t physicalMin, int32_t physicalMax, int size)
+{
+    int64_t range = (int64_t)logicalMax - logicalMin + 1;
+    struct HidScale scale;
+
+    scale.offset = logicalMin;
+    if (logicalMax <= logicalMin) {
+        range = (int64_t)physicalMax - physicalMin + 1;
+        scale.offset = physicalMin;
+        if (physicalMax <= physicalMin) {
+            range = 32768;
+            scale.offset = 0;
+        }
+    }
+    scale.factor = (int32_t)(((int64_t)size << HID_SCALE_SHIFT) / range);
+    return scale;
+}
+
+struct HidScale hidOpScale(uint8_t op, int32_t logicalMin, int32_t logicalMax,
+                           int32_t physicalMin, int32_t physicalMax)
+{
+    if (op == HidOpX)
+        return hidAxisScale(logicalMin, logicalMax, physicalMin, physicalMax, TOUCH_SCREEN_WIDTH);
+    if (op == HidOpY)
+        return hidAxisScale(logicalMin, logicalMax, physicalMin, physicalMax, TOUCH_SCREEN_HEIGHT);
+
+    struct HidScale scale = { 0, 1 << HID_SCALE_SHIFT };
+    return scale;
+}
+
+static void DecodeNone(TouchFrameAssembler &, int32_t, const struct HidScale &)
+{
+}
+
+static void DecodeContactId(TouchFrameAssembler &assembler, int32_t value, const struct HidScale &)
+{
+    assembler.beginContact(value);
+}
+
+static void DecodeX(TouchFrameAssembler &assembler, int32_t value, const struct HidScale &scale)
+{
+    assembler.setX(hidScaleValue(value, scale));
+}
+
+static void DecodeY(TouchFrameAssembler &assembler, int32_t value, const struct HidScale &scale)
+{
+    assembler.setY(hidScaleValue(value, scale));
+}
+
+static void DecodeTip(TouchFrameAssembler &assembler, int32_t value, const struct HidScale &)
+{
+    assembler.setTip(value != 0);
+}
+
+static void DecodeInRange(TouchFrameAssembler &assembler, int32_t value, const struct HidScale &)
+{
+    assembler.setInRange(value != 0);
+}
+
+static void DecodeContactCount(TouchFrameAssembler &assembler, int32_t value, const struct HidScale &)
+{
+    assembler.setContactCount(value);
+}
+
+const HidValueDecoder hidValueDecoders[HidOpCount] = {
+    DecodeNone,             /* HidOpNone */
+    DecodeContactId,        /* HidOpContactId */
+    DecodeX,                /* HidOpX */
+    DecodeY,                /* HidOpY */
+    DecodeTip,              /* HidOpTip */
+    DecodeInRange,          /* HidOpInRange */
+    DecodeContactCount      /* HidOpContactCount */
+};
+
+HidReportLayout::HidReportLayout()
+{
+    clear();
+}
+
+void HidReportLayout::clear()
+{
+    _reports.clear();
+    _reportIds = false;
+    memset(_index, 0xff, sizeof(_index));
+}
+
+HidReport &HidReportLayout::reportFor(uint8_t id)
+{
+    if (_index[id] < 0) {
+        HidReport report;
+        report.id = id;
+        report.bitLength = 0;
+        _index[id] = (int16_t)_reports.size();
+        _reports.push_back(report);
+    }
+    return _reports[_index[id]];
+}
+
+const HidReport *HidReportLayout::report(uint8_t id) const
+{
+    return _index[id] < 0 ? 0 : &_reports[_index[id]];
+}
+
+bool HidReportLayout::parse(const uint8_t *descriptor, size_t length)
+{
+    GlobalState global;
+    GlobalState stack[HID_MAX_STACK];
+    LocalState local;
+    int depth = 0;
+    uint16_t collection = 0;
+    uint16_t collections = 0;
+    uint16_t parents[HID_MAX_STACK * 4];
+    int nesting = 0;
+    size_t pos = 0;
+
+    clear();
+    memset(&global, 0, sizeof(global));
+    memset(&local, 0, sizeof(local));
+
+    while (pos < length) {
+        uint8_t prefix = descriptor[pos++];
+
+        /* long items are reserved and carry nothing we decode */
+        if (prefix == 0xfe) {
+            if (pos + 2 > length)
+                return false;
+            pos += 2 + descriptor[pos];
+            continue;
+        }
+
+        int size = prefix & 0x3;
+        if (size == 3)
+            size = 4;
+        int type = (prefix >> 2) & 0x3;
+        int tag = prefix >> 4;
+
+        if (pos + size > length)
+            return false;
+        const uint8_t *data = descriptor + pos;
+        pos += size;
+
+        uint32_t value = itemUnsigned(data, size);
+
+        if (type == ItemMain) {
+            switch (tag) {
+            case MainInput: {
+                HidReport &report = reportFor(global.reportId);
+                uint8_t flags = value & (HidFieldConstant | HidFieldVariable | HidFieldRelative);
+                if (global.logicalMin < 0)
+                    flags |= HidFieldSigned;
+
+                int32_t logicalMax = itemMaximum(global.logicalMin, global.logicalMax, global.logicalMaxRaw);
+                int32_t physicalMax = itemMaximum(global.physicalMin, global.physicalMax, global.physicalMaxRaw);
+
+                for (uint32_t i = 0; i < global.reportCount; i++) {
+                    HidField field;
+                    memset(&field, 0, sizeof(field));
+                    field.bitOffset = report.bitLength + i * global.reportSize;
+                    field.bitSize = global.reportSize;
+                    field.logicalMin = global.logicalMin;
+                    field.logicalMax = logicalMax;
+                    field.physicalMin = global.physicalMin;
+                    field.physicalMax = physicalMax;
+                    field.collection = collection;
+                    field.flags = flags;
+
+                    uint32_t usage = 0;
+                    if ((flags & HidFieldConstant) || !field.bitSize) {
+                        /* padding, or nothing to read */
+                        continue;
+                    }
+                    else if (!(flags & HidFieldVariable)) {
+                        /* array selectors are not positional values */
+                        continue;
+                    }
+                    else if (local.usageCount) {
+                        usage = local.usages[i < (uint32_t)local.usageCount ? i : local.usageCount - 1];
+                    }
+                    else if (local.haveMin && local.haveMax) {
+                        usage = local.usageMin + i;
+                        if (usage > local.usageMax)
+                            usage = local.usageMax;
+                    }
+                    else {
+                        continue;
+                    }
+
+                    field.usagePage = usage >> 16;
+                    field.usage = usage & 0xffff;
+                    report.fields.push_back(field);
+                }
+                report.bitLength += global.reportSize * global.reportCount;
+                break;
+            }
+            case MainCollection:
+                if (nesting < (int)(sizeof(parents) / sizeof(parents[0])))
+                    parents[nesting++] = collection;
+                collection = ++collections;
+                break;
+            case MainEndCollection:
+                collection = nesting ? parents[--nesting] : 0;
+                break;
+            case MainOutput:
+            case MainFeature:
+            default:
+                break;
+            }
+            memset(&local, 0, sizeof(local));
+        }
+        else if (type == ItemGlobal) {
+            switch (tag) {
+            case GlobalUsagePage:
+                global.usagePage = value & 0xffff;
+                break;
+            case GlobalLogicalMin:
+                global.logicalMin = itemSigned(data, size);
+                break;
+            case GlobalLogicalMax:
+                global.logicalMax = itemSigned(data, size);
+                global.logicalMaxRaw = value;
+                break;
+            case GlobalPhysicalMin:
+                global.physicalMin = itemSigned(data, size);
+                break;
+            case GlobalPhysicalMax:
+                global.physicalMax = itemSigned(data, size);
+                global.physicalMaxRaw = value;
+                break;
+            case GlobalReportSize:
+                if (value > 32)
+                    return false;
+                global.reportSize = value;
+                break;
+            case GlobalReportId:
+                if (!value || value > 0xff)
+                    return false;
+                global.reportId = (uint8_t)value;
+                _reportIds = true;
+                break;
+            case GlobalReportCount:
+                global.reportCount = value;
+                break;
+            case GlobalPush:
+                if (depth == HID_MAX_STACK)
+                    return false;
+                stack[depth++] = global;
+                break;
+            case GlobalPop:
+                if (!depth)
+                    return false;
+                global = stack[--depth];
+                break;
+            default:
+                break;
+            }
+        }
+        else if (type == ItemLocal) {
+            switch (tag) {
+            case LocalUsage:
+                if (local.usageCount < HID_MAX_USAGES)
+                    local.usages[local.usageCount++] = fullUsage(global.usagePage, value, size);
+                break;
+            case LocalUsageMin:
+                local.usageMin = fullUsage(global.usagePage, value, size);
+                local.haveMin = true;
+                break;
+            case LocalUsageMax:
+                local.usageMax = fullUsage(global.usagePage, value, size);
+                local.haveMax = true;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < _reports.size(); i++)
+        compile(_reports[i]);
+
+    return !_reports.empty();
+}
+
+bool HidReportLayout::isValidReport(const HidReport &report)
+{
+    for (size_t i = 0; i < report.fields.size(); i++) {
+        const HidField &field = report.fields[i];
+        if (!field.bitSize || field.bitSize > 32
+                || (uint64_t)field.bitOffset + field.bitSize > report.bitLength)
+            return false;
+    }
+    return true;
+}
+
+bool HidReportLayout::load(const std::vector<HidReport> &reports, bool reportIds)
+{
+    clear();
+
+    for (size_t i = 0; i < reports.size(); i++) {
+        if (_index[reports[i].id] >= 0 || !isValidReport(reports[i])) {
+            clear();
+            return false;
+        }
+        HidReport &report = reportFor(reports[i].id);
+        report.bitLength = reports[i].bitLength;
+        report.fields = reports[i].fields;
+        compile(report);
+    }
+    _reportIds = reportIds;
+
+    return !_reports.empty();
+}
+
+/*
+ * Slots are the collections holding a contact identifier or an X field,
+ * in the order they come.
+ */
+void HidReportLayout::compile(HidReport &report)
+{
+    std::vector<uint16_t> slots;
+
+    report.plan.clear();
+    report.countStep = -1;
+
+    for (size_t i = 0; i < report.fields.size(); i++) {
+        const HidField &field = report.fields[i];
+        uint8_t op = hidUsageOp(field.usagePage, field.usage);
+        if ((op == HidOpContactId || op == HidOpX) && field.collection
+                && std::find(slots.begin(), slots.end(), field.collection) == slots.end())
+            slots.push_back(field.collection);
+    }
+
+    for (size_t i = 0; i < report.fields.size(); i++) {
+        const HidField &field = report.fields[i];
+        uint8_t op = hidUsageOp(field.usagePage, field.usage);
+        if (op == HidOpNone || !field.bitSize)
+            continue;
+
+        HidDecodeStep step;
+        memset(&step, 0, sizeof(step));
+        step.op = op;
+        step.byteOffset = field.bitOffset / 8;
+        step.shift = field.bitOffset % 8;
+        step.bitSize = (uint8_t)field.bitSize;
+        step.sign = (field.flags & HidFieldSigned) != 0;
+        step.scale = hidOpScale(op, field.logicalMin, field.logicalMax,
+                                field.physicalMin, field.physicalMax);
+
+        size_t slot = std::find(slots.begin(), slots.end(), field.collection) - slots.begin();
+        bool inSlot = op != HidOpContactCount && slot < slots.size() && slot < HID_NO_SLOT;
+        step.slot = inSlot ? (uint8_t)slot : HID_NO_SLOT;
+
+        if (op == HidOpContactCount && report.countStep < 0)
+            report.countStep = (int)report.plan.size();
+        report.plan.push_back(step);
+    }
+
+    /* a report of a single contact has nothing to skip */
+    if (slots.size() < 2) {
+        for (size_t i = 0; i < report.plan.size(); i++)
+            report.plan[i].slot = HID_NO_SLOT;
+    }
+}
+
+bool HidReportLayout::isTouchLayout() const
+{
+    for (size_t i = 0; i < _reports.size(); i++) {
+        bool x = false, y = false;
+        for (size_t k = 0; k < _reports[i].plan.size(); k++) {
+            x |= _reports[i].plan[k].op == HidOpX;
+            y |= _reports[i].plan[k].op == HidOpY;
+        }
+        if (x && y)
+            return true;
+    }
+    return false;
+}
+
+/* a field spans at most five bytes */
+static inline int32_t fieldValue(const uint8_t *data, size_t length, const HidDecodeStep &step)
+{
+    const uint8_t *p = data + step.byteOffset;
+    size_t avail = length - step.byteOffset;
+    uint64_t raw = 0;
+    for (size_t b = 0; b < 5 && b < avail; b++)
+        raw |= (uint64_t)p[b] << (8 * b);
+
+    uint32_t bits = (uint32_t)(raw >> step.shift);
+    if (step.bitSize < 32)
+        bits &= (1u << step.bitSize) - 1;
+    int32_t value = (int32_t)bits;
+    if (step.sign && step.bitSize < 32 && (bits & (1u << (step.bitSize - 1))))
+        value = (int32_t)(bits | (~0u << step.bitSize));
+    return value;
+}
+
+bool HidReportLayout::decode(const uint8_t *data, size_t length, TouchFrameAssembler &assembler) const
+{
+    uint8_t id = 0;
+
+    if (_reportIds) {
+        if (!length)
+            return false;
+        id = *data++;
+        length--;
+    }
+
+    int index = _index[id];
+    if (index < 0)
+        return false;
+
+    const HidReport &report = _reports[index];
+    if (length * 8 < report.bitLength)
+        return false;
+
+    /* the contact count usually trails the contacts it counts, it is read first */
+    int count = report.countStep >= 0 ? fieldValue(data, length, report.plan[report.countStep]) : 0;
+
+    const HidDecodeStep *step = report.plan.data();
+    const HidDecodeStep *end = step + report.plan.size();
+    for (; step != end; step++) {
+        if (step->slot != HID_NO_SLOT && count > 0 && step->slot >= count)
+            continue;
+        hidValueDecoders[step->op](assembler, fieldValue(data, length, *step), step->scale);
+    }
+
+    assembler.endReport();
+    return true;
+}
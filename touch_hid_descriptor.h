@@ -0,0 +1,187 @@
+#ifndef TOUCH_HID_DESCRIPTOR_H
+#define TOUCH_HID_DESCRIPTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class TouchFrameAssembler;
+
+#define HID_PAGE_GENERIC_DESKTOP    0x01
+#define HID_PAGE_BUTTON             0x09
+#define HID_PAGE_DIGITIZER          0x0d
+
+#define HID_USAGE_GD_X              0x30
+#define HID_USAGE_GD_Y              0x31
+
+#define HID_USAGE_BUTTON_1          0x01
+
+#define HID_USAGE_DIG_TOUCH_SCREEN  0x04
+#define HID_USAGE_DIG_TIP_PRESSURE  0x30
+#define HID_USAGE_DIG_IN_RANGE      0x32
+#define HID_USAGE_DIG_TOUCH         0x33
+#define HID_USAGE_DIG_TIP_SWITCH    0x42
+#define HID_USAGE_DIG_WIDTH         0x48
+#define HID_USAGE_DIG_HEIGHT        0x49
+#define HID_USAGE_DIG_CONTACT_ID    0x51
+#define HID_USAGE_DIG_DEVICE_INDEX  0x53
+#define HID_USAGE_DIG_CONTACT_COUNT 0x54
+#define HID_USAGE_DIG_CONTACT_MAX   0x55
+
+/* HidField.flags, mirroring the Input main item data bits */
+enum {
+    HidFieldConstant = 0x01,
+    HidFieldVariable = 0x02,
+    HidFieldRelative = 0x04,
+    HidFieldSigned   = 0x80     /* logical minimum is negative */
+};
+
+enum HidDecodeOp {
+    HidOpNone,
+    HidOpContactId,
+    HidOpX,
+    HidOpY,
+    HidOpTip,
+    HidOpInRange,
+    HidOpContactCount,
+    HidOpCount
+};
+
+struct HidUsageOp {
+    uint16_t usagePage;
+    uint16_t usage;
+    uint8_t op;
+};
+
+/* the usages decoding acts on, every other usage is HidOpNone */
+static constexpr struct HidUsageOp HidUsageOps[] = {
+    { HID_PAGE_GENERIC_DESKTOP, HID_USAGE_GD_X, HidOpX },
+    { HID_PAGE_GENERIC_DESKTOP, HID_USAGE_GD_Y, HidOpY },
+    { HID_PAGE_DIGITIZER, HID_USAGE_DIG_CONTACT_ID, HidOpContactId },
+    { HID_PAGE_DIGITIZER, HID_USAGE_DIG_TIP_SWITCH, HidOpTip },
+    { HID_PAGE_DIGITIZER, HID_USAGE_DIG_TOUCH, HidOpTip },
+    { HID_PAGE_DIGITIZER, HID_USAGE_DIG_IN_RANGE, HidOpInRange },
+    { HID_PAGE_DIGITIZER, HID_USAGE_DIG_CONTACT_COUNT, HidOpContactCount },
+};
+
+/* the HidDecodeOp of a usage, looked up when an element or field is loaded, never per value */
+constexpr uint8_t hidUsageOp(uint16_t usagePage, uint16_t usage, size_t i = 0)
+{
+    return i == sizeof(HidUsageOps) / sizeof(HidUsageOps[0]) ? (uint8_t)HidOpNone
+            : HidUsageOps[i].usagePage == usagePage && HidUsageOps[i].usage == usage ? HidUsageOps[i].op
+            : hidUsageOp(usagePage, usage, i + 1);
+}
+
+static_assert(hidUsageOp(HID_PAGE_GENERIC_DESKTOP, HID_USAGE_GD_Y) == HidOpY, "usage table");
+static_assert(hidUsageOp(HID_PAGE_BUTTON, HID_USAGE_BUTTON_1) == HidOpNone, "usage table");
+
+#define HID_SCALE_SHIFT 16
+
+/*
+ * Fixed point mapping of a value onto the surface:
+ * (value - offset) * factor >> HID_SCALE_SHIFT. Values that aren't
+ * coordinates pass through with factor 1.
+ */
+struct HidScale {
+    int32_t offset;
+    int32_t factor;
+};
+
+/*
+ * The scale spreading an axis over size surface units. The logical range
+ * is what the device reports in; a descriptor that leaves it empty falls
+ * back to the physical range, and to 0..32767 without either.
+ */
+struct HidScale hidAxisScale(int32_t logicalMin, int32_t logicalMax,
+                             int32_t physicalMin, int32_t physicalMax, int size);
+/* hidAxisScale() for coordinates, the identity for everything else */
+struct HidScale hidOpScale(uint8_t op, int32_t logicalMin, int32_t logicalMax,
+                           int32_t physicalMin, int32_t physicalMax);
+
+static inline int hidScaleValue(int32_t value, const struct HidScale &scale)
+{
+    return (int)(((int64_t)value - scale.offset) * scale.factor >> HID_SCALE_SHIFT);
+}
+
+/* feeds one value into the assembler; indexed by HidDecodeOp */
+typedef void (*HidValueDecoder)(TouchFrameAssembler &assembler, int32_t value, const struct HidScale &scale);
+extern const HidValueDecoder hidValueDecoders[HidOpCount];
+
+/* one input value of a report, as declared by the descriptor */
+struct HidField {
+    uint32_t bitOffset;         /* from the first byte after the report id */
+    uint32_t bitSize;
+    uint16_t usagePage;
+    uint16_t usage;
+    int32_t logicalMin;
+    int32_t logicalMax;
+    int32_t physicalMin;
+    int32_t physicalMax;
+    uint16_t collection;        /* index of the innermost enclosing collection */
+    uint8_t flags;
+};
+
+#define HID_NO_SLOT 0xff
+
+/* precompiled extraction of one field the decoder cares about */
+struct HidDecodeStep {
+    uint32_t byteOffset;
+    uint8_t shift;
+    uint8_t bitSize;
+    uint8_t op;
+    uint8_t sign;
+    uint8_t slot;               /* contact slot of the field, HID_NO_SLOT outside one */
+    struct HidScale scale;
+};
+
+struct HidReport {
+    uint8_t id;
+    uint32_t bitLength;
+    std::vector<HidField> fields;
+    std::vector<HidDecodeStep> plan;
+    int countStep;              /* plan index of the contact count, -1 if none */
+};
+
+/*
+ * Input report layout of a HID device, compiled from its report descriptor.
+ *
+ * parse() walks the descriptor items once and records every input field
+ * with its bit position, logical/physical range and usage. Fields the touch
+ * pipeline consumes are then compiled into a per-report decode plan, so
+ * decode() turns a whole raw input report into assembler calls in a single
+ * pass without looking at the descriptor again.
+ *
+ * Contact slots a report leaves unused are skipped once its contact count
+ * says so; devices zero them, and a zeroed slot reads as contact 0.
+ */
+class HidReportLayout
+{
+public:
+    HidReportLayout();
+
+    bool parse(const uint8_t *descriptor, size_t length);
+    /* rebuilds the layout from the fields of reports parsed earlier */
+    bool load(const std::vector<HidReport> &reports, bool reportIds);
+    /* every field 1 to 32 bits and within the report */
+    static bool isValidReport(const HidReport &report);
+    void clear();
+
+    /* true when some input report carries both X and Y */
+    bool isTouchLayout() const;
+    bool usesReportIds() const { return _reportIds; }
+
+    const HidReport *report(uint8_t id) const;
+    const std::vector<HidReport> &reports() const { return _reports; }
+
+    bool decode(const uint8_t *data, size_t length, TouchFrameAssembler &assembler) const;
+
+private:
+    HidReport &reportFor(uint8_t id);
+    void compile(HidReport &report);
+
+    std::vector<HidReport> _reports;
+    bool _reportIds;
+    int16_t _index[256];        /* report id -> _reports index, -1 if none */
+};
+
+#endif // TOUCH_HID_DESCRIPTOR_H
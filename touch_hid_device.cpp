@@ -0,0 +1,323 @@
+#include "touch_hid_device.h"
+#include "touch_clock.h"
+#include "touch_trace.h"
+
+#include <string.h>
+
+static inline void traceElement(const struct TouchLayoutElement &element, int32_t value)
+{
+    TOUCH_TRACE(TraceHidElement, element.usagePage << 16 | element.usage, element.type, value);
+}
+
+/* X/Y of a pointing device, the first button and the digitizer usages of a touch screen */
+static bool WantElement(uint16_t usagePage, uint16_t usage)
+{
+    switch (usagePage) {
+    case HID_PAGE_GENERIC_DESKTOP:
+        return usage == HID_USAGE_GD_X || usage == HID_USAGE_GD_Y;
+    case HID_PAGE_BUTTON:
+        return usage == HID_USAGE_BUTTON_1;
+    case HID_PAGE_DIGITIZER:
+        switch (usage) {
+        case HID_USAGE_DIG_TOUCH_SCREEN:
+        case HID_USAGE_DIG_TOUCH:
+        case HID_USAGE_DIG_TIP_SWITCH:
+        case HID_USAGE_DIG_CONTACT_ID:
+        case HID_USAGE_DIG_IN_RANGE:
+        case HID_USAGE_DIG_CONTACT_MAX:
+        case HID_USAGE_DIG_TIP_PRESSURE:
+        case HID_USAGE_DIG_WIDTH:
+        case HID_USAGE_DIG_HEIGHT:
+        case HID_USAGE_DIG_DEVICE_INDEX:
+        case HID_USAGE_DIG_CONTACT_COUNT:
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+static inline bool isInput(uint32_t type)
+{
+    return type >= HidElementInputMisc && type <= HidElementInputScanCodes;
+}
+
+HidDeviceSession::HidDeviceSession() :
+    _device(0),
+    _fields(TOUCH_FIELDS_ALL),
+    _queueFallback(false),
+    _layout(0),
+    _queue(0),
+    _rawReports(false),
+    _fallbacks(0),
+    _receiveTime(0)
+{
+}
+
+HidDeviceSession::~HidDeviceSession()
+{
+    close();
+}
+
+void HidDeviceSession::close()
+{
+    delete _queue;
+    _queue = 0;
+    delete _layout;
+    _layout = 0;
+    _elements.clear();
+    _elementsByCookie.clear();
+    _rawReports = false;
+    _assembler.reset();
+    _device = 0;
+}
+
+/*
+ * Models seen before, in this run or an earlier one, come out of the
+ * layout cache without walking the elements or parsing the descriptor;
+ * others are discovered and added to it.
+ */
+bool HidDeviceSession::open(HidDevice *device, int id, TouchFrameHandler handler, void *context)
+{
+    close();
+    _device = device;
+    _monitor.restart();
+    _assembler.setDevice(id);
+    _assembler.setHandler(handler, context);
+
+    std::vector<uint8_t> descriptor;
+    if (!device->descriptor(descriptor) || descriptor.empty()) {
+        /* nothing to tell models apart by, discover the elements every time */
+        struct TouchLayout layout;
+        discover(descriptor, &layout);
+        return loadElements(layout.elements);
+    }
+
+    struct TouchLayoutKey key;
+    memset(&key, 0, sizeof(key));
+    key.vendorId = device->vendorId();
+    key.productId = device->productId();
+    key.version = device->version();
+    key.descriptorHash = TouchLayoutCache::hash(descriptor.data(), descriptor.size());
+
+    struct TouchLayout layout;
+    bool cached = touchLayoutCache().find(key, &layout);
+    TOUCH_TRACE(TraceLayoutCache, cached, key.vendorId << 16 | (key.productId & 0xffff), key.descriptorHash);
+
+    if (cached) {
+        if (!layout.reports.empty()) {
+            _layout = new HidReportLayout();
+            if (!_layout->load(layout.reports, layout.reportIds) || !_layout->isTouchLayout()) {
+                delete _layout;
+                _layout = 0;
+            }
+        }
+    }
+    else {
+        discover(descriptor, &layout);
+        /* devices without usable elements are not worth remembering */
+        if (!layout.elements.empty())
+            touchLayoutCache().insert(key, layout);
+    }
+
+    return loadElements(layout.elements) || _layout;
+}
+
+/* lists the elements decoding cares about and compiles the report layout */
+bool HidDeviceSession::discover(const std::vector<uint8_t> &descriptor, struct TouchLayout *layout)
+{
+    std::vector<struct TouchLayoutElement> elements = _device->elements();
+
+    layout->elements.clear();
+    layout->reports.clear();
+    layout->reportIds = false;
+
+    for (size_t i = 0; i < elements.size(); i++) {
+        const struct TouchLayoutElement &element = elements[i];
+        traceElement(element, 0);
+        if (!WantElement(element.usagePage, element.usage) || element.cookie >= HID_MAX_COOKIE)
+            continue;
+
+        TOUCH_TRACE(TraceElementAdded, element.usagePage << 16 | element.usage,
+                    element.type, element.cookie);
+        layout->elements.push_back(element);
+    }
+
+    if (!descriptor.empty()) {
+        _layout = new HidReportLayout();
+        if (_layout->parse(descriptor.data(), descriptor.size()) && _layout->isTouchLayout()) {
+            layout->reports = _layout->reports();
+            layout->reportIds = _layout->usesReportIds();
+        }
+        else {
+            delete _layout;
+            _layout = 0;
+        }
+    }
+
+    return !layout->elements.empty();
+}
+
+/*
+ * Indexes the element table by cookie, so a value finds its element with
+ * a bounds check and a load, and settles each element's decoder and scale.
+ * The table is at most HID_MAX_COOKIE entries; elements past it are dropped.
+ */
+bool HidDeviceSession::loadElements(const std::vector<struct TouchLayoutElement> &elements)
+{
+    _elements.clear();
+    _elements.reserve(elements.size());
+
+    uint32_t limit = 0;
+    for (size_t i = 0; i < elements.size(); i++) {
+        if (elements[i].cookie >= HID_MAX_COOKIE)
+            continue;
+
+        _elements.push_back(HidElement());
+        struct HidElement &element = _elements.back();
+        element.cookie = elements[i].cookie;
+        element.type = elements[i].type;
+        element.usagePage = elements[i].usagePage;
+        element.usage = elements[i].usage;
+        element.value = 0;
+        element.op = hidUsageOp(element.usagePage, element.usage);
+        element.scale = hidOpScale(element.op, elements[i].logicalMin, elements[i].logicalMax,
+                                   elements[i].physicalMin, elements[i].physicalMax);
+        if (element.cookie + 1 > limit)
+            limit = element.cookie + 1;
+    }
+
+    _elementsByCookie.assign(limit, (struct HidElement *)0);
+    for (size_t i = 0; i < _elements.size(); i++)
+        _elementsByCookie[_elements[i].cookie] = &_elements[i];
+
+    return !_elements.empty();
+}
+
+/*
+ * The queue starts out deep enough for every input element of a report
+ * over HID_QUEUE_SERVICE_MS at HID_QUEUE_REPORT_RATE; serviceQueue()
+ * grows it from there when it overflows.
+ */
+HidQueue *HidDeviceSession::setupQueue()
+{
+    if (!_device || _elements.empty())
+        return 0;
+
+    int inputs = 0;
+    for (size_t i = 0; i < _elements.size(); i++)
+        inputs += isInput(_elements[i].type);
+    if (!inputs)
+        return 0;
+
+    delete _queue;
+    _queue = _device->createQueue();
+    if (!_queue)
+        return 0;
+
+    _monitor.setElementsPerReport(inputs);
+    bool added = false;
+    if (_queue->create(_monitor.initialDepth())) {
+        for (size_t i = 0; i < _elements.size(); i++) {
+            const struct HidElement &element = _elements[i];
+            TOUCH_TRACE(TraceHidElement, element.usagePage << 16 | element.usage, element.type, element.value);
+            if (isInput(element.type) && _queue->addElement(element.cookie))
+                added = true;
+        }
+    }
+
+    if (!added) {
+        delete _queue;
+        _queue = 0;
+    }
+    return _queue;
+}
+
+/* drains the queue, then grows it or gives up on it for raw reports if it overflowed */
+void HidDeviceSession::serviceQueue(uint64_t receiveTime)
+{
+    if (!_queue || _rawReports)
+        return;
+
+    _receiveTime = receiveTime;
+    _monitor.drain(*_queue, DecodeQueueEvent, this, receiveTime);
+
+    int depth = _queue->depth();
+    switch (_monitor.advice(depth)) {
+    case HidQueueGrow:
+        _queue->resize(_monitor.grownDepth(depth));
+        break;
+    case HidQueueFallBack:
+        if (_queueFallback && startReports())
+            _fallbacks++;
+        break;
+    default:
+        break;
+    }
+}
+
+void HidDeviceSession::DecodeQueueEvent(const struct HidQueueEvent *event, void *context)
+{
+    ((HidDeviceSession *)context)->decodeValue(event);
+}
+
+void HidDeviceSession::decodeValue(const struct HidQueueEvent *event)
+{
+    struct HidElement *element;
+    if (event->cookie >= _elementsByCookie.size() || !(element = _elementsByCookie[event->cookie]))
+        return;
+
+    element->value = event->value;
+
+    TOUCH_TRACE(TraceQueueEvent, element->usagePage << 16 | element->usage, event->cookie, event->value);
+    _assembler.setTimestamp((_fields & TOUCH_FIELD_DEVICE_TIME) ? event->timestamp : 0, _receiveTime);
+    if (element->op != HidOpNone) {
+        TOUCH_TRACE_SCOPE(TraceStageElementDecode);
+        hidValueDecoders[element->op](_assembler, element->value, element->scale);
+    }
+}
+
+bool HidDeviceSession::startReports()
+{
+    if (!_device || !_layout)
+        return false;
+    if (!_device->startReports(ReportReceived, this))
+        return false;
+
+    if (_queue)
+        _queue->stop();
+    _rawReports = true;
+    return true;
+}
+
+void HidDeviceSession::ReportReceived(const uint8_t *report, size_t length, void *context)
+{
+    ((HidDeviceSession *)context)->decodeReport(report, length, touchMonotonicNs());
+}
+
+bool HidDeviceSession::decodeReport(const uint8_t *report, size_t length, uint64_t receiveTime)
+{
+    /* report callbacks carry no device timestamp */
+    _assembler.setTimestamp(0, receiveTime);
+
+    if (_layout && _layout->decode(report, length, _assembler)) {
+        TOUCH_TRACE(TraceReport, length, 1, 0);
+        return true;
+    }
+
+    /* keep the head of reports the layout can't make sense of for tracedump */
+    if (touchTraceEnabled()) {
+        uint64_t head[2] = { 0, 0 };
+        memcpy(head, report, length < sizeof(head) ? length : sizeof(head));
+        touchTraceWrite(TraceRawReport, (uint32_t)length, head[0], head[1]);
+    }
+    return false;
+}
+
+void HidDeviceSession::drops(struct TouchDropCounts *drops) const
+{
+    drops->overflows += _monitor.overflows();
+    drops->lostReports += _monitor.lostReports();
+    drops->lostElements += _monitor.lostElements();
+    drops->fallbacks += _fallbacks;
+}
@@ -0,0 +1,137 @@
+#ifndef TOUCH_HID_DEVICE_H
+#define TOUCH_HID_DEVICE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include "touch_frame.h"
+#include "touch_hid_descriptor.h"
+#include "touch_hid_queue.h"
+#include "touch_layout_cache.h"
+
+/* TouchLayoutElement.type, numbered like IOHIDElementType */
+enum HidElementType {
+    HidElementInputMisc = 1,
+    HidElementInputButton = 2,
+    HidElementInputAxis = 3,
+    HidElementInputScanCodes = 4,
+    HidElementOutput = 129,
+    HidElementFeature = 257,
+    HidElementCollection = 513
+};
+
+/*
+ * An element of the device in use, looked up by cookie as values arrive.
+ * Its decoder and scale are settled when the element table is built, so
+ * a value costs one call through hidValueDecoders.
+ */
+struct HidElement {
+    uint32_t cookie;
+    uint32_t type;
+    uint16_t usagePage;
+    uint16_t usage;
+    int32_t value;
+    uint8_t op;                 /* HidOpNone for elements only kept for the trace */
+    struct HidScale scale;
+};
+
+typedef void (*HidReportHandler)(const uint8_t *report, size_t length, void *context);
+
+/*
+ * What the acquisition path needs from a HID device: its identity, its
+ * report descriptor and elements, an element value queue and raw input
+ * reports. IOKit devices implement it in touch_osx.cpp, simulated ones in
+ * touch_sim_device.cpp; everything past it is shared.
+ */
+class HidDevice
+{
+public:
+    virtual ~HidDevice() {}
+
+    virtual uint32_t vendorId() const = 0;
+    virtual uint32_t productId() const = 0;
+    virtual uint32_t version() const = 0;
+
+    /* false if the device doesn't expose its report descriptor */
+    virtual bool descriptor(std::vector<uint8_t> &descriptor) const = 0;
+    /* every element the device declares, before any filtering */
+    virtual std::vector<struct TouchLayoutElement> elements() const = 0;
+
+    /* an empty queue for the device's element values, owned by the caller */
+    virtual HidQueue *createQueue() = 0;
+    /* starts handing raw input reports to handler, in place of the queue */
+    virtual bool startReports(HidReportHandler handler, void *context) = 0;
+};
+
+/*
+ * Decode state of one device from discovery to disconnect.
+ *
+ * open() finds the elements and report layout, through the layout cache
+ * when the model has been seen before. The device's values then come
+ * either through the queue setupQueue() creates, drained by
+ * serviceQueue(), or as raw reports through decodeReport(); a queue
+ * that keeps overflowing is swapped for raw reports when the fallback is
+ * enabled. Completed frames go to the handler given to open().
+ *
+ * Everything but the counters belongs to the thread servicing the
+ * device.
+ */
+class HidDeviceSession
+{
+public:
+    HidDeviceSession();
+    ~HidDeviceSession();
+
+    bool open(HidDevice *device, int id, TouchFrameHandler handler, void *context);
+    /* forgets the device and deletes its queue */
+    void close();
+
+    void setRequestedFields(unsigned fields) { _fields = fields; }
+    void setQueueFallback(bool enable) { _queueFallback = enable; }
+
+    size_t elementCount() const { return _elements.size(); }
+    bool hasReportLayout() const { return _layout != 0; }
+    const HidReportLayout *reportLayout() const { return _layout; }
+
+    /* a queue subscribed to every input element, not started yet, 0 on failure */
+    HidQueue *setupQueue();
+    HidQueue *queue() const { return _queue; }
+    void serviceQueue(uint64_t receiveTime);
+
+    /* switches to raw reports, false without a report layout */
+    bool startReports();
+    bool rawReports() const { return _rawReports; }
+    bool decodeReport(const uint8_t *report, size_t length, uint64_t receiveTime);
+
+    const HidQueueMonitor &queueMonitor() const { return _monitor; }
+    /* adds what the queue lost to drops, over every open() so far */
+    void drops(struct TouchDropCounts *drops) const;
+
+private:
+    bool discover(const std::vector<uint8_t> &descriptor, struct TouchLayout *layout);
+    bool loadElements(const std::vector<struct TouchLayoutElement> &elements);
+    void decodeValue(const struct HidQueueEvent *event);
+
+    static void DecodeQueueEvent(const struct HidQueueEvent *event, void *context);
+    static void ReportReceived(const uint8_t *report, size_t length, void *context);
+
+    HidDevice *_device;
+    TouchFrameAssembler _assembler;
+    unsigned _fields;
+    bool _queueFallback;
+
+    std::vector<struct HidElement> _elements;
+    std::vector<struct HidElement *> _elementsByCookie;     /* dense, indexed by cookie */
+    HidReportLayout *_layout;
+
+    HidQueue *_queue;
+    HidQueueMonitor _monitor;
+    std::atomic<bool> _rawReports;
+    std::atomic<unsigned long> _fallbacks;
+    uint64_t _receiveTime;      /* of the queue service running */
+};
+
+#endif // TOUCH_HID_DEVICE_H
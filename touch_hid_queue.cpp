@@ -0,0 +1,209 @@
+#include "touch_hid_queue.h"
+
+#include <algorithm>
+
+/* report intervals longer than this are pauses, not the report rate */
+#define HID_QUEUE_PAUSE_NS 100000000ull
+
+int hidQueueDepth(int elementsPerReport, double reportRate, int serviceMs)
+{
+    /* the reports arriving while service is late, plus the one in flight */
+    int reports = (int)(reportRate * serviceMs / 1000.0 + 0.999) + 1;
+    long depth = (long)std::max(elementsPerReport, 1) * std::max(reports, 2);
+    return (int)std::min<long>(std::max<long>(depth, HID_QUEUE_MIN_DEPTH), HID_QUEUE_MAX_DEPTH);
+}
+
+HidQueueMonitor::HidQueueMonitor() :
+    _elementsPerReport(0),
+    _interval(0),
+    _reportTime(0),
+    _reportCount(0),
+    _suspect(false),
+    _saturated(false),
+    _saturatedAtMax(0),
+    _events(0),
+    _reports(0),
+    _overflows(0),
+    _lostReports(0),
+    _lostElements(0)
+{
+}
+
+int HidQueueMonitor::initialDepth() const
+{
+    return hidQueueDepth(_elementsPerReport, HID_QUEUE_REPORT_RATE, HID_QUEUE_SERVICE_MS);
+}
+
+void HidQueueMonitor::restart()
+{
+    _interval = 0;
+    _reportTime = 0;
+    _reportCount = 0;
+    _suspect = false;
+    _saturated = false;
+    _saturatedAtMax = 0;
+}
+
+size_t HidQueueMonitor::drain(HidQueue &queue, HidQueueHandler handler, void *context, uint64_t start)
+{
+    struct HidQueueEvent event;
+    size_t count = 0;
+    size_t held = 0;            /* values queued before the drain started */
+
+    while (queue.dequeue(&event)) {
+        observe(event);
+        if (handler)
+            handler(&event, context);
+        count++;
+        held += event.timestamp <= start;
+    }
+
+    /* a queue holding all it can has been turning values away */
+    int depth = queue.depth();
+    _saturated = held && held >= (size_t)depth;
+    if (_saturated) {
+        _overflows++;
+        _suspect = true;
+        if (depth >= HID_QUEUE_MAX_DEPTH)
+            _saturatedAtMax++;
+    }
+    return count;
+}
+
+void HidQueueMonitor::observe(const struct HidQueueEvent &event)
+{
+    if (_reportCount && event.timestamp != _reportTime) {
+        closeReport(event.timestamp);
+        _reportCount = 0;
+    }
+    if (!_reportCount)
+        _reportTime = event.timestamp;
+    _reportCount++;
+    _events++;
+}
+
+void HidQueueMonitor::closeReport(uint64_t next)
+{
+    _reports++;
+    uint64_t delta = next > _reportTime ? next - _reportTime : 0;
+
+    if (_suspect) {
+        /* the report cut off by the overflow and those that never made it */
+        _suspect = false;
+        if (_reportCount < _elementsPerReport)
+            _lostElements += _elementsPerReport - _reportCount;
+        if (_interval && delta > _interval * 3 / 2)
+            _lostReports += (unsigned long)((delta + _interval / 2) / _interval - 1);
+    }
+    else if (delta && delta < HID_QUEUE_PAUSE_NS) {
+        _interval = _interval ? (_interval * 7 + delta) / 8 : delta;
+    }
+}
+
+HidQueueAdvice HidQueueMonitor::advice(int depth) const
+{
+    if (!_saturated)
+        return HidQueueKeep;
+    if (depth < HID_QUEUE_MAX_DEPTH)
+        return HidQueueGrow;
+    if (_saturatedAtMax >= HID_QUEUE_FALLBACK_OVERFLOWS)
+        return HidQueueFallBack;
+    return HidQueueKeep;
+}
+
+int HidQueueMonitor::grownDepth(int depth) const
+{
+    double rate = reportRate();
+    int needed = hidQueueDepth(_elementsPerReport, rate > 0 ? rate : HID_QUEUE_REPORT_RATE,
+                               HID_QUEUE_SERVICE_MS);
+    return std::min(std::max(depth * 2, needed), HID_QUEUE_MAX_DEPTH);
+}
+
+double HidQueueMonitor::reportRate() const
+{
+    return _interval ? 1e9 / _interval : 0;
+}
+
+SimulatedHidQueue::SimulatedHidQueue() :
+    _depth(0),
+    _running(false),
+    _rejected(0)
+{
+}
+
+bool SimulatedHidQueue::create(int depth)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _events.clear();
+    _cookies.clear();
+    _depth = depth;
+    return depth > 0;
+}
+
+bool SimulatedHidQueue::resize(int depth)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    if (depth <= 0)
+        return false;
+    while (_events.size() > (size_t)depth)
+        _events.pop_back();
+    _depth = depth;
+    return true;
+}
+
+bool SimulatedHidQueue::addElement(uint32_t cookie)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    if (std::find(_cookies.begin(), _cookies.end(), cookie) == _cookies.end())
+        _cookies.push_back(cookie);
+    return true;
+}
+
+bool SimulatedHidQueue::start()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _running = _depth > 0;
+    return _running;
+}
+
+void SimulatedHidQueue::stop()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _running = false;
+}
+
+bool SimulatedHidQueue::dequeue(struct HidQueueEvent *event)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    if (_events.empty())
+        return false;
+    *event = _events.front();
+    _events.pop_front();
+    return true;
+}
+
+size_t SimulatedHidQueue::enqueueReport(const struct HidQueueEvent *events, size_t count)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    if (!_running)
+        return 0;
+
+    size_t queued = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (std::find(_cookies.begin(), _cookies.end(), events[i].cookie) == _cookies.end())
+            continue;
+        if (_events.size() >= (size_t)_depth) {
+            _rejected++;
+            continue;
+        }
+        _events.push_back(events[i]);
+        queued++;
+    }
+    return queued;
+}
+
+size_t SimulatedHidQueue::size() const
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return _events.size();
+}
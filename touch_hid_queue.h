@@ -0,0 +1,168 @@
+#ifndef TOUCH_HID_QUEUE_H
+#define TOUCH_HID_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/* smallest and largest depth a queue is created with, in element values */
+#define HID_QUEUE_MIN_DEPTH 8
+#define HID_QUEUE_MAX_DEPTH 4096
+
+/* report rate assumed until one has been measured */
+#define HID_QUEUE_REPORT_RATE 250
+
+/* longest the run loop may be late servicing a queue without losing input */
+#define HID_QUEUE_SERVICE_MS 20
+
+/* overflows at the largest depth before falling back to raw reports */
+#define HID_QUEUE_FALLBACK_OVERFLOWS 3
+
+/* one element value, as a HID queue hands it out */
+struct HidQueueEvent {
+    uint32_t cookie;
+    int32_t value;
+    uint64_t timestamp;         /* ns, shared by all values of one report */
+};
+
+/*
+ * An element value queue of a HID device, as IOKit provides one. A full
+ * queue drops the values that no longer fit, newest first, and tells
+ * nobody.
+ */
+class HidQueue
+{
+public:
+    virtual ~HidQueue() {}
+
+    virtual bool create(int depth) = 0;
+    /*
+     * Changes the depth, keeping the elements added so far. A queue that
+     * can't be rebuilt from its own callout may do it once that returns.
+     */
+    virtual bool resize(int depth) = 0;
+    virtual int depth() const = 0;
+
+    virtual bool addElement(uint32_t cookie) = 0;
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+
+    /* the oldest queued value, false once the queue is empty */
+    virtual bool dequeue(struct HidQueueEvent *event) = 0;
+};
+
+/* values of one report the queue must hold for every report it buffers */
+int hidQueueDepth(int elementsPerReport, double reportRate, int serviceMs);
+
+typedef void (*HidQueueHandler)(const struct HidQueueEvent *event, void *context);
+
+enum HidQueueAdvice {
+    HidQueueKeep,
+    HidQueueGrow,               /* resize to grownDepth() */
+    HidQueueFallBack            /* growing didn't help, read raw reports instead */
+};
+
+/*
+ * Drains a HidQueue and works out what it lost.
+ *
+ * Queues don't report overflows, so they are inferred: a drain that
+ * finds the queue holding its full depth means values were turned away.
+ * Only values stamped before the drain started count towards that, the
+ * device goes on queueing while a long drain runs.
+ * The values of a report share its timestamp, so after such a drain the
+ * report left short of elementsPerReport values counts its missing
+ * values, and the time to the next report counts the reports that fit
+ * in between at the measured report interval. Pauses while nothing
+ * overflowed are just pauses.
+ *
+ * Counters may be read from any thread, the rest belongs to the thread
+ * draining the queue.
+ */
+class HidQueueMonitor
+{
+public:
+    HidQueueMonitor();
+
+    /* values every report puts into the queue */
+    void setElementsPerReport(int count) { _elementsPerReport = count; }
+    int elementsPerReport() const { return _elementsPerReport; }
+    int initialDepth() const;
+    /* forgets the queue watched so far for a new one, keeping the counters */
+    void restart();
+
+    /*
+     * Dequeues all values, passing each to handler, returns how many.
+     * start is when the drain began, on the clock of the value timestamps.
+     */
+    size_t drain(HidQueue &queue, HidQueueHandler handler, void *context, uint64_t start);
+
+    HidQueueAdvice advice(int depth) const;
+    int grownDepth(int depth) const;
+
+    /* reports per second, 0 until measured */
+    double reportRate() const;
+
+    unsigned long events() const { return _events; }
+    unsigned long reports() const { return _reports; }
+    unsigned long overflows() const { return _overflows; }
+    unsigned long lostReports() const { return _lostReports; }
+    unsigned long lostElements() const { return _lostElements; }
+
+private:
+    void observe(const struct HidQueueEvent &event);
+    void closeReport(uint64_t next);
+
+    int _elementsPerReport;
+    uint64_t _interval;         /* moving average of the report interval, ns */
+    uint64_t _reportTime;       /* timestamp of the report being collected */
+    int _reportCount;           /* its values seen so far */
+    bool _suspect;              /* the last drain found the queue full */
+    bool _saturated;
+    int _saturatedAtMax;
+
+    std::atomic<unsigned long> _events;
+    std::atomic<unsigned long> _reports;
+    std::atomic<unsigned long> _overflows;
+    std::atomic<unsigned long> _lostReports;
+    std::atomic<unsigned long> _lostElements;
+};
+
+/*
+ * A HidQueue in memory with the same overflow behaviour, fed report by
+ * report. Safe to feed from one thread while another drains it.
+ */
+class SimulatedHidQueue : public HidQueue
+{
+public:
+    SimulatedHidQueue();
+
+    bool create(int depth);
+    bool resize(int depth);
+    int depth() const { return _depth; }
+
+    bool addElement(uint32_t cookie);
+    bool start();
+    void stop();
+
+    bool dequeue(struct HidQueueEvent *event);
+
+    /* queues the values of one report, returns how many fit */
+    size_t enqueueReport(const struct HidQueueEvent *events, size_t count);
+    size_t size() const;
+    /* values turned away, what HidQueueMonitor estimates */
+    unsigned long rejected() const { return _rejected; }
+
+private:
+    mutable std::mutex _lock;
+    std::deque<struct HidQueueEvent> _events;
+    std::vector<uint32_t> _cookies;
+    int _depth;
+    bool _running;
+    std::atomic<unsigned long> _rejected;
+};
+
+#endif // TOUCH_HID_QUEUE_H
@@ -0,0 +1,290 @@
+#include "touch_history.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * One block of samples, a separate array per field. Until a chunk is
+ * simplified slot i holds sequence first + i; afterwards offset[] maps
+ * the remaining slots to their sequences.
+ */
+struct TouchHistory::Chunk {
+    uint64_t first;
+    uint32_t count;     /* slots in use */
+    uint32_t span;      /* sequences covered */
+    bool simplified;
+
+    int32_t idx[HISTORY_CHUNK_EVENTS];
+    int32_t x[HISTORY_CHUNK_EVENTS];
+    int32_t y[HISTORY_CHUNK_EVENTS];
+    uint64_t hostTime[HISTORY_CHUNK_EVENTS];
+    uint16_t offset[HISTORY_CHUNK_EVENTS];
+    uint8_t flags[HISTORY_CHUNK_EVENTS];
+    uint8_t device[HISTORY_CHUNK_EVENTS];
+};
+
+TouchHistory::TouchHistory() :
+    _next(0),
+    _count(0),
+    _simplified(0)
+{
+    memset(&_policy, 0, sizeof(_policy));
+}
+
+TouchHistory::~TouchHistory()
+{
+    clear();
+    for (size_t i = 0; i < _spare.size(); i++)
+        free(_spare[i]);
+}
+
+TouchHistory::Chunk *TouchHistory::allocChunk(uint64_t first)
+{
+    Chunk *chunk;
+    if (!_spare.empty()) {
+        chunk = _spare.back();
+        _spare.pop_back();
+    }
+    else {
+        chunk = (Chunk *)malloc(sizeof(Chunk));
+        if (!chunk)
+            return 0;
+    }
+
+    chunk->first = first;
+    chunk->count = 0;
+    chunk->span = 0;
+    chunk->simplified = false;
+    return chunk;
+}
+
+void TouchHistory::releaseChunk(Chunk *chunk)
+{
+    if (_spare.size() < HISTORY_SPARE_CHUNKS)
+        _spare.push_back(chunk);
+    else
+        free(chunk);
+}
+
+void TouchHistory::clear()
+{
+    while (!_chunks.empty())
+        dropFront();
+}
+
+void TouchHistory::dropFront()
+{
+    Chunk *chunk = _chunks.front();
+    _chunks.pop_front();
+    _count -= chunk->count;
+    if (_simplified)
+        _simplified--;
+    releaseChunk(chunk);
+}
+
+uint64_t TouchHistory::begin() const
+{
+    return _chunks.empty() ? _next : _chunks.front()->first;
+}
+
+size_t TouchHistory::bytes() const
+{
+    return _chunks.size() * sizeof(Chunk);
+}
+
+uint64_t TouchHistory::append(const struct TouchEvent &ev)
+{
+    Chunk *chunk = _chunks.empty() ? 0 : _chunks.back();
+    if (!chunk || chunk->simplified || chunk->span == HISTORY_CHUNK_EVENTS) {
+        chunk = allocChunk(_next);
+        if (!chunk)
+            return _next++;
+        _chunks.push_back(chunk);
+    }
+
+    uint32_t i = chunk->count++;
+    chunk->idx[i] = ev.idx;
+    chunk->x[i] = ev.x;
+    chunk->y[i] = ev.y;
+    chunk->hostTime[i] = ev.hostTime;
+    chunk->offset[i] = (uint16_t)chunk->span++;
+    chunk->flags[i] = (uint8_t)ev.flags;
+    chunk->device[i] = (uint8_t)ev.device;
+    _count++;
+    return _next++;
+}
+
+size_t TouchHistory::read(uint64_t &seq, struct TouchEvent *out, size_t max) const
+{
+    if (_chunks.empty() || !max) {
+        if (seq < _next)
+            seq = _next;
+        return 0;
+    }
+    if (seq < begin())
+        seq = begin();
+
+    /* last chunk starting at or before seq */
+    size_t c = std::upper_bound(_chunks.begin(), _chunks.end(), seq,
+                                [](uint64_t s, const Chunk *chunk) { return s < chunk->first; })
+            - _chunks.begin() - 1;
+
+    size_t n = 0;
+    for (; c < _chunks.size() && n < max; c++) {
+        const Chunk *chunk = _chunks[c];
+        uint64_t from = seq > chunk->first ? seq - chunk->first : 0;
+        uint32_t i;
+        if (!chunk->simplified)
+            i = (uint32_t)std::min<uint64_t>(from, chunk->count);
+        else
+            i = std::lower_bound(chunk->offset, chunk->offset + chunk->count, from) - chunk->offset;
+
+        for (; i < chunk->count && n < max; i++, n++) {
+            struct TouchEvent *ev = &out[n];
+            ev->idx = chunk->idx[i];
+            ev->x = chunk->x[i];
+            ev->y = chunk->y[i];
+            ev->flags = chunk->flags[i];
+            ev->deviceTime = 0;
+            ev->hostTime = chunk->hostTime[i];
+            ev->device = chunk->device[i];
+            seq = chunk->first + chunk->offset[i] + 1;
+        }
+        if (i == chunk->count && seq < chunk->first + chunk->span)
+            seq = chunk->first + chunk->span;
+    }
+    return n;
+}
+
+void TouchHistory::enforce(uint64_t now)
+{
+    /* the chunk being appended to is never dropped */
+    while (_chunks.size() > 1) {
+        const Chunk *oldest = _chunks.front();
+        const Chunk *next = _chunks[1];
+        bool drop = false;
+
+        if (_policy.maxEvents && _count - oldest->count >= _policy.maxEvents)
+            drop = true;
+        if (_policy.maxBytes && bytes() > _policy.maxBytes)
+            drop = true;
+        if (_policy.maxAgeNs && next->count && now > _policy.maxAgeNs
+                && next->hostTime[0] < now - _policy.maxAgeNs)
+            drop = true;
+        if (!drop)
+            break;
+        dropFront();
+    }
+
+    if (_policy.simplifyError <= 0.0f || _simplified + 1 >= _chunks.size())
+        return;
+
+    Chunk *chunk = _chunks[_simplified];
+    if (!chunk->count || now < _policy.simplifyAfterNs
+            || chunk->hostTime[chunk->count - 1] >= now - _policy.simplifyAfterNs)
+        return;
+
+    _count -= simplify(chunk);
+    _simplified++;
+}
+
+/*
+ * Thins each stroke in chunk, a run of touching samples of one contact,
+ * to the points Ramer-Douglas-Peucker keeps for the tolerance. The ends
+ * of every run survive, so strokes crossing chunks stay connected, and
+ * samples that are not touching are never removed. Returns the number of
+ * samples removed.
+ */
+size_t TouchHistory::simplify(Chunk *chunk)
+{
+    std::vector<bool> keep(chunk->count, false);
+    /* strokes are told apart by device and contact id */
+    std::vector<std::pair<int64_t, std::vector<uint32_t> > > open;
+    std::vector<std::pair<uint32_t, uint32_t> > stack;
+    float tolerance = _policy.simplifyError;
+
+    /* runs with at least three points go through the simplifier */
+    auto thin = [&](const std::vector<uint32_t> &run) {
+        if (run.empty())
+            return;
+        keep[run.front()] = true;
+        keep[run.back()] = true;
+
+        stack.clear();
+        if (run.size() > 2)
+            stack.push_back(std::make_pair(0u, (uint32_t)run.size() - 1));
+        while (!stack.empty()) {
+            uint32_t a = stack.back().first;
+            uint32_t b = stack.back().second;
+            stack.pop_back();
+
+            float ax = chunk->x[run[a]], ay = chunk->y[run[a]];
+            float dx = chunk->x[run[b]] - ax, dy = chunk->y[run[b]] - ay;
+            float length = sqrtf(dx * dx + dy * dy);
+
+            float worst = 0.0f;
+            uint32_t at = a;
+            for (uint32_t k = a + 1; k < b; k++) {
+                float px = chunk->x[run[k]] - ax, py = chunk->y[run[k]] - ay;
+                float d = length > 0.0f ? fabsf(px * dy - py * dx) / length
+                                        : sqrtf(px * px + py * py);
+                if (d > worst) {
+                    worst = d;
+                    at = k;
+                }
+            }
+            if (worst > tolerance) {
+                keep[run[at]] = true;
+                if (at - a > 1)
+                    stack.push_back(std::make_pair(a, at));
+                if (b - at > 1)
+                    stack.push_back(std::make_pair(at, b));
+            }
+        }
+    };
+
+    for (uint32_t i = 0; i < chunk->count; i++) {
+        int64_t stroke = (int64_t)chunk->device[i] << 32 | (uint32_t)chunk->idx[i];
+        size_t k;
+        for (k = 0; k < open.size(); k++) {
+            if (open[k].first == stroke)
+                break;
+        }
+
+        if (!(chunk->flags[i] & TOUCH_CONTACT_TIP)) {
+            keep[i] = true;
+            if (k < open.size()) {
+                thin(open[k].second);
+                open.erase(open.begin() + k);
+            }
+            continue;
+        }
+
+        if (k == open.size())
+            open.push_back(std::make_pair(stroke, std::vector<uint32_t>()));
+        open[k].second.push_back(i);
+    }
+    for (size_t k = 0; k < open.size(); k++)
+        thin(open[k].second);
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < chunk->count; i++) {
+        if (!keep[i])
+            continue;
+        chunk->idx[kept] = chunk->idx[i];
+        chunk->x[kept] = chunk->x[i];
+        chunk->y[kept] = chunk->y[i];
+        chunk->hostTime[kept] = chunk->hostTime[i];
+        chunk->offset[kept] = chunk->offset[i];
+        chunk->flags[kept] = chunk->flags[i];
+        chunk->device[kept] = chunk->device[i];
+        kept++;
+    }
+
+    size_t removed = chunk->count - kept;
+    chunk->count = kept;
+    chunk->simplified = true;
+    return removed;
+}
@@ -0,0 +1,80 @@
+#ifndef TOUCH_HISTORY_H
+#define TOUCH_HISTORY_H
+
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "touch_shared.h"
+
+#define HISTORY_CHUNK_EVENTS 4096
+
+/* chunks kept around for reuse instead of going back to the heap */
+#define HISTORY_SPARE_CHUNKS 4
+
+/* zero disables a limit */
+struct TouchHistoryPolicy {
+    uint64_t maxAgeNs;          /* drop samples older than this */
+    size_t maxEvents;           /* keep at most about this many samples */
+    size_t maxBytes;            /* keep at most about this much chunk memory */
+    float simplifyError;        /* Ramer-Douglas-Peucker tolerance in pixels */
+    uint64_t simplifyAfterNs;   /* only simplify samples older than this */
+};
+
+/*
+ * Append-only store of every touch sample the window has seen.
+ *
+ * Samples are numbered by a sequence that never goes back, so readers keep
+ * watermarks rather than indices. Storage is a queue of fixed-size chunks
+ * with one array per field; chunks come from a small pool and whole chunks
+ * are dropped from the front as the retention policy demands.
+ *
+ * With a simplify tolerance set, chunks that have aged out of the live
+ * range get their strokes thinned with Ramer-Douglas-Peucker. The
+ * sequence numbers of removed samples are skipped by readers; device
+ * timestamps are not kept.
+ */
+class TouchHistory
+{
+public:
+    TouchHistory();
+    ~TouchHistory();
+
+    void setPolicy(const struct TouchHistoryPolicy &policy) { _policy = policy; }
+    const struct TouchHistoryPolicy &policy() const { return _policy; }
+
+    uint64_t append(const struct TouchEvent &ev);
+
+    /*
+     * Copies up to max samples numbered seq or later to out and moves seq
+     * past the last one. Samples already dropped are skipped.
+     */
+    size_t read(uint64_t &seq, struct TouchEvent *out, size_t max) const;
+
+    uint64_t begin() const;
+    uint64_t end() const { return _next; }
+    size_t size() const { return _count; }
+    size_t bytes() const;
+
+    /* applies the retention policy and simplifies at most one chunk */
+    void enforce(uint64_t now);
+    void clear();
+
+private:
+    struct Chunk;
+
+    Chunk *allocChunk(uint64_t first);
+    void releaseChunk(Chunk *chunk);
+    void dropFront();
+    size_t simplify(Chunk *chunk);
+
+    struct TouchHistoryPolicy _policy;
+    std::deque<Chunk *> _chunks;
+    std::vector<Chunk *> _spare;
+    uint64_t _next;
+    size_t _count;
+    size_t _simplified;         /* leading chunks already simplified */
+};
+
+#endif // TOUCH_HISTORY_H
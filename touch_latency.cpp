@@ -0,0 +1,94 @@
+#include "touch_latency.h"
+
+static LatencyHistogram gStages[TouchLatencyStageCount];
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::reset()
+{
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        _buckets[i].store(0, std::memory_order_relaxed);
+    _count.store(0, std::memory_order_relaxed);
+    _sum.store(0, std::memory_order_relaxed);
+    _max.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::bucketOf(uint64_t ns)
+{
+    if (ns < (1u << LATENCY_SUB_BITS))
+        return (int)ns;
+
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - LATENCY_SUB_BITS;
+    return ((shift + 1) << LATENCY_SUB_BITS)
+            + (int)((ns >> shift) & ((1u << LATENCY_SUB_BITS) - 1));
+}
+
+/* midpoint of the values that land in bucket */
+uint64_t LatencyHistogram::bucketValue(int bucket)
+{
+    if (bucket < (1 << LATENCY_SUB_BITS))
+        return bucket;
+
+    int shift = (bucket >> LATENCY_SUB_BITS) - 1;
+    uint64_t sub = bucket & ((1u << LATENCY_SUB_BITS) - 1);
+    uint64_t low = ((1ull << LATENCY_SUB_BITS) | sub) << shift;
+    return low + ((1ull << shift) >> 1);
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    _buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t seen = _max.load(std::memory_order_relaxed);
+    while (ns > seen && !_max.compare_exchange_weak(seen, ns, std::memory_order_relaxed))
+        ;
+}
+
+uint64_t LatencyHistogram::mean() const
+{
+    uint64_t n = count();
+    return n ? _sum.load(std::memory_order_relaxed) / n : 0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    uint64_t n = count();
+    if (!n)
+        return 0;
+
+    uint64_t rank = (uint64_t)(p * (n - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += _buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return bucketValue(i);
+    }
+    return max();
+}
+
+LatencyHistogram &touchLatency(TouchLatencyStage stage)
+{
+    return gStages[stage];
+}
+
+const char *touchLatencyStageName(TouchLatencyStage stage)
+{
+    switch (stage) {
+    case TouchLatencyDevice:
+        return "device";
+    case TouchLatencyQueue:
+        return "queue";
+    case TouchLatencyPresent:
+        return "present";
+    case TouchLatencyTotal:
+        return "total";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef TOUCH_LATENCY_H
+#define TOUCH_LATENCY_H
+
+#include <atomic>
+#include <stdint.h>
+
+#define LATENCY_SUB_BITS 4
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+/*
+ * Lock-free log-linear latency histogram.
+ *
+ * Each power of two is split into 2^LATENCY_SUB_BITS buckets, so any
+ * value is reported within about 6%. record() may be called from any
+ * thread; readers see a consistent enough snapshot for percentiles.
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(uint64_t ns);
+    void reset();
+
+    uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+    uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+    uint64_t mean() const;
+    uint64_t percentile(double p) const;
+
+private:
+    static int bucketOf(uint64_t ns);
+    static uint64_t bucketValue(int bucket);
+
+    std::atomic<uint64_t> _buckets[LATENCY_BUCKETS];
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _sum;
+    std::atomic<uint64_t> _max;
+};
+
+/* where along the pipeline a latency was measured */
+enum TouchLatencyStage {
+    TouchLatencyDevice,     /* device timestamp to host receive */
+    TouchLatencyQueue,      /* host receive to GUI dequeue */
+    TouchLatencyPresent,    /* GUI dequeue to present */
+    TouchLatencyTotal,      /* host receive to present */
+    TouchLatencyStageCount
+};
+
+LatencyHistogram &touchLatency(TouchLatencyStage stage);
+const char *touchLatencyStageName(TouchLatencyStage stage);
+
+#endif // TOUCH_LATENCY_H
@@ -0,0 +1,294 @@
+#include "touch_layout_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Cache file layout, in host byte order:
+ *
+ *   FileHeader
+ *   { FileEntry, TouchLayoutElement[entry.elementCount],
+ *     { FileReport, HidField[report.fieldCount] } [entry.reportCount] } ...
+ *
+ * Decode plans are not stored, they are compiled again on load so a
+ * change to the decoder never meets a stale plan. An entry whose checksum
+ * doesn't match, or whose cookies or fields don't fit, is skipped: the
+ * decoder indexes and reads reports with them unchecked.
+ */
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t fieldSize;         /* sizeof(HidField) of the writer */
+    uint32_t entryCount;
+};
+
+struct FileEntry {
+    struct TouchLayoutKey key;
+    uint32_t elementCount;
+    uint32_t reportCount;
+    uint32_t reportIds;
+    uint32_t checksum;          /* entryChecksum() of what follows */
+};
+
+struct FileReport {
+    uint32_t id;
+    uint32_t bitLength;
+    uint32_t fieldCount;
+    uint32_t reserved;
+};
+
+static uint64_t hashMore(uint64_t hash, const void *data, size_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static struct FileReport fileReport(const HidReport &fields)
+{
+    struct FileReport report;
+    memset(&report, 0, sizeof(report));
+    report.id = fields.id;
+    report.bitLength = fields.bitLength;
+    report.fieldCount = (uint32_t)fields.fields.size();
+    return report;
+}
+
+/* the elements, report headers and fields of an entry, as the file holds them */
+static uint32_t entryChecksum(const struct TouchLayout &layout)
+{
+    uint64_t sum = TouchLayoutCache::hash(0, 0);
+    sum = hashMore(sum, layout.elements.data(), layout.elements.size() * sizeof(struct TouchLayoutElement));
+    for (size_t r = 0; r < layout.reports.size(); r++) {
+        struct FileReport report = fileReport(layout.reports[r]);
+        sum = hashMore(sum, &report, sizeof(report));
+        sum = hashMore(sum, layout.reports[r].fields.data(), report.fieldCount * sizeof(HidField));
+    }
+    return (uint32_t)(sum ^ (sum >> 32));
+}
+
+/* what the decoder relies on without checking again */
+static bool validLayout(const struct TouchLayout &layout)
+{
+    for (size_t i = 0; i < layout.elements.size(); i++) {
+        if (layout.elements[i].cookie >= HID_MAX_COOKIE)
+            return false;
+    }
+    for (size_t r = 0; r < layout.reports.size(); r++) {
+        if (!HidReportLayout::isValidReport(layout.reports[r]))
+            return false;
+    }
+    return true;
+}
+
+static bool sameKey(const struct TouchLayoutKey &a, const struct TouchLayoutKey &b)
+{
+    return a.vendorId == b.vendorId && a.productId == b.productId
+            && a.version == b.version && a.descriptorHash == b.descriptorHash;
+}
+
+TouchLayoutCache::TouchLayoutCache() :
+    _loaded(false)
+{
+}
+
+void TouchLayoutCache::setPath(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _path = path;
+    _loaded = false;
+}
+
+uint64_t TouchLayoutCache::hash(const uint8_t *data, size_t length)
+{
+    return hashMore(0xcbf29ce484222325ull, data, length);
+}
+
+bool TouchLayoutCache::find(const struct TouchLayoutKey &key, struct TouchLayout *layout)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    if (!_loaded) {
+        _loaded = true;
+        load();
+    }
+
+    for (size_t i = 0; i < _entries.size(); i++) {
+        if (sameKey(_entries[i].key, key)) {
+            *layout = _entries[i].layout;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TouchLayoutCache::insert(const struct TouchLayoutKey &key, const struct TouchLayout &layout)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    if (!_loaded) {
+        _loaded = true;
+        load();
+    }
+
+    for (size_t i = 0; i < _entries.size(); i++) {
+        if (sameKey(_entries[i].key, key)) {
+            _entries.erase(_entries.begin() + i);
+            break;
+        }
+    }
+    if (_entries.size() >= TOUCH_LAYOUT_CACHE_ENTRIES)
+        _entries.erase(_entries.begin());
+
+    Entry entry;
+    entry.key = key;
+    entry.layout = layout;
+    for (size_t i = 0; i < entry.layout.reports.size(); i++)
+        entry.layout.reports[i].plan.clear();
+    _entries.push_back(entry);
+
+    save();
+}
+
+void TouchLayoutCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _entries.clear();
+    _loaded = true;
+}
+
+bool TouchLayoutCache::load()
+{
+    _entries.clear();
+    if (_path.empty())
+        return false;
+
+    FILE *file = fopen(_path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    struct FileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+            && header.magic == TOUCH_LAYOUT_CACHE_MAGIC
+            && header.version == TOUCH_LAYOUT_CACHE_VERSION
+            && header.fieldSize == sizeof(HidField)
+            && header.entryCount <= TOUCH_LAYOUT_CACHE_ENTRIES;
+
+    for (uint32_t e = 0; ok && e < header.entryCount; e++) {
+        struct FileEntry stored;
+        ok = fread(&stored, sizeof(stored), 1, file) == 1
+                && stored.elementCount <= 0xffff && stored.reportCount <= 256;
+        if (!ok)
+            break;
+
+        Entry entry;
+        entry.key = stored.key;
+        entry.layout.reportIds = stored.reportIds != 0;
+        entry.layout.elements.resize(stored.elementCount);
+        if (stored.elementCount)
+            ok = fread(entry.layout.elements.data(), sizeof(struct TouchLayoutElement),
+                       stored.elementCount, file) == stored.elementCount;
+
+        for (uint32_t r = 0; ok && r < stored.reportCount; r++) {
+            struct FileReport report;
+            ok = fread(&report, sizeof(report), 1, file) == 1
+                    && report.id <= 0xff && report.fieldCount <= 0xffff;
+            if (!ok)
+                break;
+
+            HidReport fields;
+            fields.id = (uint8_t)report.id;
+            fields.bitLength = report.bitLength;
+            fields.fields.resize(report.fieldCount);
+            if (report.fieldCount)
+                ok = fread(fields.fields.data(), sizeof(HidField), report.fieldCount, file)
+                        == report.fieldCount;
+            entry.layout.reports.push_back(fields);
+        }
+
+        /* a bad entry is skipped, the ones around it still read */
+        if (ok && stored.checksum == entryChecksum(entry.layout) && validLayout(entry.layout))
+            _entries.push_back(entry);
+    }
+    fclose(file);
+
+    /* a damaged file is dropped as a whole, the next insert replaces it */
+    if (!ok)
+        _entries.clear();
+    return ok;
+}
+
+/* written beside the old file and renamed over it, so readers never see half */
+bool TouchLayoutCache::save() const
+{
+    if (_path.empty())
+        return false;
+
+    std::string temporary = _path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+
+    struct FileHeader header;
+    header.magic = TOUCH_LAYOUT_CACHE_MAGIC;
+    header.version = TOUCH_LAYOUT_CACHE_VERSION;
+    header.fieldSize = sizeof(HidField);
+    header.entryCount = (uint32_t)_entries.size();
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (size_t e = 0; ok && e < _entries.size(); e++) {
+        const struct TouchLayout &layout = _entries[e].layout;
+        struct FileEntry stored;
+        memset(&stored, 0, sizeof(stored));
+        stored.key = _entries[e].key;
+        stored.elementCount = (uint32_t)layout.elements.size();
+        stored.reportCount = (uint32_t)layout.reports.size();
+        stored.reportIds = layout.reportIds;
+        stored.checksum = entryChecksum(layout);
+        ok = fwrite(&stored, sizeof(stored), 1, file) == 1
+                && fwrite(layout.elements.data(), sizeof(struct TouchLayoutElement),
+                          stored.elementCount, file) == stored.elementCount;
+
+        for (size_t r = 0; ok && r < layout.reports.size(); r++) {
+            const HidReport &fields = layout.reports[r];
+            struct FileReport report = fileReport(fields);
+            ok = fwrite(&report, sizeof(report), 1, file) == 1
+                    && fwrite(fields.fields.data(), sizeof(HidField),
+                              report.fieldCount, file) == report.fieldCount;
+        }
+    }
+
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), _path.c_str())) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+static std::string defaultPath()
+{
+    const char *path = getenv("TOUCH_LAYOUT_CACHE");
+    if (path)
+        return path;
+
+    const char *home = getenv("HOME");
+    if (!home || !*home)
+        return std::string();
+#ifdef __APPLE__
+    return std::string(home) + "/Library/Caches/TouchTest.layouts";
+#else
+    return std::string(home) + "/.cache/TouchTest.layouts";
+#endif
+}
+
+TouchLayoutCache &touchLayoutCache()
+{
+    /* function statics are initialized once, whichever thread gets here first */
+    static TouchLayoutCache cache;
+    static bool configured = (cache.setPath(defaultPath()), true);
+    (void)configured;
+    return cache;
+}
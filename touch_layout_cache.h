@@ -0,0 +1,109 @@
+#ifndef TOUCH_LAYOUT_CACHE_H
+#define TOUCH_LAYOUT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "touch_hid_descriptor.h"
+
+/* devices remembered, the least recently added are forgotten first */
+#define TOUCH_LAYOUT_CACHE_ENTRIES 64
+
+#define TOUCH_LAYOUT_CACHE_MAGIC    0x43594c54u     /* "TLYC" */
+#define TOUCH_LAYOUT_CACHE_VERSION  2
+
+/*
+ * A device model as far as decoding goes. The descriptor hash tells
+ * firmware revisions apart that kept their version number.
+ */
+struct TouchLayoutKey {
+    uint32_t vendorId;
+    uint32_t productId;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t descriptorHash;
+};
+
+/*
+ * Cookies index a dense table, so elements with a cookie at or past this
+ * are left out. Devices number their elements from a small base.
+ */
+#define HID_MAX_COOKIE 4096
+
+/* an element the device's queue subscribes to, with the ranges its values are scaled from */
+struct TouchLayoutElement {
+    uint32_t cookie;
+    uint32_t type;
+    uint16_t usagePage;
+    uint16_t usage;
+    int32_t logicalMin;
+    int32_t logicalMax;
+    int32_t physicalMin;
+    int32_t physicalMax;
+};
+
+struct TouchLayout {
+    std::vector<struct TouchLayoutElement> elements;
+    /* fields of the input reports, empty if the device has no touch layout */
+    std::vector<HidReport> reports;
+    bool reportIds;
+};
+
+/*
+ * Discovery results of the devices seen so far, in memory and in a file.
+ *
+ * Matching a device means walking its element dictionaries and parsing
+ * its report descriptor. Both only depend on the device model, so once a
+ * model has been seen its elements and report fields are kept here and
+ * a reconnect or restart finds them with one lookup. The file is read on
+ * the first lookup and rewritten whenever a new model is added; a file
+ * that doesn't check out is ignored and replaced, and so is an entry
+ * whose checksum, cookies or field offsets don't.
+ *
+ * Devices may be matched on threads of their own, a lock keeps the
+ * entries consistent.
+ */
+class TouchLayoutCache
+{
+public:
+    TouchLayoutCache();
+
+    /* an empty path keeps the cache in memory only */
+    void setPath(const std::string &path);
+    const std::string &path() const { return _path; }
+
+    bool find(const struct TouchLayoutKey &key, struct TouchLayout *layout);
+    void insert(const struct TouchLayoutKey &key, const struct TouchLayout &layout);
+    void clear();
+
+    size_t size() const { return _entries.size(); }
+
+    /* FNV-1a, what TouchLayoutKey.descriptorHash holds */
+    static uint64_t hash(const uint8_t *data, size_t length);
+
+private:
+    struct Entry {
+        struct TouchLayoutKey key;
+        struct TouchLayout layout;
+    };
+
+    bool load();
+    bool save() const;
+
+    std::mutex _lock;
+    std::string _path;
+    bool _loaded;
+    std::vector<Entry> _entries;
+};
+
+/*
+ * The process wide cache, stored where TOUCH_LAYOUT_CACHE says or in the
+ * user's cache directory. An empty TOUCH_LAYOUT_CACHE keeps it in memory.
+ */
+TouchLayoutCache &touchLayoutCache();
+
+#endif // TOUCH_LAYOUT_CACHE_H
@@ -9,7 +9,18 @@
 #include <IOKit/hidsystem/IOHIDShared.h>
 #include <IOKit/hidsystem/IOHIDParameter.h>
 
+#include <stdlib.h>
+#include <string.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "touch_shared.h"
+#include "touch_backend.h"
+#include "touch_clock.h"
+#include "touch_hid_device.h"
+#include "touch_trace.h"
 
 #define TOUCH_SCREEN 1
 
@@ -18,6 +29,13 @@
 //---------------------------------------------------------------------------
 static IONotificationPortRef	gNotifyPort = NULL;
 static io_iterator_t		gAddedIter = 0;
+static bool			gRawReports = false;
+
+static TouchBackend *		gTouchBackend = NULL;
+static unsigned			gRequestedFields = TOUCH_FIELDS_ALL;
+static bool			gDeviceThreads = false;
+static bool			gQueueFallback = false;
+static TouchDropCounts		gReleasedDrops;		// of devices gone since start()
 
 //---------------------------------------------------------------------------
 // TypeDefs
@@ -30,12 +48,25 @@ typedef enum CalibrationState {
     kCalibrationStateBottomLeft
 } CalibrationState;
 
+class IOKitHidDevice;
+
+/*
+ * Everything one device needs to decode its input. Devices never share
+ * state, so each one can be serviced on a thread of its own.
+ */
 typedef struct HIDData
 {
+    struct HIDData *            next;               // gDeviceList link
+    int                         device;             // TouchFrame.device
+    HidDeviceSession            session;            // elements, queue and decode state
+    IOKitHidDevice *            hidDevice;          // the device as session sees it
+    CFRunLoopRef                runLoop;            // where eventSource is scheduled
+    std::thread *               thread;             // owns runLoop with gDeviceThreads
+    SInt32                      vendorID;
+    SInt32                      productID;
     io_object_t			notification;
     IOHIDDeviceInterface122 ** 	hidDeviceInterface;
     IOHIDQueueInterface **      hidQueueInterface;
-    CFDictionaryRef             hidElementDictionary;
     CFRunLoopSourceRef 		eventSource;
     CalibrationState            state;
     SInt32                      minx;
@@ -47,121 +78,7 @@ typedef struct HIDData
 
 typedef HIDData * 		HIDDataRef;
 
-typedef struct HIDElement {
-    SInt32		currentValue;
-    SInt32		usagePage;
-    SInt32		usage;
-    IOHIDElementType	type;
-    IOHIDElementCookie	cookie;
-    HIDDataRef          owner;
-}HIDElement;
-
-static const char *translateHIDType(IOHIDElementType type) {
-    switch (type) {
-        case 1:
-            return "MISC";
-        case 2:
-            return "Button";
-        case 3:
-            return "Axis";
-        case 4:
-            return "ScanCodes";
-        case 129:
-            return "Output";
-        case 257:
-            return "Feature";
-        case 513:
-            return "Collection";
-
-        default:
-            return "unknown";
-            break;
-    }
-};
-
-static void reportHidElement(HIDElement *element) {
-    if (!element) {
-        return;
-    }
-
-    static int finger_number = 0;
-
-    const char *hidType = translateHIDType(element->type);
-    const char *hidUsage = "unknown";
-    if (element->usagePage == 0xd) {
-        switch (element->usage) {
-            case kHIDUsage_Dig_TouchScreen:
-                hidUsage = "touch screen";
-                break;
-            case 1:
-                hidUsage = "digitizer";
-                break;
-            case 2:
-                hidUsage = "pen";
-                break;
-            case 0x20:
-                hidUsage = "stylus";
-                break;
-            case 0x22:
-                hidUsage = "finger";
-                break;
-            case 0x30:
-                hidUsage = "pressure";
-                break;
-            case 0x32:
-                hidUsage = "in-range";
-                break;
-                //case 0x33:
-            case kHIDUsage_Dig_Touch:
-                hidUsage = "touch";
-                break;
-            case 0x48:
-                hidUsage = "width";
-                break;
-            case 0x49:
-                hidUsage = "height";
-                break;
-            case 0x51:
-                hidUsage = "contact identifier";
-                finger_number = element->currentValue;
-                break;
-            case 0x53:
-                hidUsage = "device index";
-                break;
-            case 0x54:
-                hidUsage = "actual touch count";
-                break;
-            case 0x55:
-                hidUsage = "contact count maximum";
-                break;
-        }
-    }
-#if TOUCH_REPORT
-    printf("usage page %x usage %x type %s %s value 0x%x (%d)\n",
-           element->usagePage, element->usage,
-           hidType,
-           hidUsage,
-           element->currentValue,
-           element->currentValue);
-#endif
-    if (element->usagePage == 1) {
-        float scale_x = 1920 / 32768.0f;
-        float scale_y = 1080 / 32768.0f;
-
-        short value = element->currentValue & 0xffff;
-
-        if (element->usage == kHIDUsage_GD_X) {
-            int x = (int)(value * scale_x);
-            submitTouch((struct TouchEvent){finger_number, x, 0});
-        }
-        else if (element->usage == kHIDUsage_GD_Y) {
-            int y = (int)(value * scale_y);
-            submitTouch((struct TouchEvent){finger_number, 0, y});
-        }
-    }
-}
-
-typedef HIDElement * 		HIDElementRef;
+static HIDDataRef		gDeviceList = NULL;
 
 #ifndef max
 #define max(a, b) \
@@ -176,10 +93,15 @@ typedef HIDElement * 		HIDElementRef;
 //---------------------------------------------------------------------------
 // Methods
 //---------------------------------------------------------------------------
-static void InitHIDNotifications();
+static bool InitHIDNotifications();
+static void ReleaseHIDNotifications();
+static void ReleaseHIDData(HIDDataRef hidDataRef);
+static SInt32 ReadDeviceNumber(io_object_t hidDevice, CFStringRef key);
 static void HIDDeviceAdded(void *refCon, io_iterator_t iterator);
 static void DeviceNotification(void *refCon, io_service_t service, natural_t messageType, void *messageArgument);
-static bool FindHIDElements(HIDDataRef hidDataRef);
+static bool FindHIDElements(HIDDataRef hidDataRef, std::vector<TouchLayoutElement> &elements);
+static void ScheduleHIDData(HIDDataRef hidDataRef);
+static void UnscheduleHIDData(HIDDataRef hidDataRef);
 #ifdef TOUCH_SCREEN
 static bool SetupQueue(HIDDataRef hidDataRef);
 static void QueueCallbackFunction(
@@ -195,9 +117,314 @@ static void InterruptReportCallbackFunction
  void * 			sender,
  uint32_t		 	bufferSize);
 
-void startTouchLoop(void) {
-        InitHIDNotifications();
-        //CFRunLoopRun();
+//---------------------------------------------------------------------------
+// AbsoluteTimeToNs
+//---------------------------------------------------------------------------
+static uint64_t AbsoluteTimeToNs(AbsoluteTime time)
+{
+    UInt64 ticks;
+
+    memcpy(&ticks, &time, sizeof(ticks));
+    return touchMachTimeToNs(ticks);
+}
+
+//---------------------------------------------------------------------------
+// IOKitHidQueue
+//
+// HidQueue on top of an IOHIDQueueInterface, so queue sizing and overflow
+// detection work the same here as against SimulatedHidQueue. The queue
+// interface and its event source stay owned by HIDData.
+//---------------------------------------------------------------------------
+class IOKitHidQueue : public HidQueue
+{
+public:
+    explicit IOKitHidQueue(HIDDataRef hidDataRef) :
+        _hidDataRef(hidDataRef), _queue(hidDataRef->hidQueueInterface), _depth(0),
+        _pendingDepth(0), _resizeSource(NULL) {}
+
+    ~IOKitHidQueue() {
+        if (_resizeSource)
+        {
+            CFRunLoopSourceInvalidate(_resizeSource);
+            CFRelease(_resizeSource);
+        }
+    }
+
+    bool create(int depth) {
+        if ((*_queue)->create(_queue, 0, depth) != kIOReturnSuccess)
+            return false;
+        _depth = depth;
+        return true;
+    }
+
+    /*
+     * The kernel queue can't grow in place, it is made anew with the same
+     * elements. Growing is asked for from the queue's own callout, which
+     * must not dispose the queue it runs for, so the new queue is made by
+     * rebuild() on the next pass of the device's run loop.
+     */
+    bool resize(int depth) {
+        if (!_hidDataRef->runLoop)
+            return false;
+
+        if (!_resizeSource)
+        {
+            CFRunLoopSourceContext context = { 0, this, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &Rebuild };
+            _resizeSource = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &context);
+            if (!_resizeSource)
+                return false;
+            CFRunLoopAddSource(_hidDataRef->runLoop, _resizeSource, kCFRunLoopDefaultMode);
+        }
+
+        if (depth > _pendingDepth)
+            _pendingDepth = depth;
+        CFRunLoopSourceSignal(_resizeSource);
+        return true;
+    }
+
+    int depth() const { return _depth; }
+
+    bool addElement(uint32_t cookie) {
+        if ((*_queue)->addElement(_queue, (IOHIDElementCookie)cookie, 0) != kIOReturnSuccess)
+            return false;
+        _cookies.push_back(cookie);
+        return true;
+    }
+
+    bool start() { return (*_queue)->start(_queue) == kIOReturnSuccess; }
+    void stop() { (*_queue)->stop(_queue); }
+
+    bool dequeue(struct HidQueueEvent *event) {
+        AbsoluteTime        zeroTime = {0,0};
+        IOHIDEventStruct    hidEvent;
+
+        while ((*_queue)->getNextEvent(_queue, &hidEvent, zeroTime, 0) == kIOReturnSuccess)
+        {
+            // Only intersted in 32 values right now
+            if ((hidEvent.longValueSize != 0) && (hidEvent.longValue != NULL))
+            {
+                free(hidEvent.longValue);
+                continue;
+            }
+
+            event->cookie = (UInt32)hidEvent.elementCookie;
+            event->value = hidEvent.value;
+            event->timestamp = AbsoluteTimeToNs(hidEvent.timestamp);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    static void Rebuild(void *info) { ((IOKitHidQueue *)info)->rebuild(); }
+
+    /*
+     * The old event source is only swapped out once the new queue has one,
+     * so a failed rebuild leaves the device scheduled as it was.
+     */
+    void rebuild() {
+        CFRunLoopSourceRef  source = NULL;
+        int                 depth = _pendingDepth;
+
+        _pendingDepth = 0;
+        if (depth <= _depth || _hidDataRef->session.rawReports())
+            return;
+
+        (*_queue)->stop(_queue);
+        (*_queue)->dispose(_queue);
+        if (!create(depth))
+            return;
+        for (size_t i = 0; i < _cookies.size(); i++)
+            (*_queue)->addElement(_queue, (IOHIDElementCookie)_cookies[i], 0);
+
+        if ((*_queue)->createAsyncEventSource(_queue, &source) != kIOReturnSuccess || !source)
+            return;
+        (*_queue)->setEventCallout(_queue, QueueCallbackFunction, NULL, _hidDataRef);
+
+        CFRunLoopRemoveSource(_hidDataRef->runLoop, _hidDataRef->eventSource, kCFRunLoopDefaultMode);
+        _hidDataRef->eventSource = source;
+        CFRunLoopAddSource(_hidDataRef->runLoop, source, kCFRunLoopDefaultMode);
+        start();
+    }
+
+    HIDDataRef                  _hidDataRef;
+    IOHIDQueueInterface **      _queue;
+    int                         _depth;
+    int                         _pendingDepth;      // asked for by resize(), 0 once built
+    CFRunLoopSourceRef          _resizeSource;      // runs rebuild() outside the queue callout
+    std::vector<uint32_t>       _cookies;
+};
+
+//---------------------------------------------------------------------------
+// IOKitHidDevice
+//
+// HidDevice on top of the device interface in HIDData, so element
+// discovery, queueing and decoding are shared with simulated devices.
+// Identity and descriptor are read from the registry entry when the
+// device is matched.
+//---------------------------------------------------------------------------
+class IOKitHidDevice : public HidDevice
+{
+public:
+    IOKitHidDevice(io_object_t hidDevice, HIDDataRef hidDataRef) :
+        _hidDataRef(hidDataRef), _handler(NULL), _context(NULL)
+    {
+        CFTypeRef descriptor = IORegistryEntryCreateCFProperty(hidDevice, CFSTR(kIOHIDReportDescriptorKey), kCFAllocatorDefault, 0);
+
+        _version = ReadDeviceNumber(hidDevice, CFSTR(kIOHIDVersionNumberKey));
+        if (descriptor)
+        {
+            if (CFGetTypeID(descriptor) == CFDataGetTypeID())
+            {
+                const UInt8 *bytes = CFDataGetBytePtr((CFDataRef)descriptor);
+                _descriptor.assign(bytes, bytes + CFDataGetLength((CFDataRef)descriptor));
+            }
+            CFRelease(descriptor);
+        }
+    }
+
+    uint32_t vendorId() const { return _hidDataRef->vendorID; }
+    uint32_t productId() const { return _hidDataRef->productID; }
+    uint32_t version() const { return _version; }
+
+    bool descriptor(std::vector<uint8_t> &descriptor) const {
+        descriptor = _descriptor;
+        return !descriptor.empty();
+    }
+
+    std::vector<TouchLayoutElement> elements() const {
+        std::vector<TouchLayoutElement> elements;
+        FindHIDElements(_hidDataRef, elements);
+        return elements;
+    }
+
+    /* the queue interface stays owned by HIDData, ReleaseHIDData disposes of it */
+    HidQueue *createQueue() {
+        if (!_hidDataRef->hidQueueInterface)
+            _hidDataRef->hidQueueInterface = (*_hidDataRef->hidDeviceInterface)->allocQueue(_hidDataRef->hidDeviceInterface);
+        if (!_hidDataRef->hidQueueInterface)
+            return NULL;
+        return new IOKitHidQueue(_hidDataRef);
+    }
+
+    /*
+     * From the queue callback the queue's run loop source is swapped for
+     * the report source in place; otherwise the report source is
+     * scheduled like a queue's would be.
+     */
+    bool startReports(HidReportHandler handler, void *context) {
+        HIDDataRef          hidDataRef  = _hidDataRef;
+        CFRunLoopSourceRef  source      = NULL;
+        IOReturn            ret;
+
+        ret = (*(hidDataRef->hidDeviceInterface))->createAsyncEventSource(hidDataRef->hidDeviceInterface, &source);
+        if (ret != kIOReturnSuccess || !source)
+            return false;
+
+        _handler = handler;
+        _context = context;
+        ret = (*(hidDataRef->hidDeviceInterface))->setInterruptReportHandlerCallback(hidDataRef->hidDeviceInterface, hidDataRef->buffer, sizeof(hidDataRef->buffer), &InterruptReportCallbackFunction, NULL, hidDataRef);
+        if (ret != kIOReturnSuccess)
+        {
+            CFRelease(source);
+            return false;
+        }
+
+        if (hidDataRef->eventSource && hidDataRef->runLoop)
+        {
+            CFRunLoopRemoveSource(hidDataRef->runLoop, hidDataRef->eventSource, kCFRunLoopDefaultMode);
+            hidDataRef->eventSource = source;
+            CFRunLoopAddSource(hidDataRef->runLoop, source, kCFRunLoopDefaultMode);
+        }
+        else
+        {
+            hidDataRef->eventSource = source;
+            ScheduleHIDData(hidDataRef);
+        }
+        return true;
+    }
+
+    /* hands the report InterruptReportCallbackFunction got in HIDData.buffer on */
+    void report(uint32_t size) {
+        if (_handler)
+            _handler(_hidDataRef->buffer, size, _context);
+    }
+
+private:
+    HIDDataRef                  _hidDataRef;
+    uint32_t                    _version;
+    std::vector<uint8_t>        _descriptor;
+    HidReportHandler            _handler;
+    void *                      _context;
+};
+
+//---------------------------------------------------------------------------
+// OSXTouchBackend
+//
+// IOKit implementation of TouchBackend. Devices are matched and serviced
+// on the run loop of the thread that calls start().
+//---------------------------------------------------------------------------
+class OSXTouchBackend : public TouchBackend
+{
+public:
+    const char *name() const { return "iokit"; }
+    unsigned fields() const { return TOUCH_FIELDS_ALL; }
+
+    bool start() {
+        /* TOUCH_RAW_REPORTS decodes whole input reports instead of dequeuing element values */
+        const char *raw = getenv("TOUCH_RAW_REPORTS");
+        gRawReports = raw && atoi(raw) > 0;
+
+        /* TOUCH_DEVICE_THREADS runs every device on a thread of its own */
+        const char *threads = getenv("TOUCH_DEVICE_THREADS");
+        gDeviceThreads = threads && atoi(threads) > 0;
+        /* TOUCH_QUEUE_FALLBACK reads raw reports from devices whose queue keeps overflowing */
+        const char *fallback = getenv("TOUCH_QUEUE_FALLBACK");
+        gQueueFallback = fallback && atoi(fallback) > 0;
+        memset(&gReleasedDrops, 0, sizeof(gReleasedDrops));
+        gRequestedFields = requestedFields();
+        gTouchBackend = this;
+        return InitHIDNotifications();
+    }
+
+    void stop() {
+        ReleaseHIDNotifications();
+        while (gDeviceList)
+            ReleaseHIDData(gDeviceList);
+        gTouchBackend = NULL;
+    }
+
+    std::vector<TouchDeviceInfo> devices() const {
+        std::vector<TouchDeviceInfo> list;
+        for (HIDDataRef hidDataRef = gDeviceList; hidDataRef; hidDataRef = hidDataRef->next) {
+            TouchDeviceInfo info;
+            info.name = "HID touch screen";
+            info.path = std::to_string(hidDataRef->device);
+            info.vendorId = hidDataRef->vendorID;
+            info.productId = hidDataRef->productID;
+            list.push_back(info);
+        }
+        return list;
+    }
+
+    void drops(struct TouchDropCounts *drops) const {
+        drops->overflows += gReleasedDrops.overflows;
+        drops->lostReports += gReleasedDrops.lostReports;
+        drops->lostElements += gReleasedDrops.lostElements;
+        drops->fallbacks += gReleasedDrops.fallbacks;
+        for (HIDDataRef hidDataRef = gDeviceList; hidDataRef; hidDataRef = hidDataRef->next)
+            hidDataRef->session.drops(drops);
+    }
+
+    static void DeliverFrame(const struct TouchFrame *frame, void *) {
+        if (gTouchBackend)
+            gTouchBackend->deliver(frame, 1);
+    }
+};
+
+TouchBackend *createOSXTouchBackend()
+{
+    return new OSXTouchBackend();
 }
 
 
@@ -208,7 +435,7 @@ void startTouchLoop(void) {
 // and calls the routine that will alert us when a HID Device is plugged in.
 //---------------------------------------------------------------------------
 
-static void InitHIDNotifications()
+static bool InitHIDNotifications()
 {
     CFMutableDictionaryRef 	matchingDict;
     CFNumberRef                 refProdID;
@@ -222,7 +449,7 @@ static void InitHIDNotifications()
     //
     kr = IOMasterPort(bootstrap_port, &masterPort);
     if (kr || !masterPort)
-        return;
+        return false;
 
     // Create a notification port and add its run loop event source to our run loop
     // This is how async notifications get set up.
@@ -239,7 +466,7 @@ static void InitHIDNotifications()
     matchingDict = IOServiceMatching(kIOHIDDeviceKey);
 
     if (!matchingDict)
-        return;
+        return false;
 
     /* Create objects for product and vendor IDs. */
     refProdID = CFNumberCreate (kCFAllocatorDefault, kCFNumberIntType, &productID);
@@ -257,7 +484,7 @@ static void InitHIDNotifications()
     matchingDict = IOServiceMatching("IOHIDDevice");
 
     if (!matchingDict)
-        return;
+        return false;
 
     /* Create objects for product and vendor IDs. */
     refProdID = CFNumberCreate (kCFAllocatorDefault, kCFNumberIntType, &productID);
@@ -287,9 +514,52 @@ static void InitHIDNotifications()
                                           );
 
     if ( kr != kIOReturnSuccess )
-        return;
+        return false;
 
     HIDDeviceAdded( NULL, gAddedIter );
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// ReleaseHIDNotifications
+//
+// Undoes InitHIDNotifications: no further devices will be matched.
+//---------------------------------------------------------------------------
+
+static void ReleaseHIDNotifications()
+{
+    if (gAddedIter)
+    {
+        IOObjectRelease(gAddedIter);
+        gAddedIter = 0;
+    }
+
+    if (gNotifyPort)
+    {
+        CFRunLoopRemoveSource(CFRunLoopGetCurrent(),
+                              IONotificationPortGetRunLoopSource(gNotifyPort),
+                              kCFRunLoopDefaultMode);
+        IONotificationPortDestroy(gNotifyPort);
+        gNotifyPort = NULL;
+    }
+}
+
+//---------------------------------------------------------------------------
+// ReadDeviceNumber
+//---------------------------------------------------------------------------
+
+static SInt32 ReadDeviceNumber(io_object_t hidDevice, CFStringRef key)
+{
+    SInt32      value = 0;
+    CFTypeRef   number = IORegistryEntryCreateCFProperty(hidDevice, key, kCFAllocatorDefault, 0);
+
+    if (number)
+    {
+        if (CFGetTypeID(number) == CFNumberGetTypeID())
+            CFNumberGetValue((CFNumberRef)number, kCFNumberSInt32Type, &value);
+        CFRelease(number);
+    }
+    return value;
 }
 
 //---------------------------------------------------------------------------
@@ -336,11 +606,27 @@ static void HIDDeviceAdded(void *refCon, io_iterator_t iterator)
         if ( ( result == S_OK ) && hidDeviceInterface )
         {
             /* Create a custom object to keep data around for later. */
-            hidDataRef = (HIDData*)malloc(sizeof(HIDData));
-            bzero(hidDataRef, sizeof(HIDData));
-
+            hidDataRef = new HIDData();
             hidDataRef->hidDeviceInterface = hidDeviceInterface;
 
+            /* The lowest device id no other device uses. */
+            for (hidDataRef->device = 0; hidDataRef->device < TOUCH_MAX_DEVICES; hidDataRef->device++)
+            {
+                HIDDataRef other = gDeviceList;
+                while (other && other->device != hidDataRef->device)
+                    other = other->next;
+                if (!other)
+                    break;
+            }
+            if (hidDataRef->device == TOUCH_MAX_DEVICES)
+                goto HIDDEVICEADDED_FAIL;
+
+            hidDataRef->vendorID = ReadDeviceNumber(hidDevice, CFSTR(kIOHIDVendorIDKey));
+            hidDataRef->productID = ReadDeviceNumber(hidDevice, CFSTR(kIOHIDProductIDKey));
+            hidDataRef->hidDevice = new IOKitHidDevice(hidDevice, hidDataRef);
+            hidDataRef->session.setRequestedFields(gRequestedFields);
+            hidDataRef->session.setQueueFallback(gQueueFallback);
+
 #ifdef TOUCH_SCREEN
             /* Open the device interface. */
             result = (*(hidDataRef->hidDeviceInterface))->open (hidDataRef->hidDeviceInterface, kIOHIDOptionsTypeSeizeDevice);
@@ -349,8 +635,17 @@ static void HIDDeviceAdded(void *refCon, io_iterator_t iterator)
                 goto HIDDEVICEADDED_FAIL;
 
             /* Find the HID elements for this device and set up a receive queue. */
-            pass = FindHIDElements(hidDataRef);
-            pass = SetupQueue(hidDataRef);
+            pass = hidDataRef->session.open(hidDataRef->hidDevice, hidDataRef->device, OSXTouchBackend::DeliverFrame, NULL);
+
+            if (pass && gRawReports && hidDataRef->session.hasReportLayout())
+            {
+                /* Decode raw input reports with the compiled layout. */
+                pass = hidDataRef->session.startReports();
+            }
+            else
+            {
+                pass = SetupQueue(hidDataRef);
+            }
 
             printf("Please touch screen to continue.\n\n");
 #else
@@ -387,16 +682,10 @@ static void HIDDeviceAdded(void *refCon, io_iterator_t iterator)
             result = (*(hidDataRef->hidDeviceInterface))->open (hidDataRef->hidDeviceInterface, 0);
 
             /* Find the HID elements for this device */
-            pass = FindHIDElements(hidDataRef);
+            pass = hidDataRef->session.open(hidDataRef->hidDevice, hidDataRef->device, OSXTouchBackend::DeliverFrame, NULL);
 
-            /* Create an asynchronous event source for this device. */
-            result = (*(hidDataRef->hidDeviceInterface))->createAsyncEventSource(hidDataRef->hidDeviceInterface, &hidDataRef->eventSource);
-
-            /* Set the handler to call when the device sends a report. */
-            result = (*(hidDataRef->hidDeviceInterface))->setInterruptReportHandlerCallback(hidDataRef->hidDeviceInterface, hidDataRef->buffer, sizeof(hidDataRef->buffer), &InterruptReportCallbackFunction, NULL, hidDataRef);
-
-            /* Add the asynchronous event source to the run loop. */
-            CFRunLoopAddSource(CFRunLoopGetCurrent(), hidDataRef->eventSource, kCFRunLoopDefaultMode);
+            /* Have the device's reports decoded as they arrive. */
+            pass = hidDataRef->session.startReports();
 
 #endif
 
@@ -410,12 +699,14 @@ static void HIDDeviceAdded(void *refCon, io_iterator_t iterator)
                                              &(hidDataRef->notification)	// notification
                                              );
 
+            hidDataRef->next = gDeviceList;
+            gDeviceList = hidDataRef;
+            TOUCH_TRACE(TraceHotPlug, hidDataRef->device, 1, hidDataRef->vendorID << 16 | (hidDataRef->productID & 0xffff));
+
             goto HIDDEVICEADDED_CLEANUP;
         }
 
-#ifdef TOUCH_SCREEN
     HIDDEVICEADDED_FAIL:
-#endif
         // Failed to allocated a UPS interface.  Do some cleanup
         if ( hidDeviceInterface )
         {
@@ -424,7 +715,9 @@ static void HIDDeviceAdded(void *refCon, io_iterator_t iterator)
         }
 
         if ( hidDataRef )
-            free ( hidDataRef );
+            delete hidDataRef->hidDevice;
+        delete hidDataRef;
+        hidDataRef = NULL;
 
     HIDDEVICEADDED_CLEANUP:
         // Clean up
@@ -447,63 +740,169 @@ static void DeviceNotification(void *		refCon,
                         natural_t 	messageType,
                         void *		messageArgument )
 {
-    kern_return_t	kr;
     HIDDataRef		hidDataRef = (HIDDataRef) refCon;
 
     /* Check to see if a device went away and clean up. */
     if ( (hidDataRef != NULL) &&
         (messageType == kIOMessageServiceIsTerminated) )
     {
-        if (hidDataRef->hidQueueInterface != NULL)
-        {
-            kr = (*(hidDataRef->hidQueueInterface))->stop((hidDataRef->hidQueueInterface));
-            kr = (*(hidDataRef->hidQueueInterface))->dispose((hidDataRef->hidQueueInterface));
-            kr = (*(hidDataRef->hidQueueInterface))->Release (hidDataRef->hidQueueInterface);
-            hidDataRef->hidQueueInterface = NULL;
-        }
+        TOUCH_TRACE(TraceHotPlug, hidDataRef->device, 0, hidDataRef->vendorID << 16 | (hidDataRef->productID & 0xffff));
+        ReleaseHIDData(hidDataRef);
+    }
+}
+
+//---------------------------------------------------------------------------
+// ReleaseHIDData
+//
+// Stops delivery from a device, closes it and frees its private data.
+//---------------------------------------------------------------------------
 
-        if (hidDataRef->hidDeviceInterface != NULL)
+static void ReleaseHIDData(HIDDataRef hidDataRef)
+{
+    HIDDataRef *	link;
+
+    for (link = &gDeviceList; *link; link = &(*link)->next)
+    {
+        if (*link == hidDataRef)
         {
-            kr = (*(hidDataRef->hidDeviceInterface))->close (hidDataRef->hidDeviceInterface);
-            kr = (*(hidDataRef->hidDeviceInterface))->Release (hidDataRef->hidDeviceInterface);
-            hidDataRef->hidDeviceInterface = NULL;
+            *link = hidDataRef->next;
+            break;
         }
+    }
+
+    if (hidDataRef->eventSource != NULL)
+    {
+        UnscheduleHIDData(hidDataRef);
+        hidDataRef->eventSource = NULL;
+    }
+
+    /* the session's queue wraps hidQueueInterface, it goes first */
+    hidDataRef->session.drops(&gReleasedDrops);
+    hidDataRef->session.close();
+    delete hidDataRef->hidDevice;
+    hidDataRef->hidDevice = NULL;
+
+    if (hidDataRef->hidQueueInterface != NULL)
+    {
+        (*(hidDataRef->hidQueueInterface))->stop((hidDataRef->hidQueueInterface));
+        (*(hidDataRef->hidQueueInterface))->dispose((hidDataRef->hidQueueInterface));
+        (*(hidDataRef->hidQueueInterface))->Release (hidDataRef->hidQueueInterface);
+        hidDataRef->hidQueueInterface = NULL;
+    }
+
+    if (hidDataRef->hidDeviceInterface != NULL)
+    {
+        (*(hidDataRef->hidDeviceInterface))->close (hidDataRef->hidDeviceInterface);
+        (*(hidDataRef->hidDeviceInterface))->Release (hidDataRef->hidDeviceInterface);
+        hidDataRef->hidDeviceInterface = NULL;
+    }
+
+    if (hidDataRef->notification)
+    {
+        IOObjectRelease(hidDataRef->notification);
+        hidDataRef->notification = 0;
+    }
+
+    delete hidDataRef;
+}
+
+//---------------------------------------------------------------------------
+// ScheduleHIDData
+//
+// Adds the device's event source to the current run loop or, with
+// gDeviceThreads, to the run loop of a thread started for the device.
+//---------------------------------------------------------------------------
+
+static void ScheduleHIDData(HIDDataRef hidDataRef)
+{
+    if (!gDeviceThreads)
+    {
+        hidDataRef->runLoop = CFRunLoopGetCurrent();
+        CFRunLoopAddSource(hidDataRef->runLoop, hidDataRef->eventSource, kCFRunLoopDefaultMode);
+        return;
+    }
+
+    std::mutex              lock;
+    std::condition_variable started;
+    bool                    ready = false;
 
-        if (hidDataRef->notification)
+    hidDataRef->thread = new std::thread([&] {
+        CFRunLoopRef runLoop = CFRunLoopGetCurrent();
+        CFRunLoopAddSource(runLoop, hidDataRef->eventSource, kCFRunLoopDefaultMode);
         {
-            kr = IOObjectRelease(hidDataRef->notification);
-            hidDataRef->notification = 0;
+            /* notified under the lock, the waiter's stack goes away once it returns */
+            std::lock_guard<std::mutex> guard(lock);
+            hidDataRef->runLoop = runLoop;
+            ready = true;
+            started.notify_one();
         }
 
+        /* returns once stopped or the source is gone */
+        CFRunLoopRun();
+    });
+
+    std::unique_lock<std::mutex> guard(lock);
+    started.wait(guard, [&] { return ready; });
+}
+
+//---------------------------------------------------------------------------
+// UnscheduleHIDData
+//
+// Stops delivery of the device's events; once this returns no callback of
+// the device runs anymore.
+//---------------------------------------------------------------------------
+
+static void UnscheduleHIDData(HIDDataRef hidDataRef)
+{
+    if (hidDataRef->runLoop)
+        CFRunLoopRemoveSource(hidDataRef->runLoop, hidDataRef->eventSource, kCFRunLoopDefaultMode);
+
+    if (hidDataRef->thread)
+    {
+        CFRunLoopStop(hidDataRef->runLoop);
+        hidDataRef->thread->join();
+        delete hidDataRef->thread;
+        hidDataRef->thread = NULL;
     }
+    hidDataRef->runLoop = NULL;
+}
+
+//---------------------------------------------------------------------------
+// ReadElementNumber
+//---------------------------------------------------------------------------
+static void ReadElementNumber(CFDictionaryRef element, CFStringRef key, SInt32 *value)
+{
+    CFNumberRef number = (CFNumberRef)CFDictionaryGetValue(element, key);
+
+    *value = 0;
+    if (number)
+        CFNumberGetValue(number, kCFNumberSInt32Type, value);
 }
 
 //---------------------------------------------------------------------------
 // FindHIDElements
+//
+// Lists every element of the device; HidDeviceSession picks the ones it
+// decodes and remembers them in the layout cache.
 //---------------------------------------------------------------------------
-static bool FindHIDElements(HIDDataRef hidDataRef)
+static bool FindHIDElements(HIDDataRef hidDataRef, std::vector<TouchLayoutElement> &elements)
 {
     CFArrayRef              elementArray	= NULL;
-    CFMutableDictionaryRef  hidElements     = NULL;
-    CFMutableDataRef        newData         = NULL;
     CFNumberRef             number		= NULL;
     CFDictionaryRef         element		= NULL;
-    HIDElement              newElement;
+    SInt32                  usagePage;
+    SInt32                  usage;
+    SInt32                  cookie;
+    SInt32                  type;
+    SInt32                  range[4];
+    TouchLayoutElement      newElement;
     IOReturn                ret		= kIOReturnError;
-    unsigned                i;
+    CFIndex                 i;
 
+    elements.clear();
     if (!hidDataRef)
         return false;
 
-    /* Create a mutable dictionary to hold HID elements. */
-    hidElements = CFDictionaryCreateMutable(
-                                            kCFAllocatorDefault,
-                                            0,
-                                            &kCFTypeDictionaryKeyCallBacks,
-                                            &kCFTypeDictionaryValueCallBacks);
-    if ( !hidElements )
-        return false;
-
     // Let's find the elements
     ret = (*hidDataRef->hidDeviceInterface)->copyMatchingElements(
                                                                   hidDataRef->hidDeviceInterface,
@@ -523,230 +922,96 @@ static bool FindHIDElements(HIDDataRef hidDataRef)
         if ( !element )
             continue;
 
-        bzero(&newElement, sizeof(HIDElement));
-
-        newElement.owner = hidDataRef;
-
         /* Read the element's usage page (top level category describing the type of
          element---kHIDPage_GenericDesktop, for example) */
         number = (CFNumberRef)CFDictionaryGetValue(element, CFSTR(kIOHIDElementUsagePageKey));
         if ( !number ) continue;
-        CFNumberGetValue(number, kCFNumberSInt32Type, &newElement.usagePage );
+        CFNumberGetValue(number, kCFNumberSInt32Type, &usagePage );
 
         /* Read the element's usage (second level category describing the type of
          element---kHIDUsage_GD_Keyboard, for example) */
         number = (CFNumberRef)CFDictionaryGetValue(element, CFSTR(kIOHIDElementUsageKey));
         if ( !number ) continue;
-        CFNumberGetValue(number, kCFNumberSInt32Type, &newElement.usage );
+        CFNumberGetValue(number, kCFNumberSInt32Type, &usage );
 
         /* Read the cookie (unique identifier) for the element */
         number = (CFNumberRef)CFDictionaryGetValue(element, CFSTR(kIOHIDElementCookieKey));
         if ( !number ) continue;
-        CFNumberGetValue(number, kCFNumberIntType, &(newElement.cookie) );
+        CFNumberGetValue(number, kCFNumberSInt32Type, &cookie );
 
         /* Determine what type of element this is---button, Axis, etc. */
         number = (CFNumberRef)CFDictionaryGetValue(element, CFSTR(kIOHIDElementTypeKey));
         if ( !number ) continue;
-        CFNumberGetValue(number, kCFNumberIntType, &(newElement.type) );
-
-        /* Pay attention to X/Y coordinates of a pointing device and
-         the first mouse button.  For other elements, go on to the
-         next element. */
-
-        reportHidElement(&newElement);
-
-        //type d kHIDPage_Digitizer
-        //type 1 gd_x, gd_y
-        //vendor defined ff00
-        if ( newElement.usagePage == kHIDPage_GenericDesktop )
-        {
-            switch ( newElement.usage )
-            {
-                case kHIDUsage_GD_X:
-                case kHIDUsage_GD_Y:
-                    break;
-                default:
-                    continue;
-            }
-        }
-        else if ( newElement.usagePage == kHIDPage_Button )
-        {
-
-            switch ( newElement.usage )
-            {
-                case kHIDUsage_Button_1:
-                    break;
-                default:
-                    continue;
-            }
-        }
-        else if ( newElement.usagePage == kHIDPage_Digitizer )
-        {
-            switch (newElement.usage) {
-                case kHIDUsage_Dig_TouchScreen:
-                    printf("touch screen\n");
-                    break;
-                case kHIDUsage_Dig_Touch:
-                    printf("touch\n");
-                    break;
-                case 0x51:
-                    printf("contact identifier\n");
-                    break;
-                case 0x32:
-                    printf("in-range\n");
-                    break;
-                case 0x55:
-                    printf("contact count maximum\n");
-                    break;
-                case 0x30:
-                    printf("pressure\n");
-                    break;
-                case 0x48:
-                    printf("width\n");
-                    break;
-                case 0x49:
-                    printf("height\n");
-                    break;
-                case 0x53:
-                    printf("device index\n");
-                    break;
-                case 0x54:
-                    printf("actual touch count\n");
-                    break;
-
-                default:
-                    continue;
-            }
-        }
-        else
-            continue;
-
-        /* Add this element to the hidElements dictionary. */
-        newData = CFDataCreateMutable(kCFAllocatorDefault, sizeof(HIDElement));
-        if ( !newData ) continue;
-        bcopy(&newElement, CFDataGetMutableBytePtr(newData), sizeof(HIDElement));
-
-        number = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &newElement.cookie);
-        if ( !number )  continue;
-        CFDictionarySetValue(hidElements, number, newData);
-        CFRelease(number);
-        CFRelease(newData);
+        CFNumberGetValue(number, kCFNumberSInt32Type, &type );
+
+        /* Read the logical and physical range the element's values are scaled from. */
+        ReadElementNumber(element, CFSTR(kIOHIDElementMinKey), &range[0]);
+        ReadElementNumber(element, CFSTR(kIOHIDElementMaxKey), &range[1]);
+        ReadElementNumber(element, CFSTR(kIOHIDElementScaledMinKey), &range[2]);
+        ReadElementNumber(element, CFSTR(kIOHIDElementScaledMaxKey), &range[3]);
+
+        newElement.cookie = (uint32_t)cookie;
+        newElement.type = (uint32_t)type;
+        newElement.usagePage = (uint16_t)usagePage;
+        newElement.usage = (uint16_t)usage;
+        newElement.logicalMin = range[0];
+        newElement.logicalMax = range[1];
+        newElement.physicalMin = range[2];
+        newElement.physicalMax = range[3];
+        elements.push_back(newElement);
     }
 
 FIND_ELEMENT_CLEANUP:
     if ( elementArray ) CFRelease(elementArray);
 
-    if (CFDictionaryGetCount(hidElements) == 0)
-    {
-        CFRelease(hidElements);
-        hidElements = NULL;
-    }
-    else
-    {
-        hidDataRef->hidElementDictionary = hidElements;
-    }
-
-    return hidDataRef->hidElementDictionary;
+    return !elements.empty();
 }
 
 #ifdef TOUCH_SCREEN
 //---------------------------------------------------------------------------
 // SetupQueue
+//
+// Schedules the queue HidDeviceSession subscribed to the device's input
+// elements. The session sizes it for HID_QUEUE_REPORT_RATE and grows it
+// from QueueCallbackFunction when it overflows.
 //---------------------------------------------------------------------------
 static bool SetupQueue(HIDDataRef hidDataRef)
 {
-    CFIndex		count 		= 0;
-    CFIndex		i 		= 0;
-    CFMutableDataRef *	elements	= NULL;
-    CFStringRef *	keys		= NULL;
+    HidQueue *          queue;
     IOReturn		ret;
-    HIDElementRef	tempHIDElement	= NULL;
-    bool		cookieAdded 	= false;
-    bool                boolRet         = true;
-
-    if ( !hidDataRef->hidElementDictionary || (((count = CFDictionaryGetCount(hidDataRef->hidElementDictionary)) <= 0)))
-        return false;
-
-    keys 	= (CFStringRef *)malloc(sizeof(CFStringRef) * count);
-    elements 	= (CFMutableDataRef *)malloc(sizeof(CFMutableDataRef) * count);
-
-    CFDictionaryGetKeysAndValues(hidDataRef->hidElementDictionary, (const void **)keys, (const void **)elements);
-
-    hidDataRef->hidQueueInterface = (*hidDataRef->hidDeviceInterface)->allocQueue(hidDataRef->hidDeviceInterface);
-    if ( !hidDataRef->hidQueueInterface )
-    {
-        boolRet = false;
-        goto SETUP_QUEUE_CLEANUP;
-    }
-
-    ret = (*hidDataRef->hidQueueInterface)->create(hidDataRef->hidQueueInterface, 0, 8);
-    if (ret != kIOReturnSuccess)
-    {
-        boolRet = false;
-        goto SETUP_QUEUE_CLEANUP;
-    }
-
-    for (i=0; i<count; i++)
-    {
-        if ( !elements[i] ||
-            !(tempHIDElement = (HIDElementRef)CFDataGetMutableBytePtr(elements[i])))
-            continue;
-
-        reportHidElement(tempHIDElement);
-
-        if ((tempHIDElement->type < kIOHIDElementTypeInput_Misc) || (tempHIDElement->type > kIOHIDElementTypeInput_ScanCodes))
-            continue;
 
-        ret = (*hidDataRef->hidQueueInterface)->addElement(hidDataRef->hidQueueInterface, tempHIDElement->cookie, 0);
-
-        if (ret == kIOReturnSuccess)
-            cookieAdded = true;
-    }
-
-    if ( cookieAdded )
+    queue = hidDataRef->session.setupQueue();
+    if ( !queue )
     {
-        ret = (*hidDataRef->hidQueueInterface)->createAsyncEventSource(hidDataRef->hidQueueInterface, &hidDataRef->eventSource);
-        if ( ret != kIOReturnSuccess )
-        {
-            boolRet = false;
-            goto SETUP_QUEUE_CLEANUP;
-        }
-
-        ret = (*hidDataRef->hidQueueInterface)->setEventCallout(hidDataRef->hidQueueInterface, QueueCallbackFunction, NULL, hidDataRef);
-        if ( ret != kIOReturnSuccess )
-        {
-            boolRet = false;
-            goto SETUP_QUEUE_CLEANUP;
-        }
-
-        CFRunLoopAddSource(CFRunLoopGetCurrent(), hidDataRef->eventSource, kCFRunLoopDefaultMode);
-
-        ret = (*hidDataRef->hidQueueInterface)->start(hidDataRef->hidQueueInterface);
-        if ( ret != kIOReturnSuccess )
+        /* No input elements, or the queue could not be created. */
+        if ( hidDataRef->hidQueueInterface )
         {
-            boolRet = false;
-            goto SETUP_QUEUE_CLEANUP;
+            (*hidDataRef->hidQueueInterface)->dispose(hidDataRef->hidQueueInterface);
+            (*hidDataRef->hidQueueInterface)->Release(hidDataRef->hidQueueInterface);
+            hidDataRef->hidQueueInterface = NULL;
         }
-    }
-    else
-    {
-        (*hidDataRef->hidQueueInterface)->stop(hidDataRef->hidQueueInterface);
-        (*hidDataRef->hidQueueInterface)->dispose(hidDataRef->hidQueueInterface);
-        (*hidDataRef->hidQueueInterface)->Release(hidDataRef->hidQueueInterface);
-        hidDataRef->hidQueueInterface = NULL;
+        return false;
     }
 
-SETUP_QUEUE_CLEANUP:
+    ret = (*hidDataRef->hidQueueInterface)->createAsyncEventSource(hidDataRef->hidQueueInterface, &hidDataRef->eventSource);
+    if ( ret != kIOReturnSuccess )
+        return false;
 
-    free(keys);
-    free(elements);
+    ret = (*hidDataRef->hidQueueInterface)->setEventCallout(hidDataRef->hidQueueInterface, QueueCallbackFunction, NULL, hidDataRef);
+    if ( ret != kIOReturnSuccess )
+        return false;
 
-    return boolRet;
-}
+    ScheduleHIDData(hidDataRef);
 
+    return queue->start();
+}
 
 //---------------------------------------------------------------------------
 // QueueCallbackFunction
+//
+// Has the device's session drain the queue. When the drain shows it
+// overflowed the session makes it deeper or, once that no longer helps,
+// gives up on it for raw reports.
 //---------------------------------------------------------------------------
 static void QueueCallbackFunction(
                            void * 			target,
@@ -755,49 +1020,12 @@ static void QueueCallbackFunction(
                            void * 			sender)
 {
     HIDDataRef          hidDataRef      = (HIDDataRef)refcon;
-    AbsoluteTime 	zeroTime 	= {0,0};
-    CFNumberRef		number		= NULL;
-    CFMutableDataRef	element		= NULL;
-    HIDElementRef	tempHIDElement  = NULL;//(HIDElementRef)refcon;
-    IOHIDEventStruct 	event;
-    bool                change;
-
-    if ( !hidDataRef || ( sender != hidDataRef->hidQueueInterface))
-        return;
-
-    while (result == kIOReturnSuccess)
-    {
-        result = (*hidDataRef->hidQueueInterface)->getNextEvent(
-                                                                hidDataRef->hidQueueInterface,
-                                                                &event,
-                                                                zeroTime,
-                                                                0);
-
-        if ( result != kIOReturnSuccess )
-            continue;
 
-        // Only intersted in 32 values right now
-        if ((event.longValueSize != 0) && (event.longValue != NULL))
-        {
-            free(event.longValue);
-            continue;
-        }
-
-        number = CFNumberCreate(kCFAllocatorDefault, kCFNumberIntType, &event.elementCookie);
-        if ( !number )  continue;
-        element = (CFMutableDataRef)CFDictionaryGetValue(hidDataRef->hidElementDictionary, number);
-        CFRelease(number);
-
-        if ( !element ||
-            !(tempHIDElement = (HIDElement *)CFDataGetMutableBytePtr(element)))
-            continue;
-
-        change = (tempHIDElement->currentValue != event.value);
-        tempHIDElement->currentValue = event.value;
-
-        reportHidElement(tempHIDElement);
-    }
+    if ( !hidDataRef || ( sender != hidDataRef->hidQueueInterface) )
+        return;
 
+    TOUCH_TRACE_SCOPE(TraceStageDeviceCallback);
+    hidDataRef->session.serviceQueue(touchMonotonicNs());
 }
 #endif
 
@@ -813,16 +1041,10 @@ static void InterruptReportCallbackFunction
  uint32_t		 	bufferSize)
 {
     HIDDataRef hidDataRef = (HIDDataRef)refcon;
-    int index;
 
-    if ( !hidDataRef )
+    if ( !hidDataRef || !hidDataRef->hidDevice )
         return;
 
-    printf("Buffer = ");
-
-    for ( index=0; index<bufferSize; index++)
-        printf("%2.2x ", hidDataRef->buffer[index]);
-
-    printf("\n");
-
+    TOUCH_TRACE_SCOPE(TraceStageDeviceCallback);
+    hidDataRef->hidDevice->report(bufferSize);
 }
@@ -0,0 +1,80 @@
+#ifndef TOUCH_RING_H
+#define TOUCH_RING_H
+
+#include <atomic>
+#include <stddef.h>
+
+/*
+ * Bounded single-producer/single-consumer ring.
+ *
+ * The input side calls push() and the GUI side drains the ring once per
+ * frame. Neither side ever blocks or takes a lock: when the ring is full
+ * the new element is dropped and accounted in overflowCount().
+ */
+template <typename T, size_t Capacity>
+class TouchRing
+{
+    static_assert(Capacity && !(Capacity & (Capacity - 1)),
+                  "TouchRing capacity must be a power of two");
+
+public:
+    TouchRing() : _head(0), _tail(0), _overflow(0) {}
+
+    /* producer side */
+    bool push(const T &value) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) >= Capacity) {
+            _overflow.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        _items[head & (Capacity - 1)] = value;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* consumer side */
+    bool pop(T &value) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire))
+            return false;
+        value = _items[tail & (Capacity - 1)];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Hands every element that was available at the time of the call to fn
+     * and releases them to the producer in one step. Returns the count.
+     */
+    template <typename F>
+    size_t drain(F fn) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        size_t head = _head.load(std::memory_order_acquire);
+        for (size_t i = tail; i != head; i++)
+            fn(_items[i & (Capacity - 1)]);
+        _tail.store(head, std::memory_order_release);
+        return head - tail;
+    }
+
+    size_t size() const {
+        return _head.load(std::memory_order_acquire)
+                - _tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return Capacity; }
+
+    unsigned long overflowCount() const {
+        return _overflow.load(std::memory_order_relaxed);
+    }
+
+private:
+    TouchRing(const TouchRing &);
+    TouchRing &operator=(const TouchRing &);
+
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+    alignas(64) std::atomic<unsigned long> _overflow;
+    T _items[Capacity];
+};
+
+#endif // TOUCH_RING_H
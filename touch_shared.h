@@ -1,6 +1,9 @@
 #ifndef TOUCH_SHARED_H
 #define TOUCH_SHARED_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -8,16 +11,112 @@ extern "C" {
 #define TOUCH_PID 0x524
 #define TOUCH_VID 0x596
 
-#define TOUCH_REPORT 0
+#define TOUCH_MAX_CONTACTS 10
+
+/* digitizers one process tells apart, device ids run from 0 to this - 1 */
+#define TOUCH_MAX_DEVICES 8
+#define TOUCH_SCREEN_WIDTH 1920
+#define TOUCH_SCREEN_HEIGHT 1080
+
+/* bumped whenever TouchFrame or the entry points below change */
+#define TOUCH_API_VERSION 4
 
+/* TouchContact.flags */
+#define TOUCH_CONTACT_TIP       0x1
+#define TOUCH_CONTACT_IN_RANGE  0x2
+
+/* TouchFrame.fields and TouchCapabilities.fields */
+#define TOUCH_FIELD_POSITION        0x01
+#define TOUCH_FIELD_TIP             0x02
+#define TOUCH_FIELD_IN_RANGE        0x04
+#define TOUCH_FIELD_CONTACT_ID      0x08
+#define TOUCH_FIELD_CONTACT_COUNT   0x10
+#define TOUCH_FIELD_DEVICE_TIME     0x20
+#define TOUCH_FIELD_HOST_TIME       0x40
+#define TOUCH_FIELDS_ALL            0x7f
+
+/*
+ * Timestamps are monotonic nanoseconds in the touchMonotonicNs() time base.
+ * deviceTime is when the device produced the report (the host receive time
+ * if the backend has nothing better), hostTime is when the backend read it.
+ */
 struct TouchEvent {
     int idx;
     int x;
     int y;
+    unsigned flags;     /* TOUCH_CONTACT_*, a sample without TIP ends the stroke */
+    uint64_t deviceTime;
+    uint64_t hostTime;
+    int device;         /* TouchFrame.device of the frame the sample came from */
+};
+
+struct TouchContact {
+    int id;             /* HID contact identifier (digitizer usage 0x51) */
+    int x;
+    int y;
+    unsigned flags;
 };
 
+/* all contacts delivered by one input report */
+struct TouchFrame {
+    int count;          /* valid entries in contacts[] */
+    int contactCount;   /* touch count reported by the device, 0 if none */
+    unsigned fields;    /* TOUCH_FIELD_* the producer filled in */
+    int device;         /* digitizer the frame came from, contact ids are per device */
+    uint64_t deviceTime;
+    uint64_t hostTime;
+    struct TouchContact contacts[TOUCH_MAX_CONTACTS];
+};
+
+/* what a producer delivers, or what a consumer asked for */
+struct TouchCapabilities {
+    unsigned version;   /* TOUCH_API_VERSION */
+    unsigned fields;    /* TOUCH_FIELD_* */
+    int maxContacts;
+};
+
+/* input lost between the devices and the backend, summed over all devices */
+struct TouchDropCounts {
+    unsigned long overflows;    /* times a device or kernel queue was found full */
+    unsigned long lostReports;  /* reports estimated lost to overflows */
+    unsigned long lostElements; /* values missing from reports cut short */
+    unsigned long fallbacks;    /* devices switched to reading raw reports */
+};
+
+/*
+ * Implemented by the consumer. Frames arrive in batches, one call per
+ * batch the backend read, from the acquisition thread. submitTouch() is
+ * the single-sample entry point of version 1, kept as a shim around
+ * submitTouchFrame().
+ */
+extern void submitTouchFrame(const struct TouchFrame *frames, size_t count);
 extern void submitTouch(struct TouchEvent ev);
+
+/* fields the consumer needs, call before startTouchLoop(), all by default */
+extern void requestTouchFields(unsigned fields);
+
+/* what the running backend delivers of the requested fields, 0 if none runs */
+extern int queryTouchCapabilities(struct TouchCapabilities *caps);
+
+/* what the running backend lost so far, 0 if none runs */
+extern int queryTouchDrops(struct TouchDropCounts *drops);
+
 extern void startTouchLoop(void);
+extern void stopTouchLoop(void);
+
+/* nonzero when no backend runs or the running one has nothing left to deliver */
+extern int touchLoopFinished(void);
+
+/* replay a capture file instead of opening a device, call before startTouchLoop() */
+extern void selectTouchReplay(const char *path, double speed);
+
+/* record every frame the backend delivers, returns 0 on failure */
+extern int startTouchCapture(const char *path);
+extern void stopTouchCapture(void);
+
+/* publish every frame to local readers through the shm object name, returns 0 on failure */
+extern int startTouchBroadcast(const char *name);
+extern void stopTouchBroadcast(void);
 
 #ifdef __cplusplus
 }
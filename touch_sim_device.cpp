@@ -0,0 +1,575 @@
+#include "touch_sim_device.h"
+#include "touch_clock.h"
+#include "touch_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+/* longest nap while unplugged, so stop() doesn't wait out a long down time */
+#define SIM_DOWN_STEP_MS 10
+
+static bool ReadFile(const char *path, std::vector<uint8_t> &data)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    uint8_t chunk[4096];
+    size_t n;
+    data.clear();
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        data.insert(data.end(), chunk, chunk + n);
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+static bool lessPoint(const struct SimMotionPoint &a, const struct SimMotionPoint &b)
+{
+    return a.contact != b.contact ? a.contact < b.contact : a.ms < b.ms;
+}
+
+SimMotionScript::SimMotionScript() :
+    _duration(0)
+{
+}
+
+bool SimMotionScript::load(const char *path)
+{
+    std::vector<uint8_t> data;
+    if (!ReadFile(path, data))
+        return false;
+    return parse(std::string(data.begin(), data.end()));
+}
+
+bool SimMotionScript::parse(const std::string &text)
+{
+    _points.clear();
+    _duration = 0;
+
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos)
+            end = text.size();
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+
+        size_t hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        struct SimMotionPoint point;
+        char word[8];
+        memset(&point, 0, sizeof(point));
+        if (sscanf(line.c_str(), "%u %d %f %f", &point.ms, &point.contact, &point.x, &point.y) == 4) {
+            point.x = std::min(std::max(point.x, 0.0f), 1.0f);
+            point.y = std::min(std::max(point.y, 0.0f), 1.0f);
+        }
+        else if (sscanf(line.c_str(), "%u %d %7s", &point.ms, &point.contact, word) == 3
+                 && !strcmp(word, "up")) {
+            point.up = true;
+        }
+        else {
+            _points.clear();
+            return false;
+        }
+        if (point.contact < 0 || point.contact >= TOUCH_MAX_CONTACTS) {
+            _points.clear();
+            return false;
+        }
+
+        _points.push_back(point);
+        _duration = std::max(_duration, point.ms);
+    }
+
+    std::stable_sort(_points.begin(), _points.end(), lessPoint);
+    if (!_duration)
+        _duration = 1;
+    return !_points.empty();
+}
+
+void SimMotionScript::frameAt(uint64_t t, struct TouchFrame *frame) const
+{
+    uint32_t ms = (uint32_t)(t / 1000000 % _duration);
+
+    memset(frame, 0, sizeof(*frame));
+    for (size_t i = 0; i < _points.size(); ) {
+        /* the points of one contact, and the last one not after ms */
+        size_t at = _points.size();
+        int contact = _points[i].contact;
+        for (; i < _points.size() && _points[i].contact == contact; i++) {
+            if (_points[i].ms <= ms)
+                at = i;
+        }
+        if (at == _points.size() || _points[at].up)
+            continue;
+
+        float x = _points[at].x, y = _points[at].y;
+        if (at + 1 < i && !_points[at + 1].up && _points[at + 1].ms > _points[at].ms) {
+            const struct SimMotionPoint &next = _points[at + 1];
+            float f = (float)(ms - _points[at].ms) / (next.ms - _points[at].ms);
+            x += (next.x - x) * f;
+            y += (next.y - y) * f;
+        }
+
+        struct TouchContact *c = &frame->contacts[frame->count++];
+        c->id = contact;
+        c->x = (int)(x * TOUCH_SYNTH_LOGICAL_MAX);
+        c->y = (int)(y * TOUCH_SYNTH_LOGICAL_MAX);
+        c->flags = TOUCH_CONTACT_TIP | TOUCH_CONTACT_IN_RANGE;
+    }
+    frame->contactCount = frame->count;
+}
+
+SimDeviceConfig::SimDeviceConfig() :
+    vendorId(TOUCH_VID),
+    productId(TOUCH_PID),
+    version(1),
+    contacts(2),
+    rate(SIM_DEFAULT_RATE),
+    upMs(0),
+    downMs(0),
+    serviceMs(SIM_DEFAULT_SERVICE_MS),
+    rawReports(false),
+    queueFallback(false)
+{
+}
+
+static inline bool isPosition(const HidField &field)
+{
+    return field.usagePage == HID_PAGE_GENERIC_DESKTOP
+            && (field.usage == HID_USAGE_GD_X || field.usage == HID_USAGE_GD_Y);
+}
+
+/* writes the low size bits of value at bit offset of report, least significant first */
+static void PutBits(uint8_t *report, uint32_t offset, uint32_t size, uint32_t value)
+{
+    for (uint32_t done = 0; done < size; ) {
+        uint32_t bit = (offset + done) & 7;
+        uint32_t n = std::min(8 - bit, size - done);
+        uint8_t mask = (uint8_t)(((1u << n) - 1) << bit);
+        uint8_t *byte = &report[(offset + done) >> 3];
+        *byte = (uint8_t)((*byte & ~mask) | (((value >> done) << bit) & mask));
+        done += n;
+    }
+}
+
+/*
+ * Cookies are handed out in descriptor order from 1. Contact slots are
+ * the collections holding an X field, in the order they come.
+ */
+SimulatedHidDevice::SimulatedHidDevice(const SimDeviceConfig &config) :
+    _config(config),
+    _synth(config.contacts),
+    _report(0),
+    _slotCount(0),
+    _queue(0),
+    _handler(0),
+    _context(0)
+{
+    if (_config.descriptor.empty())
+        _config.descriptor = _synth.descriptor();
+    memset(&_last, 0, sizeof(_last));
+
+    if (!_layout.parse(_config.descriptor.data(), _config.descriptor.size()))
+        return;
+
+    const std::vector<HidReport> &reports = _layout.reports();
+    for (size_t r = 0; r < reports.size() && !_report; r++) {
+        for (size_t i = 0; i < reports[r].fields.size(); i++) {
+            if (reports[r].fields[i].usagePage == HID_PAGE_GENERIC_DESKTOP
+                    && reports[r].fields[i].usage == HID_USAGE_GD_X)
+                _report = &reports[r];
+        }
+    }
+    if (!_report)
+        return;
+
+    std::vector<uint16_t> collections;
+    for (size_t i = 0; i < _report->fields.size(); i++) {
+        const HidField &field = _report->fields[i];
+        if (field.usagePage == HID_PAGE_GENERIC_DESKTOP && field.usage == HID_USAGE_GD_X
+                && std::find(collections.begin(), collections.end(), field.collection) == collections.end())
+            collections.push_back(field.collection);
+    }
+    _slotCount = (int)collections.size();
+
+    uint32_t cookie = 1;
+    for (size_t r = 0; r < reports.size(); r++) {
+        for (size_t i = 0; i < reports[r].fields.size(); i++) {
+            const HidField &field = reports[r].fields[i];
+            bool constant = field.flags & HidFieldConstant;
+            if (!constant) {
+                struct TouchLayoutElement element;
+                element.cookie = cookie;
+                element.type = isPosition(field) ? HidElementInputAxis
+                        : field.bitSize == 1 ? HidElementInputButton : HidElementInputMisc;
+                element.usagePage = field.usagePage;
+                element.usage = field.usage;
+                element.logicalMin = field.logicalMin;
+                element.logicalMax = field.logicalMax;
+                element.physicalMin = field.physicalMin;
+                element.physicalMax = field.physicalMax;
+                _elements.push_back(element);
+            }
+            if (&reports[r] == _report) {
+                std::vector<uint16_t>::iterator slot =
+                        std::find(collections.begin(), collections.end(), field.collection);
+                _cookies.push_back(constant ? 0 : cookie);
+                _slots.push_back(slot == collections.end() ? -1 : (int)(slot - collections.begin()));
+            }
+            if (!constant)
+                cookie++;
+        }
+    }
+}
+
+bool SimulatedHidDevice::descriptor(std::vector<uint8_t> &descriptor) const
+{
+    descriptor = _config.descriptor;
+    return !descriptor.empty();
+}
+
+std::vector<struct TouchLayoutElement> SimulatedHidDevice::elements() const
+{
+    return _elements;
+}
+
+HidQueue *SimulatedHidDevice::createQueue()
+{
+    _queue = new SimulatedHidQueue();
+    return _queue;
+}
+
+bool SimulatedHidDevice::startReports(HidReportHandler handler, void *context)
+{
+    _handler = handler;
+    _context = context;
+    return true;
+}
+
+void SimulatedHidDevice::stopReports()
+{
+    _handler = 0;
+    _context = 0;
+}
+
+/* the script or the synth's circles, plus one report of contacts that lifted since the last */
+void SimulatedHidDevice::frameAt(uint64_t t, struct TouchFrame *frame)
+{
+    if (!_config.script.isEmpty())
+        _config.script.frameAt(t, frame);
+    else
+        _synth.frameAt(t, frame);
+
+    for (int i = 0; i < _last.count && frame->count < TOUCH_MAX_CONTACTS; i++) {
+        bool down = false;
+        for (int j = 0; j < frame->count && !down; j++)
+            down = frame->contacts[j].id == _last.contacts[i].id;
+        if (!down && (_last.contacts[i].flags & TOUCH_CONTACT_TIP)) {
+            frame->contacts[frame->count] = _last.contacts[i];
+            frame->contacts[frame->count++].flags = 0;
+        }
+    }
+    frame->contactCount = frame->count;
+    _last = *frame;
+}
+
+int32_t SimulatedHidDevice::fieldValue(const HidField &field, const struct TouchFrame &frame, int slot) const
+{
+    const struct TouchContact *contact = slot >= 0 && slot < frame.count ? &frame.contacts[slot] : 0;
+    int64_t range = (int64_t)field.logicalMax - field.logicalMin;
+
+    if (field.usagePage == HID_PAGE_DIGITIZER) {
+        switch (field.usage) {
+        case HID_USAGE_DIG_CONTACT_ID:
+            return contact ? contact->id : 0;
+        case HID_USAGE_DIG_TOUCH:
+        case HID_USAGE_DIG_TIP_SWITCH:
+            return contact && (contact->flags & TOUCH_CONTACT_TIP);
+        case HID_USAGE_DIG_IN_RANGE:
+            return contact && (contact->flags & TOUCH_CONTACT_IN_RANGE);
+        case HID_USAGE_DIG_CONTACT_COUNT:
+            return frame.count;
+        }
+    }
+    else if (isPosition(field)) {
+        int value = !contact ? 0 : field.usage == HID_USAGE_GD_X ? contact->x : contact->y;
+        return (int32_t)(field.logicalMin + value * range / TOUCH_SYNTH_LOGICAL_MAX);
+    }
+    return field.logicalMin;
+}
+
+void SimulatedHidDevice::generate(uint64_t t, SimulatedHidQueue *queue)
+{
+    if (!_report)
+        return;
+
+    struct TouchFrame frame;
+    frameAt(t, &frame);
+    if (frame.count > _slotCount)
+        frame.count = _slotCount;
+
+    const std::vector<HidField> &fields = _report->fields;
+    if (_handler) {
+        size_t offset = _layout.usesReportIds() ? 1 : 0;
+        _buffer.assign(offset + (_report->bitLength + 7) / 8, 0);
+        if (offset)
+            _buffer[0] = _report->id;
+        for (size_t i = 0; i < fields.size(); i++) {
+            if (_cookies[i])
+                PutBits(&_buffer[offset], fields[i].bitOffset, fields[i].bitSize,
+                        (uint32_t)fieldValue(fields[i], frame, _slots[i]));
+        }
+        _handler(_buffer.data(), _buffer.size(), _context);
+        return;
+    }
+
+    /* every value of the contacts present, in report order and with the report's time */
+    if (!queue)
+        return;
+    _events.clear();
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (!_cookies[i] || _slots[i] >= frame.count)
+            continue;
+        struct HidQueueEvent event;
+        event.cookie = _cookies[i];
+        event.value = fieldValue(fields[i], frame, _slots[i]);
+        event.timestamp = t;
+        _events.push_back(event);
+    }
+    queue->enqueueReport(_events.data(), _events.size());
+}
+
+SimulatedTouchBackend::SimulatedTouchBackend(const SimDeviceConfig &config, int devices, double seconds) :
+    _config(config),
+    _seconds(seconds),
+    _startTime(0),
+    _running(false)
+{
+    for (int i = 0; i < devices && i < TOUCH_MAX_DEVICES; i++) {
+        Device *device = new Device();
+        device->device = new SimulatedHidDevice(config);
+        device->plugged = false;
+        device->reports = 0;
+        device->plugs = 0;
+        _devices.push_back(device);
+    }
+}
+
+SimulatedTouchBackend::~SimulatedTouchBackend()
+{
+    stop();
+    for (size_t i = 0; i < _devices.size(); i++) {
+        delete _devices[i]->device;
+        delete _devices[i];
+    }
+}
+
+bool SimulatedTouchBackend::start()
+{
+    if (_running || _devices.empty() || !_devices[0]->device->isValid())
+        return false;
+
+    _startTime = touchMonotonicNs();
+    _running = true;
+    for (size_t i = 0; i < _devices.size(); i++)
+        _devices[i]->thread = std::thread(&SimulatedTouchBackend::run, this, (int)i);
+    return true;
+}
+
+void SimulatedTouchBackend::stop()
+{
+    _running = false;
+    for (size_t i = 0; i < _devices.size(); i++) {
+        if (_devices[i]->thread.joinable())
+            _devices[i]->thread.join();
+    }
+}
+
+void SimulatedTouchBackend::DeliverFrame(const struct TouchFrame *frame, void *context)
+{
+    ((SimulatedTouchBackend *)context)->deliver(frame, 1);
+}
+
+/*
+ * Reports due while the thread slept are all generated when it wakes,
+ * each with its own time, the way a device keeps reporting while the
+ * host is late. That is what fills the queue when service is slow.
+ */
+void SimulatedTouchBackend::run(int id)
+{
+    Device *d = _devices[id];
+    SimulatedHidDevice *device = d->device;
+    uint64_t interval = 1000000000ull / std::max(_config.rate, 1);
+    uint64_t serviceInterval = (uint64_t)std::max(_config.serviceMs, 0) * 1000000ull;
+    uint32_t model = _config.vendorId << 16 | (_config.productId & 0xffff);
+
+    while (_running) {
+        d->session.setRequestedFields(requestedFields());
+        d->session.setQueueFallback(_config.queueFallback);
+        d->session.open(device, id, DeliverFrame, this);
+
+        SimulatedHidQueue *queue = 0;
+        if (_config.rawReports && d->session.hasReportLayout()) {
+            d->session.startReports();
+        }
+        else {
+            /* the device made the session's queue, so it knows it by its type */
+            HidQueue *created = d->session.setupQueue();
+            if (created && created == device->queue()) {
+                queue = device->queue();
+                queue->start();
+            }
+        }
+        d->plugged = true;
+        d->plugs++;
+        TOUCH_TRACE(TraceHotPlug, id, 1, model);
+
+        uint64_t now = touchMonotonicNs();
+        uint64_t unplug = _config.upMs > 0 ? now + _config.upMs * 1000000ull : UINT64_MAX;
+        uint64_t next = now;
+        uint64_t service = now + serviceInterval;
+        while (_running && now < unplug) {
+            for (; next <= now; next += interval) {
+                device->generate(next, queue);
+                d->reports++;
+            }
+            if (queue && now >= service) {
+                d->session.serviceQueue(now);
+                service = now + serviceInterval;
+            }
+
+            uint64_t wake = queue && !d->session.rawReports() ? std::min(next, service) : next;
+            now = touchMonotonicNs();
+            if (wake > now)
+                std::this_thread::sleep_for(std::chrono::nanoseconds(wake - now));
+            now = touchMonotonicNs();
+        }
+
+        /* what is still queued arrived before the device went away */
+        if (queue)
+            d->session.serviceQueue(touchMonotonicNs());
+        d->plugged = false;
+        TOUCH_TRACE(TraceHotPlug, id, 0, model);
+        device->stopReports();
+        d->session.close();
+
+        for (int ms = 0; _running && ms < _config.downMs; ms += SIM_DOWN_STEP_MS)
+            std::this_thread::sleep_for(std::chrono::milliseconds(
+                    std::min(SIM_DOWN_STEP_MS, _config.downMs - ms)));
+    }
+}
+
+std::vector<TouchDeviceInfo> SimulatedTouchBackend::devices() const
+{
+    std::vector<TouchDeviceInfo> list;
+    for (size_t i = 0; i < _devices.size(); i++) {
+        if (!_devices[i]->plugged)
+            continue;
+        TouchDeviceInfo info;
+        info.name = "Simulated HID touch screen";
+        info.path = "sim:" + std::to_string(i);
+        info.vendorId = _config.vendorId;
+        info.productId = _config.productId;
+        list.push_back(info);
+    }
+    return list;
+}
+
+bool SimulatedTouchBackend::finished() const
+{
+    return _seconds > 0 && _running && touchMonotonicNs() - _startTime >= _seconds * 1e9;
+}
+
+void SimulatedTouchBackend::drops(struct TouchDropCounts *drops) const
+{
+    for (size_t i = 0; i < _devices.size(); i++)
+        _devices[i]->session.drops(drops);
+}
+
+unsigned long SimulatedTouchBackend::reports() const
+{
+    unsigned long reports = 0;
+    for (size_t i = 0; i < _devices.size(); i++)
+        reports += _devices[i]->reports;
+    return reports;
+}
+
+unsigned long SimulatedTouchBackend::plugs() const
+{
+    unsigned long plugs = 0;
+    for (size_t i = 0; i < _devices.size(); i++)
+        plugs += _devices[i]->plugs;
+    return plugs;
+}
+
+TouchBackend *createSimulatedTouchBackend(const char *spec)
+{
+    SimDeviceConfig config;
+    int devices = 1;
+    double seconds = 0;
+
+    std::string rest = spec ? spec : "";
+    while (!rest.empty()) {
+        size_t comma = rest.find(',');
+        std::string item = rest.substr(0, comma);
+        rest.erase(0, comma == std::string::npos ? rest.size() : comma + 1);
+        if (item.empty())
+            continue;
+
+        size_t equals = item.find('=');
+        if (equals == std::string::npos)
+            return 0;
+        std::string key = item.substr(0, equals);
+        const char *value = item.c_str() + equals + 1;
+
+        if (key == "devices")
+            devices = atoi(value);
+        else if (key == "contacts")
+            config.contacts = atoi(value);
+        else if (key == "rate")
+            config.rate = atoi(value);
+        else if (key == "vid")
+            config.vendorId = (uint32_t)strtoul(value, 0, 0);
+        else if (key == "pid")
+            config.productId = (uint32_t)strtoul(value, 0, 0);
+        else if (key == "version")
+            config.version = (uint32_t)strtoul(value, 0, 0);
+        else if (key == "descriptor") {
+            if (!ReadFile(value, config.descriptor) || config.descriptor.empty())
+                return 0;
+        }
+        else if (key == "script") {
+            if (!config.script.load(value))
+                return 0;
+        }
+        else if (key == "up")
+            config.upMs = atoi(value);
+        else if (key == "down")
+            config.downMs = atoi(value);
+        else if (key == "service")
+            config.serviceMs = atoi(value);
+        else if (key == "raw")
+            config.rawReports = atoi(value) > 0;
+        else if (key == "fallback")
+            config.queueFallback = atoi(value) > 0;
+        else if (key == "seconds")
+            seconds = atof(value);
+        else
+            return 0;
+    }
+
+    if (devices < 1 || devices > TOUCH_MAX_DEVICES || config.rate < 1 || config.serviceMs < 0)
+        return 0;
+    if (!SimulatedHidDevice(config).isValid())
+        return 0;
+    return new SimulatedTouchBackend(config, devices, seconds);
+}
@@ -0,0 +1,196 @@
+#ifndef TOUCH_SIM_DEVICE_H
+#define TOUCH_SIM_DEVICE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "touch_backend.h"
+#include "touch_hid_device.h"
+#include "touch_synth.h"
+
+#define SIM_DEFAULT_RATE 1000
+#define SIM_DEFAULT_SERVICE_MS 1
+
+/* one line of a motion script */
+struct SimMotionPoint {
+    uint32_t ms;
+    int contact;
+    bool up;
+    float x;                    /* fractions of the surface */
+    float y;
+};
+
+/*
+ * Contact motion over time, read from lines of the form
+ *
+ *   ms contact x y             contact is down at x, y at ms
+ *   ms contact up              contact lifts at ms
+ *
+ * with x and y as fractions of the surface and # starting a comment.
+ * Positions are interpolated between the points of a contact and the
+ * script starts over after its last point.
+ */
+class SimMotionScript
+{
+public:
+    SimMotionScript();
+
+    bool load(const char *path);
+    bool parse(const std::string &text);
+
+    bool isEmpty() const { return _points.empty(); }
+    uint32_t duration() const { return _duration; }
+
+    /* contacts down at time t, in TOUCH_SYNTH_LOGICAL_MAX units */
+    void frameAt(uint64_t t, struct TouchFrame *frame) const;
+
+private:
+    std::vector<struct SimMotionPoint> _points;    /* by contact, then time */
+    uint32_t _duration;
+};
+
+struct SimDeviceConfig {
+    SimDeviceConfig();
+
+    uint32_t vendorId;
+    uint32_t productId;
+    uint32_t version;
+    /* a TouchSynth descriptor for contacts when empty */
+    std::vector<uint8_t> descriptor;
+    int contacts;
+    int rate;                   /* reports per second */
+    int upMs;                   /* plugged in this long, then gone downMs; 0 stays */
+    int downMs;
+    int serviceMs;              /* between queue drains */
+    bool rawReports;            /* start on raw reports instead of the queue */
+    bool queueFallback;         /* switch to raw reports when the queue keeps overflowing */
+    SimMotionScript script;     /* TouchSynth circles when empty */
+};
+
+/*
+ * A HID device that lives in memory.
+ *
+ * Its elements are the input fields of its report descriptor, one cookie
+ * per field, so element discovery, the layout cache, the queue and the
+ * report decoder meet it the way they meet hardware. generate() produces
+ * the report of a point in time and hands its values to the queue or the
+ * whole report to the raw report handler, whichever the session chose.
+ */
+class SimulatedHidDevice : public HidDevice
+{
+public:
+    explicit SimulatedHidDevice(const SimDeviceConfig &config);
+
+    uint32_t vendorId() const { return _config.vendorId; }
+    uint32_t productId() const { return _config.productId; }
+    uint32_t version() const { return _config.version; }
+    bool descriptor(std::vector<uint8_t> &descriptor) const;
+    std::vector<struct TouchLayoutElement> elements() const;
+
+    HidQueue *createQueue();
+    /* the queue createQueue() handed out last, owned by the session that asked for it */
+    SimulatedHidQueue *queue() const { return _queue; }
+    bool startReports(HidReportHandler handler, void *context);
+    /* back to the queue, as a fresh plug-in would be */
+    void stopReports();
+
+    const SimDeviceConfig &config() const { return _config; }
+    /* false if the descriptor has no report with X and Y */
+    bool isValid() const { return _report != 0; }
+
+    /* the report of time t, into queue unless raw reports were started */
+    void generate(uint64_t t, SimulatedHidQueue *queue);
+
+private:
+    void frameAt(uint64_t t, struct TouchFrame *frame);
+    int32_t fieldValue(const HidField &field, const struct TouchFrame &frame, int slot) const;
+
+    SimDeviceConfig _config;
+    TouchSynth _synth;
+    HidReportLayout _layout;
+    const HidReport *_report;           /* the touch report generate() produces */
+    std::vector<uint32_t> _cookies;     /* per field of _report, 0 for constants */
+    std::vector<int> _slots;            /* per field of _report, -1 outside contacts */
+    int _slotCount;
+    std::vector<struct TouchLayoutElement> _elements;
+
+    SimulatedHidQueue *_queue;
+    HidReportHandler _handler;
+    void *_context;
+
+    std::vector<uint8_t> _buffer;
+    std::vector<struct HidQueueEvent> _events;
+    struct TouchFrame _last;            /* to report lifted contacts once */
+};
+
+/*
+ * Simulated devices as a backend, for load tests without hardware.
+ *
+ * Every device gets a thread that generates reports at its rate, drains
+ * the queue every serviceMs and, with upMs set, unplugs and replugs the
+ * device, going through the same HidDeviceSession open and close as an
+ * IOKit device coming and going.
+ */
+class SimulatedTouchBackend : public TouchBackend
+{
+public:
+    SimulatedTouchBackend(const SimDeviceConfig &config, int devices, double seconds = 0);
+    ~SimulatedTouchBackend();
+
+    const char *name() const { return "simulated"; }
+    unsigned fields() const { return TOUCH_FIELDS_ALL; }
+    bool start();
+    void stop();
+    std::vector<TouchDeviceInfo> devices() const;
+    bool finished() const;
+    void drops(struct TouchDropCounts *drops) const;
+
+    /* reports generated and plug-ins so far, over all devices */
+    unsigned long reports() const;
+    unsigned long plugs() const;
+
+private:
+    struct Device {
+        SimulatedHidDevice *device;
+        HidDeviceSession session;
+        std::thread thread;
+        std::atomic<bool> plugged;
+        std::atomic<unsigned long> reports;
+        std::atomic<unsigned long> plugs;
+    };
+
+    void run(int id);
+    static void DeliverFrame(const struct TouchFrame *frame, void *context);
+
+    SimDeviceConfig _config;
+    std::vector<Device *> _devices;
+    double _seconds;
+    uint64_t _startTime;
+    std::atomic<bool> _running;
+};
+
+/*
+ * Parses a spec like "devices=4,rate=8000,up=2000,down=200":
+ *
+ *   devices    number of devices, up to TOUCH_MAX_DEVICES (1)
+ *   contacts   contacts of the synthetic descriptor (2)
+ *   rate       reports per second (1000)
+ *   vid, pid, version
+ *   descriptor file with a report descriptor to use instead
+ *   script     file with a motion script
+ *   up, down   milliseconds plugged in and unplugged, no hot-plug if up is 0
+ *   service    milliseconds between queue drains (1)
+ *   raw        1 for raw reports instead of the queue
+ *   fallback   1 to give up on a queue that keeps overflowing for raw reports
+ *   seconds    finish after this long, 0 runs until stopped
+ *
+ * Returns 0 if the spec doesn't make sense.
+ */
+TouchBackend *createSimulatedTouchBackend(const char *spec);
+
+#endif // TOUCH_SIM_DEVICE_H
@@ -0,0 +1,173 @@
+#include "touch_stream.h"
+#include "touch_clock.h"
+
+#include <string.h>
+
+#include <chrono>
+
+#define STREAM_BUFFER_SIZE (256 * 1024)
+
+/* the writer also looks for frames this often, should a wakeup go missing */
+#define STREAM_POLL_MS 2
+
+TouchStreamWriter::TouchStreamWriter() :
+    _file(0),
+    _ownsFile(false),
+    _format(TouchStreamBinary),
+    _policy(TouchStreamDrop),
+    _sleeping(false),
+    _running(false),
+    _written(0),
+    _waits(0),
+    _failed(false)
+{
+}
+
+TouchStreamWriter::~TouchStreamWriter()
+{
+    close();
+}
+
+bool TouchStreamWriter::open(const char *path, TouchStreamFormat format, TouchStreamPolicy policy)
+{
+    close();
+
+    if (!strcmp(path, "-")) {
+        _file = stdout;
+        _ownsFile = false;
+    }
+    else {
+        _file = fopen(path, "wb");
+        if (!_file)
+            return false;
+        _ownsFile = true;
+    }
+    setvbuf(_file, 0, _IOFBF, STREAM_BUFFER_SIZE);
+
+    _format = format;
+    _policy = policy;
+    _written = 0;
+    _waits = 0;
+    _failed = false;
+
+    if (_format == TouchStreamBinary && !_capture.open(_file)) {
+        close();
+        return false;
+    }
+
+    _running = true;
+    _thread = std::thread(&TouchStreamWriter::run, this);
+    return true;
+}
+
+void TouchStreamWriter::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _running = false;
+    }
+    _wake.notify_all();
+    _space.notify_all();
+    if (_thread.joinable())
+        _thread.join();
+
+    if (!_file)
+        return;
+
+    if (_capture.isOpen())
+        _capture.close();
+    if (_ownsFile)
+        fclose(_file);
+    else
+        fflush(_file);
+    _file = 0;
+}
+
+void TouchStreamWriter::submit(const struct TouchFrame *frames, size_t count)
+{
+    if (!_file)
+        return;
+
+    /* the ring takes one producer, devices may deliver from several threads */
+    std::lock_guard<std::mutex> producer(_producerLock);
+
+    for (size_t i = 0; i < count; i++) {
+        if (_policy == TouchStreamBlock && _ring.size() >= _ring.capacity()) {
+            std::unique_lock<std::mutex> lock(_lock);
+            _waits++;
+            _space.wait(lock, [this] {
+                return _ring.size() < _ring.capacity() || !_running || _failed;
+            });
+        }
+        _ring.push(frames[i]);
+    }
+
+    if (_sleeping.load()) {
+        std::lock_guard<std::mutex> lock(_lock);
+        _wake.notify_one();
+    }
+}
+
+bool TouchStreamWriter::writeNdjson(const struct TouchFrame &frame)
+{
+    fprintf(_file, "{\"d\":%d,", frame.device);
+    if (frame.fields & TOUCH_FIELD_HOST_TIME)
+        fprintf(_file, "\"t\":%llu,", (unsigned long long)frame.hostTime);
+    if (frame.fields & TOUCH_FIELD_DEVICE_TIME)
+        fprintf(_file, "\"dt\":%llu,", (unsigned long long)frame.deviceTime);
+    if (frame.fields & TOUCH_FIELD_CONTACT_COUNT)
+        fprintf(_file, "\"cc\":%d,", frame.contactCount);
+    fprintf(_file, "\"n\":%d,\"c\":[", frame.count);
+
+    int count = frame.count < TOUCH_MAX_CONTACTS ? frame.count : TOUCH_MAX_CONTACTS;
+    for (int i = 0; i < count; i++) {
+        const struct TouchContact *contact = &frame.contacts[i];
+        fprintf(_file, "%s{\"id\":%d,\"x\":%d,\"y\":%d,\"f\":%u}", i ? "," : "",
+                contact->id, contact->x, contact->y, contact->flags);
+    }
+    return fprintf(_file, "]}\n") > 0;
+}
+
+void TouchStreamWriter::run()
+{
+    for (;;) {
+        size_t count = _ring.drain([this](const struct TouchFrame &frame) {
+            if (_failed)
+                return;
+
+            bool ok;
+            if (_format == TouchStreamBinary) {
+                /* records stay on the host clock, device clocks differ per device */
+                uint64_t stamp = frame.hostTime ? frame.hostTime : touchMonotonicNs();
+                ok = _capture.write(&frame, stamp);
+            }
+            else {
+                ok = writeNdjson(frame);
+            }
+            if (!ok || ferror(_file))
+                _failed = true;
+            else
+                _written++;
+        });
+
+        if (count) {
+            if (_policy == TouchStreamBlock) {
+                std::lock_guard<std::mutex> lock(_lock);
+                _space.notify_all();
+            }
+            continue;
+        }
+
+        /* caught up, hand the consumer what we have */
+        if (!_failed && fflush(_file))
+            _failed = true;
+
+        std::unique_lock<std::mutex> lock(_lock);
+        if (!_running && !_ring.size())
+            break;
+        _sleeping = true;
+        if (!_ring.size())
+            _wake.wait_for(lock, std::chrono::milliseconds(STREAM_POLL_MS));
+        _sleeping = false;
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef TOUCH_STREAM_H
+#define TOUCH_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "touch_capture.h"
+#include "touch_ring.h"
+#include "touch_shared.h"
+
+/* frames buffered between the backend and the output */
+#define STREAM_RING_FRAMES 4096
+
+enum TouchStreamFormat {
+    TouchStreamBinary,      /* the capture file layout, replayable with --replay */
+    TouchStreamNdjson       /* one JSON object per frame and line */
+};
+
+enum TouchStreamPolicy {
+    TouchStreamDrop,        /* drop frames while the output lags behind */
+    TouchStreamBlock        /* hold up the backend until there is room */
+};
+
+/*
+ * Writes decoded frames to a file or stdout from a thread of its own.
+ *
+ * submit() runs on the backend thread and only copies frames into a ring;
+ * formatting and writing happen on the writer thread, so a slow pipe
+ * never stalls acquisition unless the block policy asks for it. With the
+ * drop policy frames that find the ring full are counted and lost.
+ */
+class TouchStreamWriter
+{
+public:
+    TouchStreamWriter();
+    ~TouchStreamWriter();
+
+    /* "-" writes to stdout */
+    bool open(const char *path, TouchStreamFormat format, TouchStreamPolicy policy);
+    /* writes out what is still buffered and closes the output */
+    void close();
+    bool isOpen() const { return _file != 0; }
+
+    void submit(const struct TouchFrame *frames, size_t count);
+
+    unsigned long written() const { return _written; }
+    unsigned long dropped() const { return _ring.overflowCount(); }
+    unsigned long waits() const { return _waits; }
+    /* the output failed, e.g. the reading end of a pipe went away */
+    bool failed() const { return _failed; }
+
+private:
+    void run();
+    bool writeNdjson(const struct TouchFrame &frame);
+
+    FILE *_file;
+    bool _ownsFile;
+    TouchStreamFormat _format;
+    TouchStreamPolicy _policy;
+    TouchCaptureWriter _capture;
+
+    TouchRing<struct TouchFrame, STREAM_RING_FRAMES> _ring;
+    std::thread _thread;
+    std::mutex _producerLock;
+    std::mutex _lock;
+    std::condition_variable _wake;      /* frames arrived, for the writer */
+    std::condition_variable _space;     /* frames went out, for submit() */
+    std::atomic<bool> _sleeping;
+    bool _running;
+
+    std::atomic<unsigned long> _written;
+    std::atomic<unsigned long> _waits;
+    std::atomic<bool> _failed;
+};
+
+#endif // TOUCH_STREAM_H
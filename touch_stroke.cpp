@@ -0,0 +1,376 @@
+#include "touch_stroke.h"
+
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define STROKE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define STROKE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define STROKE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * Per-row constants of a segment. Coverage of a pixel whose center is
+ * (wx, wy) away from the segment start is
+ *
+ *     t = clamp((wx * dx + wy * dy) / |d|^2, 0, 1)
+ *     coverage = clamp(r0 + t * dr - |w - t * d|, 0, 1)
+ *
+ * where r0 already includes the half pixel of anti-aliasing.
+ */
+struct SpanParams {
+    float wy;
+    float wyDy;
+    float dx;
+    float dy;
+    float invLen2;
+    float r0;
+    float dr;
+    uint32_t color;
+};
+
+typedef void (*SpanKernel)(uint32_t *row, int count, float wx, const SpanParams &p);
+
+static inline uint32_t BlendPixel(uint32_t dst, uint32_t src, unsigned a)
+{
+    uint32_t rb = (((dst & 0xff00ff) * (256 - a) + (src & 0xff00ff) * a) >> 8) & 0xff00ff;
+    uint32_t ag = (((dst >> 8) & 0xff00ff) * (256 - a) + ((src >> 8) & 0xff00ff) * a) & 0xff00ff00;
+    return rb | ag;
+}
+
+static void SpanScalar(uint32_t *row, int count, float wx, const SpanParams &p)
+{
+    for (int i = 0; i < count; i++, wx += 1.0f) {
+        float t = (wx * p.dx + p.wyDy) * p.invLen2;
+        t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+        float qx = wx - t * p.dx;
+        float qy = p.wy - t * p.dy;
+        float cover = p.r0 + t * p.dr - sqrtf(qx * qx + qy * qy);
+        if (cover <= 0.0f)
+            continue;
+        unsigned a = cover >= 1.0f ? 256 : (unsigned)(cover * 256.0f + 0.5f);
+        row[i] = BlendPixel(row[i], p.color, a);
+    }
+}
+
+#ifdef STROKE_SSE2
+static void SpanSSE2(uint32_t *row, int count, float wx, const SpanParams &p)
+{
+    const __m128 dx = _mm_set1_ps(p.dx);
+    const __m128 dy = _mm_set1_ps(p.dy);
+    const __m128 wy = _mm_set1_ps(p.wy);
+    const __m128 wyDy = _mm_set1_ps(p.wyDy);
+    const __m128 invLen2 = _mm_set1_ps(p.invLen2);
+    const __m128 r0 = _mm_set1_ps(p.r0);
+    const __m128 dr = _mm_set1_ps(p.dr);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(256.0f);
+    const __m128 step = _mm_set1_ps(4.0f);
+    const __m128i zeroi = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(256);
+    const __m128i src = _mm_unpacklo_epi8(_mm_set1_epi32((int)p.color), zeroi);
+
+    __m128 x = _mm_add_ps(_mm_set1_ps(wx), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+    int i = 0;
+    for (; i + 4 <= count; i += 4, x = _mm_add_ps(x, step)) {
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(x, dx), wyDy), invLen2);
+        t = _mm_min_ps(_mm_max_ps(t, zero), one);
+        __m128 qx = _mm_sub_ps(x, _mm_mul_ps(t, dx));
+        __m128 qy = _mm_sub_ps(wy, _mm_mul_ps(t, dy));
+        __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)));
+        __m128 cover = _mm_sub_ps(_mm_add_ps(r0, _mm_mul_ps(t, dr)), dist);
+        cover = _mm_min_ps(_mm_max_ps(cover, zero), one);
+
+        __m128i a = _mm_cvtps_epi32(_mm_mul_ps(cover, scale));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, zeroi)) == 0xffff)
+            continue;
+
+        /* spread each pixel's alpha over its four channels */
+        __m128i a16 = _mm_packs_epi32(a, a);
+        a16 = _mm_unpacklo_epi16(a16, a16);
+        __m128i aLo = _mm_unpacklo_epi32(a16, a16);
+        __m128i aHi = _mm_unpackhi_epi32(a16, a16);
+
+        __m128i dst = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i lo = _mm_unpacklo_epi8(dst, zeroi);
+        __m128i hi = _mm_unpackhi_epi8(dst, zeroi);
+        lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, _mm_sub_epi16(full, aLo)),
+                                          _mm_mullo_epi16(src, aLo)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, _mm_sub_epi16(full, aHi)),
+                                          _mm_mullo_epi16(src, aHi)), 8);
+        _mm_storeu_si128((__m128i *)(row + i), _mm_packus_epi16(lo, hi));
+    }
+    SpanScalar(row + i, count - i, wx + i, p);
+}
+#endif
+
+#ifdef STROKE_AVX2
+__attribute__((target("avx2")))
+static void SpanAVX2(uint32_t *row, int count, float wx, const SpanParams &p)
+{
+    const __m256 dx = _mm256_set1_ps(p.dx);
+    const __m256 dy = _mm256_set1_ps(p.dy);
+    const __m256 wy = _mm256_set1_ps(p.wy);
+    const __m256 wyDy = _mm256_set1_ps(p.wyDy);
+    const __m256 invLen2 = _mm256_set1_ps(p.invLen2);
+    const __m256 r0 = _mm256_set1_ps(p.r0);
+    const __m256 dr = _mm256_set1_ps(p.dr);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 scale = _mm256_set1_ps(256.0f);
+    const __m256 step = _mm256_set1_ps(8.0f);
+    const __m256i zeroi = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi16(256);
+    const __m256i src = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)p.color), zeroi);
+
+    __m256 x = _mm256_add_ps(_mm256_set1_ps(wx),
+                             _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+    int i = 0;
+    for (; i + 8 <= count; i += 8, x = _mm256_add_ps(x, step)) {
+        __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(x, dx), wyDy), invLen2);
+        t = _mm256_min_ps(_mm256_max_ps(t, zero), one);
+        __m256 qx = _mm256_sub_ps(x, _mm256_mul_ps(t, dx));
+        __m256 qy = _mm256_sub_ps(wy, _mm256_mul_ps(t, dy));
+        __m256 dist = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(qx, qx), _mm256_mul_ps(qy, qy)));
+        __m256 cover = _mm256_sub_ps(_mm256_add_ps(r0, _mm256_mul_ps(t, dr)), dist);
+        cover = _mm256_min_ps(_mm256_max_ps(cover, zero), one);
+
+        __m256i a = _mm256_cvtps_epi32(_mm256_mul_ps(cover, scale));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, zeroi)) == -1)
+            continue;
+
+        /* unpacks work per 128-bit lane, which keeps pixels and alphas paired */
+        __m256i a16 = _mm256_packs_epi32(a, a);
+        a16 = _mm256_unpacklo_epi16(a16, a16);
+        __m256i aLo = _mm256_unpacklo_epi32(a16, a16);
+        __m256i aHi = _mm256_unpackhi_epi32(a16, a16);
+
+        __m256i dst = _mm256_loadu_si256((const __m256i *)(row + i));
+        __m256i lo = _mm256_unpacklo_epi8(dst, zeroi);
+        __m256i hi = _mm256_unpackhi_epi8(dst, zeroi);
+        lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(lo, _mm256_sub_epi16(full, aLo)),
+                                                _mm256_mullo_epi16(src, aLo)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(hi, _mm256_sub_epi16(full, aHi)),
+                                                _mm256_mullo_epi16(src, aHi)), 8);
+        _mm256_storeu_si256((__m256i *)(row + i), _mm256_packus_epi16(lo, hi));
+    }
+    SpanScalar(row + i, count - i, wx + i, p);
+}
+#endif
+
+#ifdef STROKE_NEON
+static void SpanNEON(uint32_t *row, int count, float wx, const SpanParams &p)
+{
+    const float32x4_t dx = vdupq_n_f32(p.dx);
+    const float32x4_t dy = vdupq_n_f32(p.dy);
+    const float32x4_t wy = vdupq_n_f32(p.wy);
+    const float32x4_t wyDy = vdupq_n_f32(p.wyDy);
+    const float32x4_t invLen2 = vdupq_n_f32(p.invLen2);
+    const float32x4_t r0 = vdupq_n_f32(p.r0);
+    const float32x4_t dr = vdupq_n_f32(p.dr);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t step = vdupq_n_f32(4.0f);
+    const uint16x8_t full = vdupq_n_u16(256);
+    const uint16x8_t src = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(p.color)));
+    const float offsets[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+
+    float32x4_t x = vaddq_f32(vdupq_n_f32(wx), vld1q_f32(offsets));
+    int i = 0;
+    for (; i + 4 <= count; i += 4, x = vaddq_f32(x, step)) {
+        float32x4_t t = vmulq_f32(vmlaq_f32(wyDy, x, dx), invLen2);
+        t = vminq_f32(vmaxq_f32(t, zero), one);
+        float32x4_t qx = vmlsq_f32(x, t, dx);
+        float32x4_t qy = vmlsq_f32(wy, t, dy);
+        float32x4_t d2 = vmlaq_f32(vmulq_f32(qx, qx), qy, qy);
+        /* sqrt via reciprocal estimate, d2 is clamped so 0 stays 0 */
+        float32x4_t rs = vrsqrteq_f32(vmaxq_f32(d2, vdupq_n_f32(1e-12f)));
+        rs = vmulq_f32(rs, vrsqrtsq_f32(vmulq_f32(d2, rs), rs));
+        float32x4_t dist = vmulq_f32(d2, rs);
+        float32x4_t cover = vsubq_f32(vmlaq_f32(r0, t, dr), dist);
+        cover = vminq_f32(vmaxq_f32(cover, zero), one);
+
+        uint32x4_t a = vcvtq_u32_f32(vmlaq_n_f32(vdupq_n_f32(0.5f), cover, 256.0f));
+        if (!(vgetq_lane_u32(a, 0) | vgetq_lane_u32(a, 1) | vgetq_lane_u32(a, 2) | vgetq_lane_u32(a, 3)))
+            continue;
+
+        /* spread each pixel's alpha over its four channels */
+        uint16x4_t a16 = vmovn_u32(a);
+        uint16x4x2_t pairs = vzip_u16(a16, a16);
+        uint16x4x2_t lo4 = vzip_u16(pairs.val[0], pairs.val[0]);
+        uint16x4x2_t hi4 = vzip_u16(pairs.val[1], pairs.val[1]);
+        uint16x8_t aLo = vcombine_u16(lo4.val[0], lo4.val[1]);
+        uint16x8_t aHi = vcombine_u16(hi4.val[0], hi4.val[1]);
+
+        uint8x16_t dst = vreinterpretq_u8_u32(vld1q_u32(row + i));
+        uint16x8_t lo = vmulq_u16(vmovl_u8(vget_low_u8(dst)), vsubq_u16(full, aLo));
+        uint16x8_t hi = vmulq_u16(vmovl_u8(vget_high_u8(dst)), vsubq_u16(full, aHi));
+        lo = vshrq_n_u16(vmlaq_u16(lo, src, aLo), 8);
+        hi = vshrq_n_u16(vmlaq_u16(hi, src, aHi), 8);
+        vst1q_u32(row + i, vreinterpretq_u32_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi))));
+    }
+    SpanScalar(row + i, count - i, wx + i, p);
+}
+#endif
+
+static SpanKernel SelectKernel(const char **name)
+{
+#ifdef STROKE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return SpanAVX2;
+    }
+#endif
+#if defined(STROKE_SSE2)
+    *name = "sse2";
+    return SpanSSE2;
+#elif defined(STROKE_NEON)
+    *name = "neon";
+    return SpanNEON;
+#else
+    *name = "scalar";
+    return SpanScalar;
+#endif
+}
+
+static const char *gKernelName = "scalar";
+static const SpanKernel gSpan = SelectKernel(&gKernelName);
+
+const char *strokeKernelName()
+{
+    return gKernelName;
+}
+
+void strokeSegment(const struct StrokeTarget &target, const struct StrokeSegment &s)
+{
+    float dx = s.x1 - s.x0;
+    float dy = s.y1 - s.y0;
+    float len2 = dx * dx + dy * dy;
+    float reach = (s.w0 > s.w1 ? s.w0 : s.w1) * 0.5f + 1.0f;
+
+    SpanParams p;
+    p.dx = dx;
+    p.dy = dy;
+    p.invLen2 = len2 > 1e-6f ? 1.0f / len2 : 0.0f;
+    p.r0 = s.w0 * 0.5f + 0.5f;
+    p.dr = (s.w1 - s.w0) * 0.5f;
+    p.color = s.color | 0xff000000;
+
+    int top = (int)floorf((s.y0 < s.y1 ? s.y0 : s.y1) - reach) - target.originY;
+    int bottom = (int)ceilf((s.y0 > s.y1 ? s.y0 : s.y1) + reach) - target.originY;
+    if (top < 0)
+        top = 0;
+    if (bottom > target.height)
+        bottom = target.height;
+
+    for (int y = top; y < bottom; y++) {
+        float py = y + target.originY + 0.5f;
+
+        /* the part of the segment within reach of this row bounds the span */
+        float ta = 0.0f, tb = 1.0f;
+        if (fabsf(dy) > 1e-6f) {
+            ta = (py - reach - s.y0) / dy;
+            tb = (py + reach - s.y0) / dy;
+            if (ta > tb) {
+                float swap = ta;
+                ta = tb;
+                tb = swap;
+            }
+            if (tb < 0.0f || ta > 1.0f)
+                continue;
+            ta = ta < 0.0f ? 0.0f : ta;
+            tb = tb > 1.0f ? 1.0f : tb;
+        }
+        else if (fabsf(py - s.y0) > reach) {
+            continue;
+        }
+
+        float xa = s.x0 + ta * dx;
+        float xb = s.x0 + tb * dx;
+        if (xa > xb) {
+            float swap = xa;
+            xa = xb;
+            xb = swap;
+        }
+        int left = (int)floorf(xa - reach) - target.originX;
+        int right = (int)ceilf(xb + reach) - target.originX;
+        if (left < 0)
+            left = 0;
+        if (right > target.width)
+            right = target.width;
+        if (left >= right)
+            continue;
+
+        p.wy = py - s.y0;
+        p.wyDy = p.wy * dy;
+        uint32_t *line = (uint32_t *)((uint8_t *)target.bits + target.bytesPerLine * y);
+        gSpan(line + left, right - left, left + target.originX + 0.5f - s.x0, p);
+    }
+}
+
+void strokeSegments(const struct StrokeTarget &target, const struct StrokeSegment *segments, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        strokeSegment(target, segments[i]);
+}
+
+StrokeBuilder::StrokeBuilder()
+{
+    reset();
+}
+
+void StrokeBuilder::reset()
+{
+    _count = 0;
+}
+
+bool StrokeBuilder::add(const struct TouchEvent &ev, float width, struct StrokeSegment *segment)
+{
+    int k;
+    for (k = 0; k < _count; k++) {
+        if (_pens[k].id == ev.idx && _pens[k].device == ev.device)
+            break;
+    }
+
+    if (!(ev.flags & TOUCH_CONTACT_TIP)) {
+        if (k < _count)
+            _pens[k] = _pens[--_count];
+        return false;
+    }
+
+    float x = (float)ev.x;
+    float y = (float)ev.y;
+    if (k == _count) {
+        if (_count == TOUCH_MAX_CONTACTS)
+            return false;
+        _count++;
+        _pens[k].device = ev.device;
+        _pens[k].id = ev.idx;
+        _pens[k].x = x;
+        _pens[k].y = y;
+        _pens[k].width = width;
+    }
+
+    struct Pen *pen = &_pens[k];
+    segment->x0 = pen->x;
+    segment->y0 = pen->y;
+    segment->x1 = x;
+    segment->y1 = y;
+    segment->w0 = pen->width;
+    segment->w1 = width;
+    segment->color = 0;
+
+    pen->x = x;
+    pen->y = y;
+    pen->width = width;
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef TOUCH_STROKE_H
+#define TOUCH_STROKE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "touch_shared.h"
+
+/* one piece of a contact trail, widths are full widths in pixels */
+struct StrokeSegment {
+    float x0, y0;
+    float x1, y1;
+    float w0, w1;
+    uint32_t color;     /* 0xRRGGBB, drawn opaque */
+};
+
+/*
+ * A Format_RGB32 pixel buffer, or a window of one. Segments are given in
+ * canvas coordinates; origin is where bits[0] sits on the canvas, so a
+ * tile can be a target of its own.
+ */
+struct StrokeTarget {
+    uint32_t *bits;
+    size_t bytesPerLine;
+    int width;
+    int height;
+    int originX;
+    int originY;
+};
+
+/*
+ * Draws an anti-aliased segment with round caps whose width changes
+ * linearly from w0 to w1. Rows are walked in spans and handed to the
+ * widest span kernel the CPU supports (AVX2, SSE2 or NEON, scalar
+ * otherwise).
+ */
+void strokeSegment(const struct StrokeTarget &target, const struct StrokeSegment &segment);
+void strokeSegments(const struct StrokeTarget &target, const struct StrokeSegment *segments, size_t count);
+
+/* name of the span kernel in use */
+const char *strokeKernelName();
+
+/*
+ * Turns the sample stream of each contact into connected segments. A
+ * contact that lifts ends its stroke; the first sample of a stroke
+ * yields a dot so taps stay visible.
+ */
+class StrokeBuilder
+{
+public:
+    StrokeBuilder();
+
+    void reset();
+    bool add(const struct TouchEvent &ev, float width, struct StrokeSegment *segment);
+
+private:
+    struct Pen {
+        int device;
+        int id;
+        float x;
+        float y;
+        float width;
+    };
+
+    struct Pen _pens[TOUCH_MAX_CONTACTS];
+    int _count;
+};
+
+#endif // TOUCH_STROKE_H
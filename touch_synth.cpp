@@ -0,0 +1,116 @@
+#include "touch_synth.h"
+
+#include <math.h>
+#include <string.h>
+
+/* bytes per contact: tip/in-range bits, contact id, X, Y */
+#define SYNTH_CONTACT_SIZE 6
+
+static const uint8_t SynthHeader[] = {
+    0x05, 0x0d,                 /* Usage Page (Digitizer) */
+    0x09, 0x04,                 /* Usage (Touch Screen) */
+    0xa1, 0x01,                 /* Collection (Application) */
+    0x85, TOUCH_SYNTH_REPORT_ID,/*   Report ID */
+};
+
+static const uint8_t SynthContact[] = {
+    0x05, 0x0d,                 /* Usage Page (Digitizer) */
+    0x09, 0x22,                 /* Usage (Finger) */
+    0xa1, 0x02,                 /* Collection (Logical) */
+    0x09, 0x42,                 /*   Usage (Tip Switch) */
+    0x09, 0x32,                 /*   Usage (In Range) */
+    0x15, 0x00,                 /*   Logical Minimum (0) */
+    0x25, 0x01,                 /*   Logical Maximum (1) */
+    0x75, 0x01,                 /*   Report Size (1) */
+    0x95, 0x02,                 /*   Report Count (2) */
+    0x81, 0x02,                 /*   Input (Data, Var, Abs) */
+    0x95, 0x06,                 /*   Report Count (6) */
+    0x81, 0x03,                 /*   Input (Const) */
+    0x09, 0x51,                 /*   Usage (Contact Identifier) */
+    0x26, 0xff, 0x00,           /*   Logical Maximum (255) */
+    0x75, 0x08,                 /*   Report Size (8) */
+    0x95, 0x01,                 /*   Report Count (1) */
+    0x81, 0x02,                 /*   Input (Data, Var, Abs) */
+    0x05, 0x01,                 /*   Usage Page (Generic Desktop) */
+    0x26, 0xff, 0x7f,           /*   Logical Maximum (32767) */
+    0x75, 0x10,                 /*   Report Size (16) */
+    0x09, 0x30,                 /*   Usage (X) */
+    0x09, 0x31,                 /*   Usage (Y) */
+    0x95, 0x02,                 /*   Report Count (2) */
+    0x81, 0x02,                 /*   Input (Data, Var, Abs) */
+    0xc0,                       /* End Collection */
+};
+
+static const uint8_t SynthTrailer[] = {
+    0x05, 0x0d,                 /* Usage Page (Digitizer) */
+    0x09, 0x54,                 /* Usage (Contact Count) */
+    0x26, 0xff, 0x00,           /* Logical Maximum (255) */
+    0x75, 0x08,                 /* Report Size (8) */
+    0x95, 0x01,                 /* Report Count (1) */
+    0x81, 0x02,                 /* Input (Data, Var, Abs) */
+    0xc0,                       /* End Collection */
+};
+
+TouchSynth::TouchSynth(int contacts) :
+    _contacts(contacts < 1 ? 1 : contacts > TOUCH_MAX_CONTACTS ? TOUCH_MAX_CONTACTS : contacts)
+{
+    _descriptor.insert(_descriptor.end(), SynthHeader, SynthHeader + sizeof(SynthHeader));
+    for (int i = 0; i < _contacts; i++)
+        _descriptor.insert(_descriptor.end(), SynthContact, SynthContact + sizeof(SynthContact));
+    _descriptor.insert(_descriptor.end(), SynthTrailer, SynthTrailer + sizeof(SynthTrailer));
+}
+
+size_t TouchSynth::reportSize() const
+{
+    return 1 + _contacts * SYNTH_CONTACT_SIZE + 1;
+}
+
+void TouchSynth::frameAt(uint64_t t, struct TouchFrame *frame) const
+{
+    double seconds = t / 1e9;
+
+    memset(frame, 0, sizeof(*frame));
+    frame->count = _contacts;
+    frame->contactCount = _contacts;
+
+    for (int i = 0; i < _contacts; i++) {
+        struct TouchContact *contact = &frame->contacts[i];
+        double cx = (i % 5 + 1) * (TOUCH_SYNTH_LOGICAL_MAX / 6.0);
+        double cy = (i / 5 + 1) * (TOUCH_SYNTH_LOGICAL_MAX / 3.0);
+        double radius = TOUCH_SYNTH_LOGICAL_MAX / 14.0;
+        double phase = seconds * (1.0 + 0.25 * i) * 2 * M_PI;
+
+        contact->id = i;
+        contact->x = (int)(cx + radius * cos(phase));
+        contact->y = (int)(cy + radius * sin(phase));
+        contact->flags = TOUCH_CONTACT_TIP | TOUCH_CONTACT_IN_RANGE;
+    }
+}
+
+size_t TouchSynth::encode(const struct TouchFrame *frame, uint8_t *report, size_t size) const
+{
+    size_t length = reportSize();
+    uint8_t *p = report;
+
+    if (size < length)
+        return 0;
+
+    memset(report, 0, length);
+    *p++ = TOUCH_SYNTH_REPORT_ID;
+
+    for (int i = 0; i < _contacts; i++, p += SYNTH_CONTACT_SIZE) {
+        if (i >= frame->count)
+            continue;
+        const struct TouchContact *contact = &frame->contacts[i];
+        p[0] = (contact->flags & TOUCH_CONTACT_TIP ? 0x1 : 0)
+             | (contact->flags & TOUCH_CONTACT_IN_RANGE ? 0x2 : 0);
+        p[1] = (uint8_t)contact->id;
+        p[2] = contact->x & 0xff;
+        p[3] = (contact->x >> 8) & 0xff;
+        p[4] = contact->y & 0xff;
+        p[5] = (contact->y >> 8) & 0xff;
+    }
+    *p = (uint8_t)(frame->count < _contacts ? frame->count : _contacts);
+
+    return length;
+}
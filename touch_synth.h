@@ -0,0 +1,41 @@
+#ifndef TOUCH_SYNTH_H
+#define TOUCH_SYNTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "touch_shared.h"
+
+#define TOUCH_SYNTH_REPORT_ID 1
+#define TOUCH_SYNTH_LOGICAL_MAX 32767
+
+/*
+ * Synthetic multitouch digitizer.
+ *
+ * Describes itself with a Windows-style touch screen report descriptor
+ * (one report carrying every contact plus the contact count) and moves
+ * its contacts along deterministic circles, so the same time always
+ * produces the same report.
+ */
+class TouchSynth
+{
+public:
+    explicit TouchSynth(int contacts);
+
+    int contacts() const { return _contacts; }
+    const std::vector<uint8_t> &descriptor() const { return _descriptor; }
+    size_t reportSize() const;
+
+    /* contact positions at time t, in logical units */
+    void frameAt(uint64_t t, struct TouchFrame *frame) const;
+
+    /* packs frame into a raw input report, returns its length */
+    size_t encode(const struct TouchFrame *frame, uint8_t *report, size_t size) const;
+
+private:
+    int _contacts;
+    std::vector<uint8_t> _descriptor;
+};
+
+#endif // TOUCH_SYNTH_H
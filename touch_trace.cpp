@@ -0,0 +1,244 @@
+#include "touch_trace.h"
+#include "touch_clock.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <vector>
+
+std::atomic<bool> gTouchTraceEnabled(false);
+
+/*
+ * One thread's ring. Only the owning thread writes records and head, the
+ * saver reads them from the side and drops whatever may have been
+ * overwritten while it copied. Records are only read below head, so they
+ * are left uninitialised.
+ */
+struct TouchTraceBuffer {
+    uint32_t thread;
+    std::atomic<uint64_t> head;
+    struct TouchTraceRecord records[TRACE_THREAD_RECORDS];
+
+    explicit TouchTraceBuffer(uint32_t t) : thread(t), head(0) {}
+};
+
+/*
+ * Buffers outlive their threads so a save still sees what they logged.
+ * When a thread exits its ring goes on the free list and the next thread
+ * to trace carries on writing into it, so a device thread restarted on
+ * every plug-in doesn't add a ring each time: there are never more rings
+ * than threads tracing at once.
+ */
+static std::mutex gBuffersLock;
+static std::vector<TouchTraceBuffer *> gBuffers;
+static std::vector<TouchTraceBuffer *> gFreeBuffers;
+
+static thread_local TouchTraceBuffer *tBuffer = 0;
+static thread_local bool tExited = false;
+
+/* hands the thread's ring back when the thread exits */
+struct TouchTraceOwner {
+    TouchTraceBuffer *buffer;
+
+    TouchTraceOwner() : buffer(0) {}
+    ~TouchTraceOwner() {
+        tBuffer = 0;
+        tExited = true;
+        if (buffer) {
+            std::lock_guard<std::mutex> lock(gBuffersLock);
+            gFreeBuffers.push_back(buffer);
+        }
+    }
+};
+
+static thread_local TouchTraceOwner tOwner;
+
+static TouchTraceBuffer *CreateBuffer()
+{
+    TouchTraceBuffer *buffer = 0;
+    {
+        std::lock_guard<std::mutex> lock(gBuffersLock);
+        if (!gFreeBuffers.empty()) {
+            buffer = gFreeBuffers.back();
+            gFreeBuffers.pop_back();
+        }
+        else {
+            buffer = new (std::nothrow) TouchTraceBuffer((uint32_t)gBuffers.size());
+            if (!buffer)
+                return 0;
+            gBuffers.push_back(buffer);
+        }
+    }
+
+    tOwner.buffer = buffer;
+    return buffer;
+}
+
+void touchTraceWrite(uint32_t event, uint32_t a, uint64_t b, uint64_t c)
+{
+    TouchTraceBuffer *buffer = tBuffer;
+    if (!buffer) {
+        /* a destructor tracing after the thread gave its ring back */
+        if (tExited)
+            return;
+        buffer = tBuffer = CreateBuffer();
+        if (!buffer)
+            return;
+    }
+
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    struct TouchTraceRecord *record = &buffer->records[head & (TRACE_THREAD_RECORDS - 1)];
+    record->time = touchMonotonicNs();
+    record->event = event;
+    record->a = a;
+    record->b = b;
+    record->c = c;
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void touchTraceEnable(bool enable)
+{
+    gTouchTraceEnabled.store(enable, std::memory_order_relaxed);
+}
+
+const char *touchTraceEventName(uint32_t event)
+{
+    static const char *const names[TraceEventCount] = {
+        "unknown", "hid element", "element added", "queue event", "report",
+        "raw report", "frame", "begin", "end", "layout cache",
+        "hot plug"
+    };
+    return event < TraceEventCount ? names[event] : names[0];
+}
+
+const char *touchTraceStageName(uint32_t stage)
+{
+    static const char *const names[TraceStageCount] = {
+        "device callback", "element decode", "frame assembly", "rasterize", "paint"
+    };
+    return stage < TraceStageCount ? names[stage] : "unknown";
+}
+
+/* the intact records of one thread, oldest first */
+struct TraceSnapshot {
+    uint32_t thread;
+    uint64_t lost;
+    std::vector<struct TouchTraceRecord> records;
+};
+
+static void TakeSnapshot(std::vector<TraceSnapshot> &snapshots)
+{
+    std::vector<TouchTraceBuffer *> buffers;
+    {
+        std::lock_guard<std::mutex> lock(gBuffersLock);
+        buffers = gBuffers;
+    }
+
+    snapshots.resize(buffers.size());
+    for (size_t i = 0; i < buffers.size(); i++) {
+        TouchTraceBuffer *buffer = buffers[i];
+        TraceSnapshot &snapshot = snapshots[i];
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t first = head > TRACE_THREAD_RECORDS ? head - TRACE_THREAD_RECORDS : 0;
+        snapshot.records.resize(head - first);
+        for (uint64_t seq = first; seq < head; seq++)
+            snapshot.records[seq - first] = buffer->records[seq & (TRACE_THREAD_RECORDS - 1)];
+
+        /* the owner kept writing meanwhile, the oldest copies may be torn */
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t now = buffer->head.load(std::memory_order_relaxed);
+        uint64_t valid = now > TRACE_THREAD_RECORDS ? now - TRACE_THREAD_RECORDS + 1 : 0;
+        uint64_t skip = valid > first ? std::min(valid - first, head - first) : 0;
+        snapshot.records.erase(snapshot.records.begin(), snapshot.records.begin() + skip);
+        snapshot.thread = buffer->thread;
+        snapshot.lost = first + skip;
+    }
+}
+
+bool touchTraceSave(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    std::vector<TraceSnapshot> snapshots;
+    TakeSnapshot(snapshots);
+
+    struct TouchTraceFileHeader header;
+    header.magic = TOUCH_TRACE_MAGIC;
+    header.version = TOUCH_TRACE_VERSION;
+    header.recordSize = sizeof(struct TouchTraceRecord);
+    header.threadCount = (uint32_t)snapshots.size();
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (size_t i = 0; i < snapshots.size() && ok; i++) {
+        struct TouchTraceThreadHeader thread;
+        thread.thread = snapshots[i].thread;
+        thread.count = (uint32_t)snapshots[i].records.size();
+        thread.lost = snapshots[i].lost;
+        ok = fwrite(&thread, sizeof(thread), 1, file) == 1
+                && fwrite(snapshots[i].records.data(), sizeof(struct TouchTraceRecord),
+                          thread.count, file) == thread.count;
+    }
+
+    return fclose(file) == 0 && ok;
+}
+
+/*
+ * Stages become duration events, everything else instant events carrying
+ * the raw values. Ends whose begin was overwritten are left out so the
+ * viewer doesn't close the wrong slice.
+ */
+bool touchTraceSaveChrome(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    std::vector<TraceSnapshot> snapshots;
+    TakeSnapshot(snapshots);
+
+    uint64_t start = ~0ull;
+    for (size_t i = 0; i < snapshots.size(); i++) {
+        if (!snapshots[i].records.empty())
+            start = std::min(start, snapshots[i].records[0].time);
+    }
+
+    int pid = (int)getpid();
+    const char *separator = "";
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < snapshots.size(); i++) {
+        const TraceSnapshot &snapshot = snapshots[i];
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+                "\"args\":{\"name\":\"thread %u\"}}", separator, pid, snapshot.thread, snapshot.thread);
+        separator = ",\n";
+
+        int depth = 0;
+        for (size_t k = 0; k < snapshot.records.size(); k++) {
+            const struct TouchTraceRecord &r = snapshot.records[k];
+            double ts = (r.time - start) / 1000.0;
+
+            if (r.event == TraceBegin || r.event == TraceEnd) {
+                if (r.event == TraceEnd && !depth)
+                    continue;
+                depth += r.event == TraceBegin ? 1 : -1;
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u}",
+                        touchTraceStageName(r.a), r.event == TraceBegin ? "B" : "E",
+                        ts, pid, snapshot.thread);
+            }
+            else {
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u,"
+                        "\"args\":{\"a\":%u,\"b\":%llu,\"c\":%llu}}",
+                        touchTraceEventName(r.event), ts, pid, snapshot.thread,
+                        r.a, (unsigned long long)r.b, (unsigned long long)r.c);
+            }
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,131 @@
+#ifndef TOUCH_TRACE_H
+#define TOUCH_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+/*
+ * Binary event log for the input path.
+ *
+ * Every thread that traces gets its own ring of fixed-size records, so
+ * writing one is a clock read and a few stores with no lock and no shared
+ * cache line. Rings wrap, keeping the newest TRACE_THREAD_RECORDS records
+ * of each thread. Nothing is formatted here: touchTraceSave() writes the
+ * raw records and tracedump/ turns them into text offline.
+ *
+ * Tracing is off by default and toggled at runtime; while it is off
+ * TOUCH_TRACE() costs one load and one well predicted branch.
+ *
+ * TOUCH_TRACE_SCOPE() brackets a pipeline stage with begin and end
+ * records, touchTraceSaveChrome() exports them as a Chrome trace that
+ * chrome://tracing or Perfetto show as a timeline.
+ */
+
+/* records kept per thread, a power of two */
+#define TRACE_THREAD_RECORDS 16384
+
+#define TOUCH_TRACE_MAGIC   0x43525454u     /* "TTRC" */
+#define TOUCH_TRACE_VERSION 1
+
+/* what a record is, the meaning of a, b and c is given per event */
+enum TouchTraceEvent {
+    TraceHidElement = 1,    /* a: page << 16 | usage, b: element type, c: value */
+    TraceElementAdded,      /* a: page << 16 | usage, b: element type, c: cookie */
+    TraceQueueEvent,        /* a: page << 16 | usage, b: cookie, c: value */
+    TraceReport,            /* a: report size, b: 1 if the layout decoded it */
+    TraceRawReport,         /* a: report size, b, c: the first 16 bytes */
+    TraceFrame,             /* a: contacts, b: device time, c: host time */
+    TraceBegin,             /* a: TouchTraceStage */
+    TraceEnd,               /* a: TouchTraceStage */
+    TraceLayoutCache,       /* a: 1 if the layout was cached, b: vid << 16 | pid, c: descriptor hash */
+    TraceHotPlug,           /* a: device id, b: 1 when plugged in, 0 when gone, c: vid << 16 | pid */
+    TraceEventCount
+};
+
+enum TouchTraceStage {
+    TraceStageDeviceCallback,   /* a HID callback or an evdev read */
+    TraceStageElementDecode,    /* one queued element into the assembler */
+    TraceStageFrameAssembly,    /* frames into the window's input ring */
+    TraceStageRasterize,        /* drained input into canvas tiles */
+    TraceStagePaint,            /* canvas tiles onto the window */
+    TraceStageCount
+};
+
+struct TouchTraceRecord {
+    uint64_t time;          /* touchMonotonicNs() */
+    uint32_t event;
+    uint32_t a;
+    uint64_t b;
+    uint64_t c;
+};
+
+/*
+ * Trace file layout, in host byte order:
+ *
+ *   TouchTraceFileHeader
+ *   { TouchTraceThreadHeader, TouchTraceRecord[thread.count] } ...
+ *
+ * Records of a thread are oldest first.
+ */
+struct TouchTraceFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t threadCount;
+};
+
+struct TouchTraceThreadHeader {
+    uint32_t thread;        /* in order of the first record, from 0 */
+    uint32_t count;
+    uint64_t lost;          /* older records overwritten by the ring */
+};
+
+extern std::atomic<bool> gTouchTraceEnabled;
+
+void touchTraceWrite(uint32_t event, uint32_t a, uint64_t b, uint64_t c);
+
+#define TOUCH_TRACE(event, a, b, c) \
+    do { \
+        if (__builtin_expect(gTouchTraceEnabled.load(std::memory_order_relaxed), 0)) \
+            touchTraceWrite((event), (uint32_t)(a), (uint64_t)(b), (uint64_t)(c)); \
+    } while (0)
+
+void touchTraceEnable(bool enable);
+inline bool touchTraceEnabled() { return gTouchTraceEnabled.load(std::memory_order_relaxed); }
+
+const char *touchTraceEventName(uint32_t event);
+const char *touchTraceStageName(uint32_t stage);
+
+/* a stage is only closed if tracing was on when it was opened */
+class TouchTraceScope
+{
+public:
+    explicit TouchTraceScope(TouchTraceStage stage) :
+        _stage(stage),
+        _active(touchTraceEnabled())
+    {
+        if (__builtin_expect(_active, 0))
+            touchTraceWrite(TraceBegin, _stage, 0, 0);
+    }
+
+    ~TouchTraceScope() {
+        if (__builtin_expect(_active, 0))
+            touchTraceWrite(TraceEnd, _stage, 0, 0);
+    }
+
+private:
+    TouchTraceStage _stage;
+    bool _active;
+};
+
+/* one per block */
+#define TOUCH_TRACE_SCOPE(stage) TouchTraceScope touchTraceScope(stage)
+
+/* writes what every thread has logged so far, false on failure */
+bool touchTraceSave(const char *path);
+/* the same as Chrome trace event JSON */
+bool touchTraceSaveChrome(const char *path);
+
+#endif // TOUCH_TRACE_H
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "touch_trace.h"
+
+struct Entry {
+    uint32_t thread;
+    struct TouchTraceRecord record;
+};
+
+static const char *elementTypeName(uint64_t type)
+{
+    switch (type) {
+        case 1:
+            return "MISC";
+        case 2:
+            return "Button";
+        case 3:
+            return "Axis";
+        case 4:
+            return "ScanCodes";
+        case 129:
+            return "Output";
+        case 257:
+            return "Feature";
+        case 513:
+            return "Collection";
+
+        default:
+            return "unknown";
+    }
+}
+
+static const char *usageName(uint32_t pageUsage)
+{
+    uint32_t page = pageUsage >> 16;
+    uint32_t usage = pageUsage & 0xffff;
+
+    if (page == 0x1) {
+        switch (usage) {
+            case 0x30:
+                return "x";
+            case 0x31:
+                return "y";
+        }
+    }
+    else if (page == 0x9 && usage == 1) {
+        return "button 1";
+    }
+    else if (page == 0xd) {
+        switch (usage) {
+            case 0x01:
+                return "digitizer";
+            case 0x02:
+                return "pen";
+            case 0x04:
+                return "touch screen";
+            case 0x20:
+                return "stylus";
+            case 0x22:
+                return "finger";
+            case 0x30:
+                return "pressure";
+            case 0x32:
+                return "in-range";
+            case 0x33:
+                return "touch";
+            case 0x42:
+                return "tip switch";
+            case 0x48:
+                return "width";
+            case 0x49:
+                return "height";
+            case 0x51:
+                return "contact identifier";
+            case 0x53:
+                return "device index";
+            case 0x54:
+                return "actual touch count";
+            case 0x55:
+                return "contact count maximum";
+        }
+    }
+    return "unknown";
+}
+
+static void print(const struct Entry &entry, uint64_t start)
+{
+    const struct TouchTraceRecord &r = entry.record;
+    printf("%12.3f us  thread %-3u ", (r.time - start) / 1000.0, entry.thread);
+
+    switch (r.event) {
+        case TraceHidElement:
+            printf("element     usage page %x usage %x type %s %s value 0x%x (%d)\n",
+                   r.a >> 16, r.a & 0xffff, elementTypeName(r.b), usageName(r.a),
+                   (unsigned)r.c, (int)r.c);
+            break;
+        case TraceElementAdded:
+            printf("added       usage page %x usage %x type %s %s cookie %llu\n",
+                   r.a >> 16, r.a & 0xffff, elementTypeName(r.b), usageName(r.a),
+                   (unsigned long long)r.c);
+            break;
+        case TraceQueueEvent:
+            printf("value       %s cookie %llu value %d\n",
+                   usageName(r.a), (unsigned long long)r.b, (int)r.c);
+            break;
+        case TraceReport:
+            printf("report      %u bytes%s\n", r.a, r.b ? "" : ", not decoded");
+            break;
+        case TraceRawReport: {
+            uint64_t head[2] = { r.b, r.c };
+            const uint8_t *bytes = (const uint8_t *)head;
+            printf("raw report  %u bytes:", r.a);
+            for (uint32_t i = 0; i < r.a && i < sizeof(head); i++)
+                printf(" %2.2x", bytes[i]);
+            printf("%s\n", r.a > sizeof(head) ? " ..." : "");
+            break;
+        }
+        case TraceFrame:
+            printf("frame       %u contacts device %.3f us host %.3f us\n", r.a,
+                   r.b ? (int64_t)(r.b - start) / 1000.0 : 0.0,
+                   r.c ? (int64_t)(r.c - start) / 1000.0 : 0.0);
+            break;
+
+        case TraceBegin:
+            printf("begin       %s\n", touchTraceStageName(r.a));
+            break;
+        case TraceEnd:
+            printf("end         %s\n", touchTraceStageName(r.a));
+            break;
+        case TraceLayoutCache:
+            printf("layout      %04llx:%04llx descriptor %016llx %s\n",
+                   (unsigned long long)(r.b >> 16), (unsigned long long)(r.b & 0xffff),
+                   (unsigned long long)r.c, r.a ? "cached" : "discovered");
+            break;
+        case TraceHotPlug:
+            printf("hot plug    device %u %04llx:%04llx %s\n", r.a,
+                   (unsigned long long)(r.c >> 16), (unsigned long long)(r.c & 0xffff),
+                   r.b ? "plugged in" : "gone");
+            break;
+
+        default:
+            printf("event %u    %u %llu %llu\n", r.event, r.a,
+                   (unsigned long long)r.b, (unsigned long long)r.c);
+            break;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s FILE\n  prints the records of a TouchTest --trace file in time order\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    struct TouchTraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TOUCH_TRACE_MAGIC
+            || header.version != TOUCH_TRACE_VERSION
+            || header.recordSize != sizeof(struct TouchTraceRecord)) {
+        fprintf(stderr, "%s is not a touch trace\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    std::vector<struct Entry> entries;
+    for (uint32_t t = 0; t < header.threadCount; t++) {
+        struct TouchTraceThreadHeader thread;
+        if (fread(&thread, sizeof(thread), 1, file) != 1)
+            break;
+        if (thread.lost)
+            fprintf(stderr, "thread %u: %llu older records were overwritten\n",
+                    thread.thread, (unsigned long long)thread.lost);
+
+        struct Entry entry;
+        entry.thread = thread.thread;
+        for (uint32_t i = 0; i < thread.count; i++) {
+            if (fread(&entry.record, sizeof(entry.record), 1, file) != 1)
+                break;
+            entries.push_back(entry);
+        }
+    }
+    fclose(file);
+
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.record.time < b.record.time;
+    });
+
+    uint64_t start = entries.empty() ? 0 : entries[0].record.time;
+    for (size_t i = 0; i < entries.size(); i++)
+        print(entries[i], start);
+    return 0;
+}
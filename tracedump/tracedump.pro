@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Formats the binary trace TouchTest --trace writes.
+# ./TouchTraceDump FILE
+#
+#-------------------------------------------------
+
+TARGET = TouchTraceDump
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+INCLUDEPATH += ..
+
+SOURCES += touch_tracedump.cpp \
+    ../touch_trace.cpp
+
+HEADERS += ../touch_clock.h \
+    ../touch_trace.h